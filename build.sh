@@ -169,13 +169,13 @@ build_dynv() {
 				"$CPATH"/aarch64-linux-android21-clang++ -o system/bin/dynv-$ABI dynv.cpp -std=c++17 -pthread \
 					-I./yaml-cpp/include \
 					-L./yaml-cpp/build/build-android-$ABI \
-					-lyaml-cpp \
+					-lyaml-cpp -lz \
 					-static-libgcc -static-libstdc++ -llog || return 1
 			elif [ "$ABI" == "armeabi-v7a" ]; then
 				"$CPATH"/armv7a-linux-androideabi21-clang++ -o system/bin/dynv-$ABI dynv.cpp -std=c++17 -pthread \
 					-I./yaml-cpp/include \
 					-L./yaml-cpp/build/build-android-$ABI \
-					-lyaml-cpp \
+					-lyaml-cpp -lz \
 					-static-libgcc -static-libstdc++ -llog || return 1
 			fi
 		done
@@ -187,13 +187,80 @@ build_dynv() {
 	fi
 }
 
+# Build dynv and the load generator for the Linux host, for profiling the
+# real loop with perf, valgrind or heaptrack and for tools/bench_suite.py.
+# Needs yaml-cpp and zlib development packages.
+# Run with: DYNV_ROOT=<tree> DYNV_LOG=stderr build/dynv-host --foreground
+build_dynv_host() {
+	local cxx="${CXX:-g++}"
+
+	echo "- Building dynv for host with $cxx"
+	mkdir -p build
+	"$cxx" -o build/dynv-host dynv.cpp -std=c++17 -pthread -O2 -g \
+		-lyaml-cpp -lz || {
+		echo "- Error: Failed to build host dynv."
+		exit 1
+	}
+	echo "- Host dynv built: build/dynv-host"
+
+	"$cxx" -o build/loadgen tools/loadgen.cpp -std=c++17 -O2 || {
+		echo "- Error: Failed to build loadgen."
+		exit 1
+	}
+	echo "- Load generator built: build/loadgen"
+}
+
+# Runs every /proc, sysfs and dumpsys parser over tools/parser_corpus; a
+# parser whose output changed fails the build. Built separately from the
+# daemon with DYNV_COUNT_ALLOCS, which counts heap allocations per parse.
+check_parsers() {
+	local cxx="${CXX:-g++}"
+
+	echo "- Building parser check with $cxx"
+	mkdir -p build
+	"$cxx" -o build/dynv-check dynv.cpp -std=c++17 -pthread -O2 \
+		-DDYNV_COUNT_ALLOCS -lyaml-cpp -lz || {
+		echo "- Error: Failed to build parser check."
+		exit 1
+	}
+	echo "- Checking parsers"
+	build/dynv-check --check-parsers tools/parser_corpus || {
+		echo "- Error: Parser output differs from tools/parser_corpus."
+		exit 1
+	}
+}
+
+# Resizes zram device $1 of this Linux host through dynv's resize path and
+# checks it swaps at each size; needs root and an unused device, e.g. after
+# modprobe zram num_devices=2.
+check_zram() {
+	build_dynv_host
+	echo "- Checking zram resize on zram$1"
+	build/dynv-host --check-zram "$1" || {
+		echo "- Error: zram resize check failed."
+		exit 1
+	}
+}
+
 # Parse arguments
-while getopts ":i:p" opt; do
+while getopts ":i:pHTZ:" opt; do
 	case "$opt" in
 	i) INSTALL=true ;; # Enable installation
 	p) PUSH_TO_PHONE=true ;; # Set tag to prod
+	H)
+		build_dynv_host
+		exit 0
+		;;
+	T)
+		check_parsers
+		exit 0
+		;;
+	Z)
+		check_zram "$OPTARG"
+		exit 0
+		;;
 	*)
-		echo "Usage: $0 [-i] [-p] <version> <versionCode>"
+		echo "Usage: $0 [-i] [-p] [-H] [-T] [-Z <zram number>] <version> <versionCode>"
 		exit 1
 		;;
 	esac
@@ -209,6 +276,7 @@ main() {
 
 	# Check if dynv.cpp changed before rebuilding
 	if should_rebuild_dynv; then
+		check_parsers
 		build_yaml-cpp
 		build_dynv
 	else
@@ -236,7 +304,7 @@ main() {
 	7za a -mx=9 -bd -y "$package_name" \
 		META-INF fmiop.sh customize.sh module.prop "*service.sh" \
 		uninstall.sh action.sh config.yaml \
-		system/bin tools >/dev/null 2>&1
+		system/bin tools '-xr!parser_corpus' >/dev/null 2>&1
 
 	if $INSTALL; then
 		check_root "You need ROOT to install this module" || su -c "magisk --install-module $package_name"
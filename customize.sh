@@ -171,6 +171,10 @@ update_config() {
 		printf '\n! Backup %s.old created\n' "$CONFIG_INTERNAL"
 		printf '  Config is located at %s \n' "$CONFIG_INTERNAL"
 	}
+
+	# Validate and precompile, so dynv starts without parsing YAML
+	"$MODPATH/system/bin/dynv" --compile-config "$CONFIG_FILE" >/dev/null ||
+		uprint "! Config check failed: $CONFIG_FILE"
 }
 
 update_tools() {
@@ -277,6 +281,7 @@ main() {
 		fix_mistakes
 	fi
 
+	kill_dynv
 	kill_all_pids
 	set_permissions
 	install_dynv
@@ -299,7 +304,7 @@ main() {
 		"$MODPATH/log_service.sh"
 		"$MODPATH/fmiop_service.sh"
 
-		kill -0 "$(read_pid fmiop.lmkd_loger.pid)" && uprint "$psi_started_msg"
+		pidof dynv >/dev/null && uprint "$psi_started_msg"
 		relmkd
 	fi
 
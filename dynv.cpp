@@ -1,66 +1,189 @@
+#ifdef __ANDROID__
 #include <android/log.h>
+#endif
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <syslog.h>
 #include <unistd.h>
 #include <yaml-cpp/yaml.h>
+#include <zlib.h>
 
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <cctype>
 #include <chrono>
+#include <climits>
+#include <condition_variable>
 #include <cmath>
 #include <csignal>
 #include <cstdarg>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
 #include <filesystem>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <numeric>
 #include <optional>
+#include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <type_traits>
 #include <unordered_set>
 #include <utility>
+#include <variant>
 #include <vector>
 
-#define SWAP_PROC_FILE "/proc/swaps"
-#define ZRAM_DIR "/dev/block"
-#define SWAP_DIR "/data/adb"
+// Older NDK headers predate these, the kernel ABI is stable.
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+#ifndef __NR_process_madvise
+#define __NR_process_madvise 440
+#endif
+#ifndef __NR_pidfd_send_signal
+#define __NR_pidfd_send_signal 424
+#endif
 
 using namespace std;
 using namespace chrono;
 namespace fs = filesystem;
 
-extern void save_pid(const string &filename, pid_t pid);
-extern void dyn_swap_service();
 extern void fmiop();
 
 atomic<bool> running(true);
 atomic<bool> is_swapoff_session{false};
 atomic<bool> sleeper_alive(false);
-vector<string> swapoff_tracker, active_swaps;
+vector<string> swapoff_tracker;
 mutex safe_thread_mutex;
-pair<vector<string>, vector<string>> available_swaps;
-const string fmiop_dir = "/sdcard/Android/fmiop";
-const string NVBASE = "/data/adb";
+
+/**
+ * Every system path is resolved under DYNV_ROOT when it is set, so dynv can
+ * run against a synthetic /proc, /sys and /data tree on a Linux host.
+ */
+const string ROOT = getenv("DYNV_ROOT") ? getenv("DYNV_ROOT") : "";
+
+string root_path(const string &path) { return ROOT + path; }
+
+#ifdef __ANDROID__
+const string SYSTEM_BIN = "/system/bin/";
+#else
+const string SYSTEM_BIN = "";  // Resolved through PATH
+#endif
+const string SHELL = SYSTEM_BIN.empty() ? "/bin/sh" : SYSTEM_BIN + "sh";
+
+const string SWAP_PROC_FILE = root_path("/proc/swaps");
+const string ZRAM_DIR = root_path("/dev/block");
+const string SWAP_DIR = root_path("/data/adb");
+const string ZRAM_SYSFS_DIR = root_path("/sys/block");
+const string fmiop_dir = root_path("/sdcard/Android/fmiop");
+const string NVBASE = root_path("/data/adb");
 const string LOG_FOLDER = NVBASE + "/fmiop";
-const string PIDS_DB = LOG_FOLDER + "/fmiop" + ".pids";
 const string SWAP_FILE_PREFIX = "fmiop_swap.";
-const string DEFAULT_CONFIG = "/data/adb/fmiop/config.yaml";
+const string DEFAULT_CONFIG = LOG_FOLDER + "/config.yaml";
+const string CONFIG_CACHE = LOG_FOLDER + "/config.bin";
+const string STATE_FILE = LOG_FOLDER + "/dynv.state";
+const string JOURNAL_FILE = LOG_FOLDER + "/dynv.journal";
+const string LOCK_FILE = LOG_FOLDER + "/dynv.lock";
+const string MODULE_PROP = NVBASE + "/modules/fmiop/module.prop";
 
 enum class LogType { ALWAYS, QUIET, ONCE };
-enum class LogPriority {
-  DEBUG = ANDROID_LOG_DEBUG,
-  INFO = ANDROID_LOG_INFO,
-  WARNING = ANDROID_LOG_WARN,
-  ERROR = ANDROID_LOG_ERROR
-};
+// Same values as android_LogPriority
+enum class LogPriority { DEBUG = 3, INFO = 4, WARNING = 5, ERROR = 6 };
 #define LOG_TAG "fmiop"
 
+/**
+ * Where log lines go: logd on Android, stderr or syslog elsewhere. Chosen
+ * with DYNV_LOG=logd|stderr|syslog.
+ */
+class LogBackend {
+ public:
+  virtual ~LogBackend() = default;
+  virtual void write(LogPriority level, const char *message) = 0;
+
+  static unique_ptr<LogBackend> create();
+};
+
+#ifdef __ANDROID__
+class LogdBackend : public LogBackend {
+ public:
+  void write(LogPriority level, const char *message) override {
+    __android_log_write(static_cast<int>(level), LOG_TAG, message);
+  }
+};
+#endif
+
+class StderrBackend : public LogBackend {
+ public:
+  void write(LogPriority level, const char *message) override {
+    static const char letters[] = "??VDIWEF";
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    tm local;
+    localtime_r(&ts.tv_sec, &local);
+    char time[32];
+    strftime(time, sizeof(time), "%m-%d %H:%M:%S", &local);
+    fprintf(stderr, "%s.%03ld %c/%s(%d): %s\n", time, ts.tv_nsec / 1000000,
+            letters[static_cast<int>(level)], LOG_TAG, getpid(), message);
+  }
+};
+
+class SyslogBackend : public LogBackend {
+ public:
+  SyslogBackend() { openlog(LOG_TAG, LOG_PID, LOG_DAEMON); }
+  ~SyslogBackend() override { closelog(); }
+
+  void write(LogPriority level, const char *message) override {
+    static const int priorities[] = {LOG_DEBUG, LOG_INFO, LOG_WARNING,
+                                     LOG_ERR};
+    syslog(priorities[static_cast<int>(level) - 3], "%s", message);
+  }
+};
+
+unique_ptr<LogBackend> LogBackend::create() {
+  const char *env = getenv("DYNV_LOG");
+  string name = env ? env : "";
+  if (name == "stderr") return make_unique<StderrBackend>();
+  if (name == "syslog") return make_unique<SyslogBackend>();
+#ifdef __ANDROID__
+  return make_unique<LogdBackend>();
+#else
+  return make_unique<StderrBackend>();
+#endif
+}
+
 /**
  * Converts any type to string using stringstream.
  */
@@ -91,33 +214,52 @@ class LogManager {
    * @param args Arguments to be formatted into the log message.
    */
   template <typename... Args>
-  void log(LogType type, LogPriority level, const string &key,
+  void log(LogType type, LogPriority level, string_view key,
            const char *format, Args... args) {
     if (type == LogType::QUIET) return;
 
+    lock_guard<mutex> guard(lock);
     if (type == LogType::ONCE && once_logged.find(key) != once_logged.end()) {
       return;
     }
 
-    __android_log_print(static_cast<int>(level), LOG_TAG, format, args...);
+    char message[1024];
+    snprintf(message, sizeof(message), format, args...);
+    backend->write(level, message);
 
     if (type == LogType::ONCE) {
-      once_logged.insert(key);
+      once_logged.emplace(key);
     }
   }
 
   // Overloaded function with default parameters
   template <typename... Args>
-  void log(const string &key, const char *format, Args... args) {
+  void log(string_view key, const char *format, Args... args) {
     log(key, LogType::ALWAYS, LogPriority::INFO, format, args...);
   }
 
-  void reset(const string &key) { once_logged.erase(key); }
+  bool logged(string_view key) {
+    lock_guard<mutex> guard(lock);
+    return once_logged.find(key) != once_logged.end();
+  }
+
+  void reset(string_view key) {
+    lock_guard<mutex> guard(lock);
+    auto found = once_logged.find(key);
+    if (found != once_logged.end()) once_logged.erase(found);
+  }
 
-  void reset_all() { once_logged.clear(); }
+  void reset_all() {
+    lock_guard<mutex> guard(lock);
+    once_logged.clear();
+  }
 
  private:
-  unordered_set<string> once_logged;
+  unique_ptr<LogBackend> backend = LogBackend::create();
+  mutex lock;
+  // Ordered with a transparent compare, so the control loop's keys are
+  // looked up as string_views without building a string each tick
+  set<string, less<>> once_logged;
 };
 
 static LogManager log_manager;
@@ -153,19 +295,22 @@ static LogManager log_manager;
 #define ALOG_RESET(key) log_manager.reset(key)
 
 /**
- * Reads a value from a YAML config file with a default fallback.
+ * Reads a value from the loaded config with a default fallback.
  */
 template <typename T>
-T read_config(const string &key_path, T default_value) {
+T read_config(const YAML::Node &root, const string &key_path,
+              T default_value) {
   try {
-    YAML::Node node = YAML::LoadFile(DEFAULT_CONFIG);
+    // reset() rebinds; assigning would write into the shared tree
+    YAML::Node node;
+    node.reset(root);
     size_t pos = 0, found;
     string clean_key_path =
         (key_path[0] == '.') ? key_path.substr(1) : key_path;
 
     while ((found = clean_key_path.find('.', pos)) != string::npos) {
       string key = clean_key_path.substr(pos, found - pos);
-      node = node[key];
+      node.reset(as_const(node)[key]);
 
       if (!node) {
         ALOGW("Config key not found: %s. Using default: %s", key_path.c_str(),
@@ -176,7 +321,7 @@ T read_config(const string &key_path, T default_value) {
     }
 
     string finalKey = clean_key_path.substr(pos);
-    node = node[finalKey];
+    node.reset(as_const(node)[finalKey]);
 
     if (!node) {
       ALOGW("Config key not found: %s. Using default: %s", key_path.c_str(),
@@ -194,6 +339,244 @@ T read_config(const string &key_path, T default_value) {
   }
 }
 
+/**
+ * config.yaml compiled by `dynv --compile-config`: the typed config
+ * sections written out field by field through their fields() methods, so
+ * a start from the cache neither scans YAML nor builds a node tree. The
+ * size and mtime of the source and of the dynv binary are recorded; a
+ * cache that doesn't match them is stale, which also covers an update that
+ * changed the fields of a section.
+ */
+constexpr char CONFIG_CACHE_MAGIC[4] = {'F', 'M', 'C', 'B'};
+constexpr uint32_t CONFIG_CACHE_VERSION = 2;
+
+struct ConfigCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t source_size;
+  int64_t source_mtime_ns;
+  uint64_t binary_size;
+  int64_t binary_mtime_ns;
+  uint32_t payload_bytes;
+  uint32_t checksum;  // crc32 of the payload
+};
+
+static_assert(sizeof(ConfigCacheHeader) == 48, "cache header layout");
+
+bool file_identity(const string &path, uint64_t &size, int64_t &mtime_ns) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return false;
+  size = st.st_size;
+  mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  return true;
+}
+
+bool config_cache_identity(const string &source, ConfigCacheHeader &header) {
+  memcpy(header.magic, CONFIG_CACHE_MAGIC, sizeof(header.magic));
+  header.version = CONFIG_CACHE_VERSION;
+  return file_identity(source, header.source_size, header.source_mtime_ns) &&
+         file_identity("/proc/self/exe", header.binary_size,
+                       header.binary_mtime_ns);
+}
+
+/**
+ * Appends fields in host byte order: numbers and enums as they are in
+ * memory, strings and vectors with a 32-bit length first.
+ */
+class ConfigWriter {
+ public:
+  string bytes;
+
+  template <class... T>
+  void operator()(const T &...values) {
+    (put(values), ...);
+  }
+
+ private:
+  template <class T>
+  void put(const T &value) {
+    if constexpr (is_arithmetic_v<T> || is_enum_v<T>) {
+      bytes.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    } else {
+      // fields() only reads its members through a writer
+      const_cast<T &>(value).fields(*this);
+    }
+  }
+
+  void put(const string &value) {
+    put(static_cast<uint32_t>(value.size()));
+    bytes.append(value);
+  }
+
+  template <class T>
+  void put(const vector<T> &values) {
+    put(static_cast<uint32_t>(values.size()));
+    for (const auto &value : values) put(value);
+  }
+
+  template <class A, class B>
+  void put(const pair<A, B> &value) {
+    put(value.first);
+    put(value.second);
+  }
+
+  template <class T, size_t N>
+  void put(const array<T, N> &values) {
+    for (const auto &value : values) put(value);
+  }
+};
+
+/**
+ * Reads back what ConfigWriter wrote. Never reads past the end; ok turns
+ * false instead and the rest of the fields are left alone.
+ */
+class ConfigReader {
+ public:
+  ConfigReader(const char *data, size_t size) : pos(data), end(data + size) {}
+
+  bool ok = true;
+
+  template <class... T>
+  void operator()(T &...values) {
+    (get(values), ...);
+  }
+
+  bool done() const { return ok && pos == end; }
+
+ private:
+  const char *pos;
+  const char *end;
+
+  bool take(void *out, size_t size) {
+    if (!ok || static_cast<size_t>(end - pos) < size) return ok = false;
+    memcpy(out, pos, size);
+    pos += size;
+    return true;
+  }
+
+  // A length can't be larger than the bytes left, whatever it counts
+  bool length(uint32_t &size) {
+    if (!take(&size, sizeof(size))) return false;
+    if (size > static_cast<size_t>(end - pos)) return ok = false;
+    return true;
+  }
+
+  template <class T>
+  void get(T &value) {
+    if constexpr (is_arithmetic_v<T> || is_enum_v<T>) {
+      take(&value, sizeof(value));
+    } else {
+      value.fields(*this);
+    }
+  }
+
+  void get(string &value) {
+    uint32_t size;
+    if (!length(size)) return;
+    value.assign(pos, size);
+    pos += size;
+  }
+
+  template <class T>
+  void get(vector<T> &values) {
+    uint32_t size;
+    if (!length(size)) return;
+    values.assign(size, T());
+    for (auto &value : values) {
+      if (!ok) return;
+      get(value);
+    }
+  }
+
+  template <class A, class B>
+  void get(pair<A, B> &value) {
+    get(value.first);
+    get(value.second);
+  }
+
+  template <class T, size_t N>
+  void get(array<T, N> &values) {
+    for (auto &value : values) get(value);
+  }
+};
+
+/**
+ * Writes the compiled form of config for source to path, atomically.
+ */
+template <class T>
+bool write_config_cache(const T &config, const string &source,
+                        const string &path) {
+  ConfigCacheHeader header{};
+  if (!config_cache_identity(source, header)) return false;
+
+  ConfigWriter writer;
+  writer(config);
+  header.payload_bytes = writer.bytes.size();
+  header.checksum =
+      ::crc32(0L, reinterpret_cast<const Bytef *>(writer.bytes.data()),
+              writer.bytes.size());
+
+  string tmp = path + ".tmp." + to_string(syscall(SYS_gettid));
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  iovec parts[] = {{&header, sizeof(header)},
+                   {writer.bytes.data(), writer.bytes.size()}};
+  ssize_t expected = sizeof(header) + writer.bytes.size();
+  bool ok = writev(fd, parts, 2) == expected && fsync(fd) == 0;
+  close(fd);
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Loads the compiled config into config. False when the cache is missing,
+ * stale or damaged, config is untouched then and the caller parses the
+ * source instead.
+ */
+template <class T>
+bool read_config_cache(const string &source, const string &path, T &config) {
+  ConfigCacheHeader current{};
+  if (!config_cache_identity(source, current)) return false;
+
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      st.st_size < static_cast<off_t>(sizeof(ConfigCacheHeader))) {
+    close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+
+  const auto *header = static_cast<const ConfigCacheHeader *>(map);
+  const char *payload = reinterpret_cast<const char *>(header + 1);
+  bool ok =
+      memcmp(header->magic, current.magic, sizeof(current.magic)) == 0 &&
+      header->version == current.version &&
+      header->source_size == current.source_size &&
+      header->source_mtime_ns == current.source_mtime_ns &&
+      header->binary_size == current.binary_size &&
+      header->binary_mtime_ns == current.binary_mtime_ns &&
+      sizeof(ConfigCacheHeader) + header->payload_bytes == size &&
+      ::crc32(0L, reinterpret_cast<const Bytef *>(payload),
+              header->payload_bytes) == header->checksum;
+  if (ok) {
+    T loaded;
+    ConfigReader reader(payload, header->payload_bytes);
+    reader(loaded);
+    ok = reader.done();
+    if (ok) config = move(loaded);
+  }
+  munmap(map, size);
+  return ok;
+}
+
 vector<pair<int, int>> parse_pressure_pairs(const YAML::Node &node) {
   vector<pair<int, int>> result;
   if (!node || !node.IsSequence()) return result;
@@ -212,7 +595,7 @@ vector<pair<int, int>> parse_pressure_pairs(const YAML::Node &node) {
  * Reads the current swappiness value from the system.
  */
 int read_swappiness() {
-  ifstream file("/proc/sys/vm/swappiness");
+  ifstream file(root_path("/proc/sys/vm/swappiness"));
   int swappiness;
   if (file >> swappiness) {
     return swappiness;
@@ -221,373 +604,470 @@ int read_swappiness() {
 }
 
 /**
- * Writes a new swappiness value to the system.
+ * Writes integer values to a sysctl/sysfs file through a cached fd, skipping
+ * the write when the value did not change since the last successful write.
  */
-void write_swappiness(int value) {
-  ofstream file("/proc/sys/vm/swappiness");
-  if (!file) {
-    ALOGE(
-        "Error: Unable to write to /proc/sys/vm/swappiness. Check "
-        "permission.");
-    return;
+class SysctlWriter {
+ public:
+  explicit SysctlWriter(string path) : path(std::move(path)) {}
+  SysctlWriter(const SysctlWriter &) = delete;
+  SysctlWriter &operator=(const SysctlWriter &) = delete;
+  SysctlWriter(SysctlWriter &&other) noexcept
+      : path(std::move(other.path)), fd(other.fd), last(other.last) {
+    other.fd = -1;
   }
-  file << value;
-}
-
-/**
- * Reads a specific pressure metric from /proc/pressure/<resource>.
- */
-double read_pressure(const string &resource, const string &level,
-                     const string &key) {
-  string file_path = "/proc/pressure/" + resource;
-  ifstream file(file_path);
-
-  if (!file.is_open()) {
-    ALOGE("Error: Unable to open %s", file_path.c_str());
-    return nan("");
+  ~SysctlWriter() {
+    if (fd >= 0) close(fd);
   }
 
-  string line;
-  while (getline(file, line)) {
-    istringstream iss(line);
-    string word;
-    iss >> word;
-
-    if (word == level) {
-      string metric;
-      while (iss >> metric) {
-        size_t pos = metric.find('=');
-        if (pos != string::npos) {
-          string metric_key = metric.substr(0, pos);
-          string metric_value = metric.substr(pos + 1);
+  /**
+   * @return True if the value was written, false if unchanged or on error.
+   */
+  bool write(long value) {
+    if (value == last) return false;
+    if (fd < 0) fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+      ALOGE("Error: Unable to write to %s. Check permission.", path.c_str());
+      return false;
+    }
 
-          if (metric_key == key) {
-            return stod(metric_value);
-          }
-        }
-      }
+    char buf[24];
+    int len = snprintf(buf, sizeof(buf), "%ld", value);
+    if (pwrite(fd, buf, len, 0) != len) {
+      ALOGE("Error: Writing %ld to %s failed: %s", value, path.c_str(),
+            strerror(errno));
+      close(fd);
+      fd = -1;
+      return false;
     }
+    last = value;
+    return true;
   }
 
-  ALOGE("Key: %s not found.", key.c_str());
-  return nan("");
-}
+  const string &get_path() const { return path; }
+
+ private:
+  string path;
+  int fd = -1;
+  long last = LONG_MIN;
+};
 
 /**
- * Handles termination signals.
+ * Writes a new swappiness value to the system.
  */
-void signal_handler(int signal) {
-  ALOGI("Received signal %d, exiting...", signal);
-  running = false;
-  _Exit(signal);
+void write_swappiness(int value) {
+  static SysctlWriter writer(root_path("/proc/sys/vm/swappiness"));
+  writer.write(value);
 }
 
-/**
- * Saves a PID to a file (PID_DB) with a given name.
- * If the name already exists, it is replaced.
- *
- * @param pid_name The name associated with the PID.
- * @param pid_value The PID to be saved.
- */
-void save_pid(const string &pid_name, int pid_value) {
-  vector<string> lines;
-  string line;
-  bool found = false;
-
-  // Open the PID_DB file for reading.
-  ifstream infile(PIDS_DB);
-  if (infile) {
-    while (getline(infile, line)) {
-      // Check if the line starts with "pid_name="
-      if (line.compare(0, pid_name.size() + 1, pid_name + "=") != 0) {
-        lines.push_back(line);
-      } else {
-        found = true;
-      }
-    }
-    infile.close();
-  }
+enum class PsiResource { CPU, MEMORY, IO };
+constexpr int PSI_MAX_WINDOWS = 8;
+constexpr int PSI_RING_SIZE = 512;
+// Ring entries are at least a control tick apart, which bounds the windows
+constexpr int64_t PSI_MIN_WINDOW_US = 1000000;
+constexpr int64_t PSI_MAX_WINDOW_US = (PSI_RING_SIZE - 1) * PSI_MIN_WINDOW_US;
 
-  // Append the new PID entry.
-  lines.push_back(pid_name + "=" + to_string(pid_value));
+/**
+ * Where a consumer reads its pressure from: one of the kernel averages, or a
+ * window computed from the total= stall counters.
+ */
+struct PsiSource {
+  PsiResource resource = PsiResource::MEMORY;
+  int level = 0;   // 0 = some, 1 = full
+  int avg = 1;     // avg10/avg60/avg300 index, -1 for a total window
+  int window = -1; // Window id registered in PsiSampler
+};
 
-  // Open PID_DB for writing (this overwrites the file).
-  ofstream outfile(PIDS_DB);
-  if (!outfile) {
-    ALOGE("Error: Unable to open %s for writing.", PIDS_DB.c_str());
-    return;
+/**
+ * One reading of every PSI resource, taken once per tick and shared by every
+ * consumer of pressure.
+ */
+struct PsiSample {
+  static constexpr const char *resources[] = {"cpu", "memory", "io"};
+  static constexpr const char *windows[] = {"avg10", "avg60", "avg300"};
+
+  double avg[3][2][3];  // [resource][some/full][avg10/avg60/avg300]
+  uint64_t total[3][2];  // Stall time in microseconds
+  bool has_full[3];
+  double window_values[PSI_MAX_WINDOWS][3][2];
+  int64_t time_us;
+  bool valid = false;
+
+  static int window_index(const string &window) {
+    for (int i = 0; i < 3; ++i) {
+      if (window == windows[i]) return i;
+    }
+    return 1;
   }
 
-  for (const auto &l : lines) {
-    outfile << l << "\n";
+  double get(PsiResource resource, const string &window) const {
+    return valid ? avg[static_cast<int>(resource)][0][window_index(window)]
+                 : nan("");
   }
-  outfile.close();
 
-  ALOGD("Saved PID %d for %s %s", pid_value, pid_name.c_str(),
-        found ? "(Updated)" : "(New)");
-}
+  double get(const PsiSource &source) const {
+    if (!valid) return nan("");
 
-// Function to get the smallest priority of active ZRAM swaps
-int get_smlst_priority() {
-  ifstream file(SWAP_PROC_FILE);
-  if (!file) {
-    ALOGE("Error: Unable to open %s", SWAP_PROC_FILE);
-    return -1;
+    int r = static_cast<int>(source.resource);
+    int level = (source.level == 1 && has_full[r]) ? 1 : 0;
+    return source.avg >= 0 ? avg[r][level][source.avg]
+                           : window_values[source.window][r][level];
   }
+};
 
-  string line;
-  vector<int> priorities;
-
-  // Skip the first line (header)
-  getline(file, line);
-
-  while (getline(file, line)) {
-    istringstream iss(line);
-    string device;
-    int priority;
-    string temp;
-
-    // Extract values: device name is first, priority is the 5th column
-    for (int i = 0; i < 5; ++i) {
-      if (!(iss >> temp)) {
-        break;
-      }
-      if (i == 0) {
-        device = temp;
-      } else if (i == 4) {
-        priority = stoi(temp);
-      }
+/**
+ * Parses the content of a /proc/pressure/<resource> file. The full line is
+ * optional, cpu has it only since 5.13.
+ *
+ * @return False if the some line is missing or malformed.
+ */
+bool parse_psi(const char *buf, double avg[2][3], uint64_t total[2],
+               bool &has_full) {
+  has_full = false;
+  bool has_some = false;
+
+  for (const char *line = buf; line && *line;) {
+    int level = strncmp(line, "some ", 5) == 0   ? 0
+                : strncmp(line, "full ", 5) == 0 ? 1
+                                                 : -1;
+    unsigned long long stall;
+    if (level >= 0 &&
+        sscanf(line + 5, "avg10=%lf avg60=%lf avg300=%lf total=%llu",
+               &avg[level][0], &avg[level][1], &avg[level][2], &stall) == 4) {
+      total[level] = stall;
+      (level == 0 ? has_some : has_full) = true;
     }
 
-    priorities.push_back(priority);
+    line = strchr(line, '\n');
+    if (line) line++;
   }
 
-  if (priorities.empty()) {
-    ALOGW("No active swaps found.");
-    return 32767;
+  if (!has_full) {
+    memcpy(avg[1], avg[0], sizeof(avg[0]));
+    total[1] = total[0];
   }
-
-  return *min_element(priorities.begin(), priorities.end());
+  return has_some;
 }
 
-// Function to check if a ZRAM device is active
-bool is_active(const string &device) {
-  ifstream file(SWAP_PROC_FILE);
-  if (!file) {
-    ALOGE("Error: Unable to open %s", SWAP_PROC_FILE);
-    return false;
+/**
+ * Samples PSI once per tick and computes exact pressure over arbitrary
+ * windows from a ring of total= counters. Each window keeps a tail into the
+ * ring that only moves forward, so a tick costs O(1) per window.
+ */
+class PsiSampler {
+ public:
+  PsiSampler() {
+    for (auto &fd : fds) fd = -1;
   }
 
-  string line;
-  while (getline(file, line)) {
-    if (line.find(device) != string::npos) {
-      return true;
+  /**
+   * Resolves a config time_window ("avg10", "avg60", "avg300", "2s",
+   * "500ms") and level ("some", "full") into a source, registering a new
+   * total window if needed.
+   */
+  PsiSource resolve(PsiResource resource, const string &time_window,
+                    const string &level = "some") {
+    PsiSource source;
+    source.resource = resource;
+    source.level = level == "full" ? 1 : 0;
+
+    if (time_window.compare(0, 3, "avg") == 0) {
+      source.avg = PsiSample::window_index(time_window);
+      return source;
     }
-  }
-  return false;
-}
 
-pair<vector<string>, vector<string>> get_available_swap() {
-  vector<string> swap_files, zram_devices;
-  vector<string> dir_list = {SWAP_DIR, ZRAM_DIR};
-
-  for (const auto &dir : dir_list) {
-    if (!fs::exists(dir)) {
-      ALOGW("Directory does not exist: %s", dir.c_str());
-      continue;
+    char *end;
+    long length = strtol(time_window.c_str(), &end, 10);
+    string unit = end;
+    int64_t length_us = unit == "ms"  ? length * 1000L
+                        : unit == "s" ? length * 1000000L
+                                      : -1;
+    if (length <= 0 || length_us < 0) {
+      ALOGW("Invalid PSI time_window: %s. Using avg60.", time_window.c_str());
+      source.avg = 1;
+      return source;
     }
-    if (!fs::is_directory(dir)) {
-      ALOGW("Path is not a directory: %s", dir.c_str());
-      continue;
+    if (length_us < PSI_MIN_WINDOW_US || length_us > PSI_MAX_WINDOW_US) {
+      int64_t clamped =
+          clamp(length_us, PSI_MIN_WINDOW_US, PSI_MAX_WINDOW_US);
+      ALOGW("PSI time_window %s is outside %llds to %llds, using %llds.",
+            time_window.c_str(),
+            static_cast<long long>(PSI_MIN_WINDOW_US / 1000000),
+            static_cast<long long>(PSI_MAX_WINDOW_US / 1000000),
+            static_cast<long long>(clamped / 1000000));
+      length_us = clamped;
     }
 
-    for (const auto &entry : fs::directory_iterator(dir)) {
-      bool swap_found = false;
-
-      if (entry.is_directory()) continue;
+    source.avg = -1;
+    source.window = add_window(length_us);
+    if (source.window < 0) {
+      ALOGW("Too many PSI windows, %s falls back to avg10.",
+            time_window.c_str());
+      source.avg = 0;
+    }
+    return source;
+  }
 
-      string pathStr = entry.path().string();
-      if (is_active(pathStr)) {
-        ALOGI("ACTIVE SWAP detected: %s", pathStr.c_str());
-      } else {
-        if (pathStr.find("swap") != string::npos) {
-          swap_files.push_back(pathStr);
-          swap_found = true;
-        } else if (pathStr.find("zram") != string::npos) {
-          zram_devices.push_back(pathStr);
-          swap_found = true;
-        }
+  int windows_used() const { return window_count; }
+  int64_t window_length(int window) const {
+    return windows[window].length_us;
+  }
 
-        if (swap_found) {
-          ALOGD("INACTIVE SWAP found: %s", pathStr.c_str());
-        }
+  PsiSample sample() {
+    PsiSample sample;
+    sample.valid = true;
+    sample.time_us = duration_cast<microseconds>(
+                         steady_clock::now().time_since_epoch())
+                         .count();
+
+    for (int r = 0; r < 3; ++r) {
+      if (!read_resource(r, sample)) {
+        sample.valid = false;
+        return sample;
       }
     }
+
+    push(sample);
+    return sample;
   }
 
-  // ✅ **Sorting logic**
-  auto extract_number = [](const string &s) -> int {
-    size_t pos = s.find_last_not_of("0123456789");
-    return (pos != string::npos) ? stoi(s.substr(pos + 1)) : -1;
+ private:
+  struct Entry {
+    int64_t time_us;
+    uint64_t total[3][2];
+  };
+  struct Window {
+    int64_t length_us;
+    uint64_t tail;  // Sequence number of the oldest entry in the window
   };
 
-  sort(swap_files.begin(), swap_files.end(),
-       [&](const string &a, const string &b) {
-         return extract_number(a) > extract_number(b);
-       });
-
-  sort(zram_devices.begin(), zram_devices.end(),
-       [&](const string &a, const string &b) {
-         return extract_number(a) > extract_number(b);
-       });
-
-  // ✅ **Combine them: swap first, then zram**
-  vector<string> available_swaps;
-  available_swaps.insert(available_swaps.end(), swap_files.begin(),
-                         swap_files.end());
-  available_swaps.insert(available_swaps.end(), zram_devices.begin(),
-                         zram_devices.end());
-
-  for (const auto &swap : available_swaps) {
-    ALOGD("Available SWAP: %s", swap.c_str());
-  }
-
-  return {zram_devices, swap_files};
-}
+  int fds[3];
+  array<Entry, PSI_RING_SIZE> ring;
+  uint64_t next_seq = 0;
+  Window windows[PSI_MAX_WINDOWS];
+  int window_count = 0;
 
-vector<string> get_active_swap() {
-  string line;
-  vector<pair<string, long>> swaps;  // Store (device, usage)
-  ifstream file(SWAP_PROC_FILE);
+  int add_window(int64_t length_us) {
+    for (int i = 0; i < window_count; ++i) {
+      if (windows[i].length_us == length_us) return i;
+    }
+    if (window_count == PSI_MAX_WINDOWS) return -1;
 
-  if (!file) {
-    ALOGE("Error: Unable to open %s", SWAP_PROC_FILE);
-    return {};  // Return empty if file can't be opened
+    windows[window_count] = {length_us, 0};
+    return window_count++;
   }
 
-  // Skip header
-  getline(file, line);
-
-  while (getline(file, line)) {
-    istringstream iss(line);
-    string device;
-    long size, used;  // We only care about "used"
-    iss >> device >> size >> used;
+  bool read_resource(int r, PsiSample &sample) {
+    if (fds[r] < 0) {
+      string path = root_path("/proc/pressure/") + PsiSample::resources[r];
+      fds[r] = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fds[r] < 0) return false;
+    }
 
-    if (!device.empty()) {
-      swaps.emplace_back(device, used);
+    char buf[256];
+    ssize_t len = pread(fds[r], buf, sizeof(buf) - 1, 0);
+    if (len <= 0) {
+      close(fds[r]);
+      fds[r] = -1;
+      return false;
     }
+    buf[len] = '\0';
+    return parse_psi(buf, sample.avg[r], sample.total[r], sample.has_full[r]);
   }
 
-  // Sort swaps by usage (descending order)
-  sort(swaps.begin(), swaps.end(),
-       [](const pair<string, long> &a, const pair<string, long> &b) {
-         return a.second > b.second;  // Biggest usage first
-       });
+  void push(PsiSample &sample) {
+    // Early wakeups sample more often than once a tick; only stored a tick
+    // apart, the ring keeps spanning PSI_MAX_WINDOW_US
+    const Entry &newest = ring[(next_seq - 1) % PSI_RING_SIZE];
+    if (next_seq == 0 || sample.time_us - newest.time_us >= PSI_MIN_WINDOW_US) {
+      Entry &entry = ring[next_seq++ % PSI_RING_SIZE];
+      entry.time_us = sample.time_us;
+      memcpy(entry.total, sample.total, sizeof(entry.total));
+    }
 
-  // Extract sorted device names
-  vector<string> active_swaps;
-  for (const auto &swap : swaps) {
-    active_swaps.push_back(swap.first);
-  }
+    uint64_t oldest =
+        next_seq > PSI_RING_SIZE ? next_seq - PSI_RING_SIZE : 0;
 
-  return active_swaps;
-}
+    for (int w = 0; w < window_count; ++w) {
+      Window &window = windows[w];
+      window.tail = max(window.tail, oldest);
 
-pair<int, int> get_swap_usage(const string &device) {
-  string line;
-  ifstream proc_file(SWAP_PROC_FILE);
+      // Keep the newest entry that still covers the whole window
+      while (window.tail + 1 < next_seq &&
+             ring[(window.tail + 1) % PSI_RING_SIZE].time_us <=
+                 sample.time_us - window.length_us) {
+        window.tail++;
+      }
 
-  getline(proc_file, line);  // Skip header line
+      const Entry &tail = ring[window.tail % PSI_RING_SIZE];
+      int64_t elapsed = sample.time_us - tail.time_us;
 
-  int size = 0, used = 0;
-  while (getline(proc_file, line)) {
-    if (line.find(device) != string::npos) {
-      istringstream iss(line);
-      string temp;
-      iss >> temp >> temp >> size >> used;
-      break;
+      for (int r = 0; r < 3; ++r) {
+        for (int level = 0; level < 2; ++level) {
+          sample.window_values[w][r][level] =
+              elapsed > 0 ? (sample.total[r][level] - tail.total[r][level]) *
+                                100.0 / elapsed
+                          : sample.avg[r][level][0];
+        }
+      }
     }
   }
+};
 
-  if (size == 0) {
-    lock_guard<mutex> lock(safe_thread_mutex);
-    active_swaps = get_active_swap();
-    available_swaps = get_available_swap();
+PsiSampler psi_sampler;
 
-    ALOGE("Error: Could not determine size of %s", device.c_str());
+/**
+ * Reads all PSI resources once. The sample is invalid if any file is missing.
+ */
+PsiSample sample_psi() { return psi_sampler.sample(); }
 
-    return {0, -1};  // Return -1% to indicate error
-  }
+volatile sig_atomic_t stop_signal = 0;
 
-  int used_percentage = (used * 100) / size;
-  int used_mb = (used / 1024);
-  return {used_mb, used_percentage};  // Return {used MB, percentage}
+/**
+ * Handles termination signals. Only async-signal-safe work here, the log
+ * takes a mutex the interrupted thread may hold: the service loops see
+ * running drop within a second and run_worker() logs the signal.
+ */
+void signal_handler(int signal) {
+  static const char message[] = "dynv: stopping\n";
+  stop_signal = signal;
+  running = false;
+  write(STDERR_FILENO, message, sizeof(message) - 1);
 }
 
-vector<string> get_lusg_swaps() {
-  string line;
-  ifstream proc_file(SWAP_PROC_FILE);
-  vector<string> low_usage_swaps;
-
-  getline(proc_file, line);  // Skip header line
+/**
+ * Fields of /proc/meminfo dynv reads, in kB.
+ */
+struct MemInfo {
+  uint64_t mem_total = 0, mem_free = 0, mem_available = 0;
+  uint64_t buffers = 0, cached = 0;
+  uint64_t swap_total = 0, swap_free = 0;
+  uint64_t anon_pages = 0;
+  bool has_available = false;
+};
 
-  int used = 0;
-  string device;
-  while (getline(proc_file, line)) {
-    istringstream iss(line);
-    string temp;
-    iss >> device >> temp >> temp >> used;
-    int used_mb = (used / 1024);
+/**
+ * Parses /proc/meminfo in place, without allocating.
+ */
+bool parse_meminfo(const char *buf, MemInfo &info) {
+  static const struct {
+    const char *key;
+    size_t length;
+    uint64_t MemInfo::*field;
+  } keys[] = {
+      {"MemTotal:", 9, &MemInfo::mem_total},
+      {"MemFree:", 8, &MemInfo::mem_free},
+      {"MemAvailable:", 13, &MemInfo::mem_available},
+      {"Buffers:", 8, &MemInfo::buffers},
+      {"Cached:", 7, &MemInfo::cached},
+      {"SwapTotal:", 10, &MemInfo::swap_total},
+      {"SwapFree:", 9, &MemInfo::swap_free},
+      {"AnonPages:", 10, &MemInfo::anon_pages},
+  };
 
-    if (used_mb < 10) {
-      low_usage_swaps.push_back(device);
+  int found = 0;
+  for (const char *line = buf; line && *line;) {
+    for (const auto &key : keys) {
+      if (strncmp(line, key.key, key.length) == 0) {
+        info.*key.field = strtoull(line + key.length, nullptr, 10);
+        if (key.field == &MemInfo::mem_available) info.has_available = true;
+        found++;
+        break;
+      }
     }
+    line = strchr(line, '\n');
+    if (line) line++;
   }
-
-  return low_usage_swaps;
+  return found > 0 && info.mem_total > 0;
 }
 
-int get_memory_pressure() {
-  FILE *fp = popen("free -b", "r");
-  if (!fp) {
-    perror("popen failed");
-    return -1;
+/**
+ * Memory pressure for kernels without PSI: the share of used memory that is
+ * still in RAM rather than in swap, with used memory counted as `free` does.
+ * memcg usage counters are preferred when the root memcg has them. Files
+ * stay open and are read with pread, so a tick costs a few syscalls.
+ */
+class MemoryPressureReader {
+ public:
+  MemoryPressureReader() {
+    usage_fd = open(root_path("/dev/memcg/memory.usage_in_bytes").c_str(),
+                    O_RDONLY | O_CLOEXEC);
+    memsw_fd =
+        open(root_path("/dev/memcg/memory.memsw.usage_in_bytes").c_str(),
+             O_RDONLY | O_CLOEXEC);
+  }
+  ~MemoryPressureReader() {
+    for (int fd : {meminfo_fd, usage_fd, memsw_fd}) {
+      if (fd >= 0) close(fd);
+    }
   }
+  MemoryPressureReader(const MemoryPressureReader &) = delete;
+  MemoryPressureReader &operator=(const MemoryPressureReader &) = delete;
+
+  /**
+   * @return Memory pressure in percent, or -1 when meminfo is unreadable.
+   */
+  int read() {
+    MemInfo &info = last;
+    info = MemInfo();
+    char buf[4096];
+    if (!read_file(meminfo_fd, root_path("/proc/meminfo"), buf, sizeof(buf)) ||
+        !parse_meminfo(buf, info)) {
+      return -1;
+    }
 
-  string line;
-  char buffer[256];
-  long mem_used = 0, swap_used = 0;
+    uint64_t available = info.has_available
+                             ? info.mem_available
+                             : info.mem_free + info.buffers + info.cached;
+    uint64_t mem_used = (info.mem_total - min(available, info.mem_total)) << 10;
+    uint64_t swap_used =
+        (info.swap_total - min(info.swap_free, info.swap_total)) << 10;
 
-  // Skip the header
-  fgets(buffer, sizeof(buffer), fp);
+    uint64_t memcg_used;
+    if (read_counter(usage_fd, memcg_used)) mem_used = memcg_used;
 
-  while (fgets(buffer, sizeof(buffer), fp)) {
-    istringstream iss(buffer);
-    string label;
-    long used = 0, temp;
+    uint64_t total_used;
+    if (!read_counter(memsw_fd, total_used)) total_used = mem_used + swap_used;
 
-    iss >> label;
-    if (label == "Mem:") {
-      iss >> temp >> used;
-      mem_used = used;
-    } else if (label == "Swap:") {
-      iss >> temp >> used;
-      swap_used = used;
-    }
+    if (total_used == 0) return 0;
+    return static_cast<int>(min<uint64_t>(mem_used * 100 / total_used, 100));
   }
 
-  pclose(fp);
+  // meminfo as of the last read(), zeroed when it failed
+  const MemInfo &meminfo() const { return last; }
 
-  long total_used = mem_used + swap_used;
+ private:
+  int meminfo_fd = -1, usage_fd = -1, memsw_fd = -1;
+  MemInfo last;
 
-  if (total_used == 0) return 0;
+  static bool read_file(int &fd, const string &path, char *buf, size_t size) {
+    if (fd < 0) {
+      fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) return false;
+    }
+    ssize_t len = pread(fd, buf, size - 1, 0);
+    if (len <= 0) {
+      close(fd);
+      fd = -1;
+      return false;
+    }
+    buf[len] = '\0';
+    return true;
+  }
 
-  return static_cast<int>((mem_used * 100) / total_used);
-}
+  static bool read_counter(int fd, uint64_t &value) {
+    if (fd < 0) return false;
+    char buf[32];
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) return false;
+    buf[len] = '\0';
+    value = strtoull(buf, nullptr, 10);
+    return true;
+  }
+};
 
 template <typename T, typename U>
-bool contains(const T &value, vector<U> &vector_data) {
+bool contains(const T &value, const vector<U> &vector_data) {
   return find(vector_data.begin(), vector_data.end(), value) !=
          vector_data.end();
 }
@@ -605,276 +1085,1856 @@ void safe_push_back(const string &value, vector<T> &elements) {
   elements.push_back(value);
 }
 
-// Function to perform swapoff on a single device
-void swapoff_th(const string &device) {
-  string command = "/system/bin/swapoff " + device;
+enum class SwapTier { ZRAM, BACKING, FILE };
+constexpr int SWAP_TIER_COUNT = 3;
 
-  if (system(command.c_str()) == 0) {
-    ALOGI("Swap: %s is turned off.", device.c_str());
-    if (device.find("zram") != string::npos) {
-      safe_push_back(device, available_swaps.first);
-    } else {
-      safe_push_back(device, available_swaps.second);
-    }
-    remove_element(device, &swapoff_tracker);
-    remove_element(device, &active_swaps);
-  } else {
-    remove_element(device, &swapoff_tracker);
-    ALOGE("Failed: Turn off %s", device.c_str());
-  }
+const char *tier_name(SwapTier tier) {
+  static const char *names[] = {"zram", "backing", "file"};
+  return names[static_cast<int>(tier)];
 }
 
-bool swapoff_(const string &device, vector<thread> &threads,
-              optional<string> message = nullopt) {
-  bool cntn_the_swap = contains(device, swapoff_tracker);
+struct SwapDevice {
+  string path;
+  SwapTier tier;
+  int number;  // Trailing number of the name, activation order in the tier
+  long size_kb = 0;
+  long used_kb = 0;
+  int priority = 0;
 
-  if (!cntn_the_swap) {
-    ALOGI("[THREAD] Swapoff: %s. %s", device.c_str(), message->c_str());
-    safe_push_back(device, swapoff_tracker);
-    threads.emplace_back(swapoff_th, device);
-    return true;
-  } else {
-    return false;
+  int used_mb() const { return used_kb / 1024; }
+  int used_percentage() const { return size_kb ? used_kb * 100 / size_kb : -1; }
+};
+
+/**
+ * Per-tier thresholds. Usage above activation_threshold (percent) of the
+ * lowest priority active device brings in the next device; devices using
+ * less than deactivation_threshold (MB) can be drained.
+ */
+struct SwapTierPolicy {
+  int activation_threshold;
+  int deactivation_threshold;
+  int base_priority;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(activation_threshold, deactivation_threshold, base_priority);
   }
-}
+};
 
-bool swapon(const string device, int priority) {
-  string command =
-      "/system/bin/swapon -p " + to_string(priority) + " " + device;
+struct SwapEntry {
+  string path;
+  long size_kb;
+  long used_kb;
+  int priority;
+};
 
-  if (system(command.c_str()) == 0) {
-    ALOGI("SWAPON: %s, priority: %d", device.c_str(), priority);
+/**
+ * Parses the content of /proc/swaps into one entry per active swap. The
+ * header is skipped and the type column ("partition" or "file") ignored.
+ * Whitespace and backslashes in a path are octal escapes like \040,
+ * decoded here, so a deleted swap file reads "<path> (deleted)".
+ */
+void parse_proc_swaps(const char *buf, vector<SwapEntry> &entries) {
+  const char *line = strchr(buf, '\n');  // Header
+  while (line && *++line) {
+    const char *end = strchr(line, '\n');
+    if (!end) end = line + strlen(line);
+
+    SwapEntry entry;
+    const char *p = line;
+    while (p < end && *p != ' ' && *p != '\t') {
+      if (*p == '\\' && end - p >= 4 && isdigit(p[1]) && isdigit(p[2]) &&
+          isdigit(p[3])) {
+        entry.path += static_cast<char>((p[1] - '0') * 64 +
+                                        (p[2] - '0') * 8 + (p[3] - '0'));
+        p += 4;
+      } else {
+        entry.path += *p++;
+      }
+    }
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    while (p < end && *p != ' ' && *p != '\t') p++;  // Type
+
+    long values[3];
+    int parsed = 0;
+    for (; parsed < 3; ++parsed) {
+      char *next;
+      values[parsed] = strtol(p, &next, 10);
+      if (next == p || next > end) break;
+      p = next;
+    }
+    if (!entry.path.empty() && parsed == 3) {
+      entry.size_kb = values[0];
+      entry.used_kb = values[1];
+      entry.priority = values[2];
+      entries.push_back(move(entry));
+    }
+    line = *end ? end : nullptr;
+  }
+}
 
-    return true;
-  } else {
-    ALOGE("Failed: turn on swap %s", device.c_str());
+/**
+ * Reads /proc/swaps into one entry per active swap.
+ */
+vector<SwapEntry> read_proc_swaps() {
+  vector<SwapEntry> entries;
+  int fd = open(SWAP_PROC_FILE.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    ALOGE("Error: Unable to open %s", SWAP_PROC_FILE.c_str());
+    return entries;
+  }
 
-    return false;
+  // One line per swap device, MAX_SWAPFILES is 32
+  char buf[8192];
+  size_t len = 0;
+  ssize_t n;
+  while (len < sizeof(buf) - 1 &&
+         (n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0) {
+    len += n;
   }
+  close(fd);
+  buf[len] = '\0';
+  parse_proc_swaps(buf, entries);
+  return entries;
 }
 
-bool is_doze_mode() {
-  FILE *pipe = popen("dumpsys deviceidle get deep", "r");
-  if (!pipe) {
-    cerr << "Failed to check Doze Mode!" << endl;
-    return false;
+/**
+ * Tracks every swap device by tier: zram (fast), backing block devices and
+ * swap files on flash (slow). Devices are classified once at discovery so the
+ * per-tick policy never has to look at their names again. Tier transitions
+ * (first device of a tier activated, last one drained) are logged as events.
+ */
+class SwapTierModel {
+ public:
+  void configure(const array<SwapTierPolicy, SWAP_TIER_COUNT> &tier_policies,
+                 const vector<string> &backing) {
+    lock_guard<mutex> guard(lock);
+    policies = tier_policies;
+    backing_devices = backing;
   }
 
-  char buffer[128];
-  string result = "";
-
-  while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-    result += buffer;
+  /**
+   * Rebuilds the model from /proc/swaps, the zram block devices, swap files
+   * and the configured backing devices.
+   */
+  void discover() {
+    vector<string> paths;
+    for (const string &dir : {SWAP_DIR, ZRAM_DIR}) {
+      if (!fs::is_directory(dir)) {
+        ALOGW("Directory does not exist: %s", dir.c_str());
+        continue;
+      }
+      for (const auto &entry : fs::directory_iterator(dir)) {
+        if (entry.is_directory()) continue;
+
+        string path = entry.path().string();
+        if (contains(path, backing_devices)) continue;
+        if (path.find("swap") != string::npos ||
+            path.find("zram") != string::npos) {
+          paths.push_back(path);
+        }
+      }
+    }
+    for (const auto &path : backing_devices) {
+      if (fs::exists(path)) {
+        paths.push_back(path);
+      } else {
+        ALOGW("Backing swap device does not exist: %s", path.c_str());
+      }
+    }
+    rebuild(paths);
   }
 
-  pclose(pipe);
+  /**
+   * Rebuilds the model from /proc/swaps and an already known device list,
+   * without scanning the device directories again.
+   */
+  void rebuild(const vector<string> &paths) {
+    vector<SwapEntry> entries = read_proc_swaps();
+    lock_guard<mutex> guard(lock);
+    changes++;
+
+    active.clear();
+    for (auto &devices : inactive) devices.clear();
+    active_per_tier.fill(0);
+
+    for (const auto &path : paths) {
+      if (any_of(entries.begin(), entries.end(),
+                 [&](const SwapEntry &e) { return e.path == path; })) {
+        ALOGI("ACTIVE SWAP detected: %s", path.c_str());
+        continue;
+      }
+      SwapTier tier = classify(path);
+      inactive[static_cast<int>(tier)].push_back(make_device(path, tier));
+      ALOGD("INACTIVE SWAP found: %s (%s)", path.c_str(), tier_name(tier));
+    }
 
-  // Trim whitespace
-  result.erase(0, result.find_first_not_of(" \n\r\t"));
-  result.erase(result.find_last_not_of(" \n\r\t") + 1);
+    // Next device to activate sits at the back: lowest number
+    for (auto &devices : inactive) {
+      sort(devices.begin(), devices.end(),
+           [](const SwapDevice &a, const SwapDevice &b) {
+             return a.number > b.number;
+           });
+    }
 
-  return (result == "IDLE");
-}
+    // Highest priority first, so active.back() is the last one to fill up
+    sort(entries.begin(), entries.end(),
+         [](const SwapEntry &a, const SwapEntry &b) {
+           return a.priority > b.priority;
+         });
+    for (const auto &entry : entries) {
+      SwapDevice device = make_device(entry.path, classify(entry.path));
+      device.size_kb = entry.size_kb;
+      device.used_kb = entry.used_kb;
+      device.priority = entry.priority;
+      active.push_back(device);
+      active_per_tier[static_cast<int>(device.tier)]++;
+    }
 
-bool is_sleep_mode() {
-  FILE *pipe = popen("dumpsys power", "r");
-  if (!pipe) {
-    cerr << "Failed to check Sleep Mode!" << endl;
-    return false;
+    for (const auto &device : active) {
+      ALOGD("Active SWAP: %s (%s) priority %d", device.path.c_str(),
+            tier_name(device.tier), device.priority);
+    }
   }
 
-  char buffer[128];
-  string result = "";
+  /**
+   * Updates size and usage of every active device with one /proc/swaps read.
+   */
+  void refresh_usage() {
+    vector<SwapEntry> entries = read_proc_swaps();
+    lock_guard<mutex> guard(lock);
+
+    for (auto &device : active) {
+      auto it = find_if(entries.begin(), entries.end(), [&](const auto &e) {
+        return e.path == device.path;
+      });
+      if (it != entries.end()) {
+        device.size_kb = it->size_kb;
+        device.used_kb = it->used_kb;
+      } else {
+        device.size_kb = device.used_kb = 0;
+      }
+    }
+  }
 
-  while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-    result += buffer;
+  /**
+   * The lowest priority active device, the one that fills up last.
+   */
+  optional<SwapDevice> frontier() const {
+    lock_guard<mutex> guard(lock);
+    if (active.empty()) return nullopt;
+    return active.back();
   }
 
-  pclose(pipe);
+  /**
+   * Next device to activate, fastest tier first.
+   */
+  optional<SwapDevice> next_inactive() const {
+    lock_guard<mutex> guard(lock);
+    for (const auto &devices : inactive) {
+      if (!devices.empty()) return devices.back();
+    }
+    return nullopt;
+  }
 
-  // Check if display is OFF
-  return (result.find("mWakefulness=Asleep") != string::npos);
-}
+  /**
+   * Active devices in the order they should be drained: slowest tier first,
+   * and inside a tier the lowest priority first.
+   */
+  vector<SwapDevice> drain_order() const {
+    lock_guard<mutex> guard(lock);
+    vector<SwapDevice> order(active.rbegin(), active.rend());
+    stable_sort(order.begin(), order.end(),
+                [](const SwapDevice &a, const SwapDevice &b) {
+                  return a.tier > b.tier;
+                });
+    return order;
+  }
 
-void sleeper(int seconds, function<void()> on_complete = nullptr,
-             function<bool()> interrupt_check = nullptr) {
-  sleeper_alive = true;
-  bool interrupted = false;
+  /**
+   * Active devices ordered from highest to lowest priority.
+   */
+  vector<SwapDevice> active_devices() const {
+    lock_guard<mutex> guard(lock);
+    return active;
+  }
 
-  auto deadline = steady_clock::now() + chrono::seconds(seconds);
-  ALOGI("Sleep for %d seconds...", seconds);
+  /**
+   * Inactive devices of a tier, next to activate last.
+   */
+  vector<SwapDevice> inactive_devices(SwapTier tier) const {
+    lock_guard<mutex> guard(lock);
+    return inactive[static_cast<int>(tier)];
+  }
 
-  while (steady_clock::now() < deadline) {
-    this_thread::sleep_for(milliseconds(100));
+  size_t active_count() const {
+    lock_guard<mutex> guard(lock);
+    return active.size();
+  }
 
-    if (interrupt_check && interrupt_check()) {
-      interrupted = true;
-      break;
+  optional<SwapDevice> find_active(const string &path) const {
+    lock_guard<mutex> guard(lock);
+    for (const auto &device : active) {
+      if (device.path == path) return device;
     }
+    return nullopt;
   }
 
-  if (!interrupted && on_complete) {
-    ALOGD("Sleep completed.");
-    on_complete();
+  // Paths of every known device, active or not
+  vector<string> known_devices() const {
+    lock_guard<mutex> guard(lock);
+    vector<string> paths;
+    for (const auto &device : active) paths.push_back(device.path);
+    for (const auto &devices : inactive) {
+      for (const auto &device : devices) paths.push_back(device.path);
+    }
+    return paths;
   }
 
-  sleeper_alive = false;
-}
+  // Bumped whenever a device is discovered, activated or drained
+  uint32_t version() const { return changes.load(memory_order_relaxed); }
 
-void start_swapoff_timer_if_idle(int wait_timeout) {
-  if (is_swapoff_session || !is_sleep_mode() || sleeper_alive) return;
-  thread([=] {
-    sleeper(
-        wait_timeout,
-        [] {
-          is_swapoff_session = true;
-          ALOGI_ONCE("swapoff_session", "Swapoff session started...");
-          ALOG_RESET("swapoff_timer");
-        },
-        [] {
-          if (!is_sleep_mode()) {
-            ALOGI("Device woke before timeout, swapoff canceled.");
-            ALOG_RESET("swapoff_timer");
-            ALOG_RESET("swapoff_session");
-            return true;
-          }
-          return false;
-        });
-  }).detach();
+  const SwapTierPolicy &policy(SwapTier tier) const {
+    return policies[static_cast<int>(tier)];
+  }
 
-  ALOGI_ONCE("swapoff timer", "Idle detected. Timer for swapoff initiated...");
-}
+  /**
+   * Tier base priority minus the devices already active in the tier, so each
+   * tier stays strictly above the slower ones.
+   */
+  int priority_for(SwapTier tier) const {
+    lock_guard<mutex> guard(lock);
+    int index = static_cast<int>(tier);
+    return max(policies[index].base_priority - active_per_tier[index], 0);
+  }
 
-struct Config {
-  float config_version;
-  int swappiness_max;
-  int swappiness_min;
-  int zram_activation_threshold;
-  int zram_deactivation_threshold;
-  int swap_activation_threshold;
-  int swap_deactivation_threshold;
-  int swap_deactivation_time;
-  bool pressure_binding;
-  bool deactivate_in_sleep;
-  string threshold_type;
+  void mark_active(const SwapDevice &device, int priority) {
+    lock_guard<mutex> guard(lock);
+    changes++;
+    auto &devices = inactive[static_cast<int>(device.tier)];
+    devices.erase(remove_if(devices.begin(), devices.end(),
+                            [&](const auto &d) { return d.path == device.path; }),
+                  devices.end());
+
+    SwapDevice activated = device;
+    activated.priority = priority;
+    auto pos = find_if(active.begin(), active.end(), [&](const auto &d) {
+      return d.priority < priority;
+    });
+    active.insert(pos, activated);
+
+    if (active_per_tier[static_cast<int>(device.tier)]++ == 0) {
+      ALOGI("TIER: %s tier activated by %s", tier_name(device.tier),
+            device.path.c_str());
+    }
+  }
 
-  void load_from_yaml() {
-    config_version = read_config(".config_version", -1.0);
-    swappiness_max =
-        read_config(".dynamic_swappiness.swappiness_range.max", 100);
-    swappiness_min =
-        read_config(".dynamic_swappiness.swappiness_range.min", 80);
-    zram_activation_threshold =
-        read_config(".virtual_memory.zram.activation_threshold", 70);
-    zram_deactivation_threshold =
-        read_config(".virtual_memory.zram.deactivation_threshold", 50);
-    swap_activation_threshold =
-        read_config(".virtual_memory.swap.activation_threshold", 90);
-    swap_deactivation_threshold =
-        read_config(".virtual_memory.swap.deactivation_threshold", 50);
-    swap_deactivation_time = read_config(".virtual_memory.wait_timeout", 10);
-    pressure_binding = read_config(".virtual_memory.pressure_binding", false);
-    deactivate_in_sleep =
-        read_config(".virtual_memory.deactivate_in_sleep", true);
-    threshold_type =
-        read_config(".dynamic_swappiness.threshold_type", string("psi"));
+  void mark_inactive(const string &path) {
+    lock_guard<mutex> guard(lock);
+    auto it = find_if(active.begin(), active.end(),
+                      [&](const auto &d) { return d.path == path; });
+    if (it == active.end()) return;
+    changes++;
+
+    SwapDevice device = *it;
+    active.erase(it);
+    device.size_kb = device.used_kb = device.priority = 0;
+
+    auto &devices = inactive[static_cast<int>(device.tier)];
+    devices.push_back(device);
+    sort(devices.begin(), devices.end(),
+         [](const SwapDevice &a, const SwapDevice &b) {
+           return a.number > b.number;
+         });
+
+    if (--active_per_tier[static_cast<int>(device.tier)] == 0) {
+      ALOGI("TIER: %s tier drained by %s", tier_name(device.tier),
+            path.c_str());
+    }
+  }
+
+ private:
+  mutable mutex lock;
+  array<SwapTierPolicy, SWAP_TIER_COUNT> policies{};
+  vector<string> backing_devices;
+  vector<SwapDevice> active;
+  array<vector<SwapDevice>, SWAP_TIER_COUNT> inactive;
+  array<int, SWAP_TIER_COUNT> active_per_tier{};
+  atomic<uint32_t> changes{0};
+
+  SwapTier classify(const string &path) const {
+    if (contains(path, backing_devices)) return SwapTier::BACKING;
+    if (path.find("zram") != string::npos) return SwapTier::ZRAM;
+    return SwapTier::FILE;
+  }
+
+  static SwapDevice make_device(const string &path, SwapTier tier) {
+    size_t pos = path.find_last_not_of("0123456789");
+    int number = (pos != string::npos && pos + 1 < path.size())
+                     ? stoi(path.substr(pos + 1))
+                     : -1;
+    return {path, tier, number};
   }
 };
 
-struct PressureMapping {
-  vector<pair<int, int>> cpu;
-  vector<pair<int, int>> memory;
-  vector<pair<int, int>> io;
-  vector<pair<int, int>> mem_pressure;
+SwapTierModel swap_model;
+
+constexpr uint32_t JOURNAL_MAGIC = 0x524A4D46;  // "FMJR"
+constexpr uint16_t JOURNAL_VERSION = 1;
+
+enum class JournalType : uint16_t {
+  START = 1,         // a: pid, b: config version * 100
+  TICK = 2,          // a/b/c: cpu/memory/io PSI some avg10 * 100
+  SWAP_SUMMARY = 3,  // a: active swaps, b: used MB, c: size MB
+  SWAPPINESS = 4,    // a: new value, b: previous value
+  SWAPON = 5,        // a: tier, b: device number, c: priority
+  SWAPOFF = 6,       // a: tier, b: device number, c: used MB
+  SWAPOFF_DONE = 7,  // a: tier, b: device number
+  TIMER_START = 8,   // a: timeout in seconds
+  TIMER_CANCEL = 9,
+  TIMER_FIRE = 10,
+  VM_KNOB = 11,      // a: knob index, b: value
+  RECLAIM = 12,      // a: pages reclaimed in the tick
+  ZRAM_RESIZE = 13,  // a: device number, b: old MB, c: new MB
+  DAMON = 14,        // a: cold MB, b: monitored MB, c: MB paged out
+  WORKING_SET = 15,  // a: working set MB at the first age, b: idle anon MB,
+                     // c: zram devices needed
+  PROFILE = 16,      // a: profile index + 1 (0: default), b: latency us,
+                     // c: foreground uid
 };
 
-struct DynamicSwappinessConfig {
-  int min_swappiness;
-  int max_swappiness;
-  Config _config;
-  string threshold_type = _config.threshold_type;
-  PressureMapping pressure_mapping;
-  string mode;
-  int levels;
-  int cpu_max;
-  int cpu_min;
-  int mem_max;
-  int mem_min;
-  int io_max;
-  int io_min;
-  string cpu_time_window;
-  string mem_time_window;
-  string io_time_window;
+// Tick flags
+constexpr uint16_t JOURNAL_SLEEP = 1 << 0;
+constexpr uint16_t JOURNAL_SWAPOFF_SESSION = 1 << 1;
+constexpr uint16_t JOURNAL_PSI_INVALID = 1 << 2;
+// Decision flags
+constexpr uint16_t JOURNAL_FAILED = 1 << 0;
+
+struct JournalHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t record_size;
+  uint32_t capacity;
+  uint32_t reserved;
+  uint64_t next_seq;  // Sequence of the next record, starts at 1
+  uint8_t padding[40];
+};
 
-  string pressure_to_string(const vector<pair<int, int>> &pressure_vec) {
-    stringstream ss;
-    for (size_t i = 0; i < pressure_vec.size(); ++i) {
-      ss << "[" << pressure_vec[i].first << "," << pressure_vec[i].second
-         << "]";
-      if (i != pressure_vec.size() - 1) {
-        ss << ", ";
+/**
+ * A record is valid once seq is stored. seq is cleared before the fields
+ * are written and stored last with release ordering, so a crash mid-write
+ * leaves the slot with seq 0.
+ */
+struct JournalRecord {
+  uint64_t seq;
+  int64_t time_ms;  // CLOCK_REALTIME
+  uint16_t type;
+  uint16_t flags;
+  int32_t a;
+  int32_t b;
+  int32_t c;
+};
+
+static_assert(sizeof(JournalHeader) == 64, "journal header layout");
+static_assert(sizeof(JournalRecord) == 32, "journal record layout");
+
+/**
+ * Fixed-size circular flight recorder of tick inputs and policy decisions,
+ * mmap'd from /data/adb/fmiop so records survive a daemon crash. Decode it
+ * with tools/decode_journal.py.
+ */
+class Journal {
+ public:
+  ~Journal() { close_map(); }
+
+  bool open_file(const string &file_path, size_t size_kb) {
+    uint32_t capacity =
+        max<size_t>((size_kb << 10) / sizeof(JournalRecord), 64) - 2;
+    size_t size = sizeof(JournalHeader) + capacity * sizeof(JournalRecord);
+
+    int fd = open(file_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+      ALOGE("Error: Unable to open journal %s: %s", file_path.c_str(),
+            strerror(errno));
+      return false;
+    }
+
+    // A journal with another size is carried over, one with another layout
+    // is kept aside read-only for the decoder
+    JournalHeader old{};
+    vector<JournalRecord> history;
+    if (pread(fd, &old, sizeof(old), 0) == sizeof(old) &&
+        old.magic == JOURNAL_MAGIC) {
+      if (old.version == JOURNAL_VERSION &&
+          old.record_size == sizeof(JournalRecord)) {
+        if (old.capacity != capacity) history = read_history(fd, old);
+      } else {
+        string kept = file_path + ".v" + to_string(old.version);
+        close(fd);
+        if (rename(file_path.c_str(), kept.c_str()) == 0) {
+          chmod(kept.c_str(), 0400);
+          ALOGI("Journal version %u kept as %s", old.version, kept.c_str());
+        }
+        fd = open(file_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0) return false;
       }
     }
-    return ss.str();
-  }
+    struct stat st;
+    bool resize = fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != size;
+    if (resize && ftruncate(fd, 0) == 0 && ftruncate(fd, size) != 0) {
+      ALOGE("Error: Unable to size journal %s", file_path.c_str());
+      close(fd);
+      return false;
+    }
 
-  void load_from_yaml(const YAML::Node &config) {
-    ALOGD("Loading DynamicSwappinessConfig from YAML...");
-    auto dyn = config["dynamic_swappiness"];
-    if (!dyn) {
-      ALOGW("dynamic_swappiness section not found in config.");
-      return;
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      ALOGE("Error: Unable to map journal %s", file_path.c_str());
+      return false;
     }
 
-    threshold_type = (dyn["threshold_type"] && dyn["threshold_type"].IsScalar())
-                         ? dyn["threshold_type"].as<string>()
-                         : "psi";
-    if (dyn["swappiness_range"] && dyn["swappiness_range"].IsMap()) {
-      min_swappiness = (dyn["swappiness_range"]["min"] &&
-                        dyn["swappiness_range"]["min"].IsScalar())
-                           ? dyn["swappiness_range"]["min"].as<int>()
-                           : _config.swappiness_min;
-      max_swappiness = (dyn["swappiness_range"]["max"] &&
-                        dyn["swappiness_range"]["max"].IsScalar())
-                           ? dyn["swappiness_range"]["max"].as<int>()
-                           : _config.swappiness_max;
+    base = map;
+    map_size = size;
+    header = static_cast<JournalHeader *>(map);
+    records = reinterpret_cast<JournalRecord *>(header + 1);
+
+    if (header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION ||
+        header->record_size != sizeof(JournalRecord) ||
+        header->capacity != capacity || header->next_seq == 0) {
+      memset(map, 0, size);
+      header->version = JOURNAL_VERSION;
+      header->record_size = sizeof(JournalRecord);
+      header->capacity = capacity;
+      header->next_seq = 1;
+      // Sequence numbers are kept, only the newest records that fit remain
+      size_t skip = history.size() > capacity ? history.size() - capacity : 0;
+      for (size_t r = skip; r < history.size(); ++r) {
+        records[(history[r].seq - 1) % capacity] = history[r];
+      }
+      if (!history.empty()) header->next_seq = old.next_seq;
+      __atomic_store_n(&header->magic, JOURNAL_MAGIC, __ATOMIC_RELEASE);
+      if (history.empty()) {
+        ALOGI("Journal %s initialized, %u records.", file_path.c_str(),
+              capacity);
+      } else {
+        ALOGI("Journal %s resized to %u records, %zu carried over.",
+              file_path.c_str(), capacity, history.size() - skip);
+      }
     } else {
-      min_swappiness = _config.swappiness_min;
-      max_swappiness = _config.swappiness_max;
+      ALOGI("Journal %s resumed at record %llu.", file_path.c_str(),
+            static_cast<unsigned long long>(header->next_seq));
     }
+    return true;
+  }
 
-    ALOGD("threshold_type: %s", threshold_type.c_str());
-    ALOGD("min_swappiness: %d, max_swappiness: %d", min_swappiness,
-          max_swappiness);
+  void append(JournalType type, uint16_t flags = 0, int32_t a = 0,
+              int32_t b = 0, int32_t c = 0) {
+    if (!header) return;
+
+    uint64_t seq = __atomic_fetch_add(&header->next_seq, 1, __ATOMIC_RELAXED);
+    JournalRecord &record = records[(seq - 1) % header->capacity];
+
+    // Invalidate the slot first, a crash below must not leave the previous
+    // lap's sequence on a half-written record
+    __atomic_store_n(&record.seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record.time_ms = now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+    record.type = static_cast<uint16_t>(type);
+    record.flags = flags;
+    record.a = a;
+    record.b = b;
+    record.c = c;
+    __atomic_store_n(&record.seq, seq, __ATOMIC_RELEASE);
+  }
 
-    auto psi = dyn["threshold_psi"];
-    if (psi) {
-      // Provide default values if not present in YAML
-      pressure_mapping.cpu =
-          psi["cpu_pressure"] && psi["cpu_pressure"].IsSequence()
-              ? parse_pressure_pairs(psi["cpu_pressure"])
-              : vector<pair<int, int>>{
-                    {10, 160}, {20, 120}, {30, 80}, {40, 60}, {80, 40}};
-      pressure_mapping.memory =
-          psi["memory_pressure"] && psi["memory_pressure"].IsSequence()
-              ? parse_pressure_pairs(psi["memory_pressure"])
-              : vector<pair<int, int>>{
-                    {5, 160}, {10, 140}, {15, 100}, {20, 60}, {25, 40}};
-      pressure_mapping.io =
-          psi["io_pressure"] && psi["io_pressure"].IsSequence()
-              ? parse_pressure_pairs(psi["io_pressure"])
-              : vector<pair<int, int>>{
-                    {10, 140}, {15, 100}, {20, 80}, {25, 100}};
+  /**
+   * Asks the kernel to write dirty journal pages back, for power loss.
+   */
+  void flush() {
+    if (header) msync(base, map_size, MS_ASYNC);
+  }
 
-      ALOGD("CPU Pressure Mapping: %s",
-            pressure_to_string(pressure_mapping.cpu).c_str());
-      ALOGD("Memory Pressure Mapping: %s",
-            pressure_to_string(pressure_mapping.memory).c_str());
-      ALOGD("IO Pressure Mapping: %s",
-            pressure_to_string(pressure_mapping.io).c_str());
-    } else {
-      ALOGW("threshold_psi section not found in config.");
-    }
+ private:
+  void *base = nullptr;
+  size_t map_size = 0;
+  JournalHeader *header = nullptr;
+  JournalRecord *records = nullptr;
+
+  /**
+   * Valid records of a journal file, oldest first. A slot counts only when
+   * its sequence belongs to that slot in the last lap before next_seq.
+   */
+  static vector<JournalRecord> read_history(int fd,
+                                            const JournalHeader &old) {
+    vector<JournalRecord> slots(old.capacity);
+    size_t bytes = slots.size() * sizeof(JournalRecord);
+    vector<JournalRecord> history;
+    if (pread(fd, slots.data(), bytes, sizeof(JournalHeader)) !=
+        static_cast<ssize_t>(bytes)) {
+      return history;
+    }
+    uint64_t oldest = old.next_seq > old.capacity ? old.next_seq - old.capacity
+                                                  : 1;
+    for (uint32_t slot = 0; slot < old.capacity; ++slot) {
+      const JournalRecord &record = slots[slot];
+      if (record.seq >= oldest && record.seq < old.next_seq &&
+          (record.seq - 1) % old.capacity == slot) {
+        history.push_back(record);
+      }
+    }
+    sort(history.begin(), history.end(),
+         [](const JournalRecord &a, const JournalRecord &b) {
+           return a.seq < b.seq;
+         });
+    return history;
+  }
+
+  void close_map() {
+    if (base) munmap(base, map_size);
+    base = nullptr;
+    header = nullptr;
+  }
+};
+
+Journal journal;
+
+/**
+ * Reads a single integer from a procfs/sysfs file, returns fallback on error.
+ */
+long read_long(const string &path, long fallback = -1) {
+  ifstream file(path);
+  long value;
+  return (file >> value) ? value : fallback;
+}
+
+/**
+ * Online CPUs grouped by core type: cpu_capacity where the kernel exposes
+ * it, the maximum frequency otherwise. Slowest type first.
+ */
+map<long, vector<int>> cpu_clusters() {
+  map<long, vector<int>> clusters;
+  long cpus = sysconf(_SC_NPROCESSORS_CONF);
+  for (int cpu = 0; cpu < cpus; ++cpu) {
+    string base = root_path("/sys/devices/system/cpu/cpu") + to_string(cpu);
+    if (read_long(base + "/online", 1) == 0) continue;
+
+    long capacity = read_long(base + "/cpu_capacity", -1);
+    if (capacity < 0) {
+      capacity = read_long(base + "/cpufreq/cpuinfo_max_freq", 0);
+    }
+    clusters[capacity].push_back(cpu);
+  }
+  return clusters;
+}
+
+/**
+ * Kernel features dynv can use. Bit positions in the capability bitmap,
+ * names in KernelCapabilities::names.
+ */
+enum class Capability {
+  PSI,                // /proc/pressure/{cpu,memory,io}, 4.20
+  PSI_TRIGGER,        // poll() on a pressure threshold, 5.2
+  ZRAM,
+  ZRAM_MULTI_STREAM,  // max_comp_streams
+  ZRAM_RECOMPRESS,    // recomp_algorithm, 6.2
+  ZRAM_WRITEBACK,     // backing_dev
+  ZRAM_DEDUP,         // use_dedup, vendor kernels only
+  PIDFD,              // pidfd_open, 5.3
+  PROCESS_MADVISE,    // process_madvise(MADV_PAGEOUT), 5.10
+  MGLRU,              // lru_gen enabled, 6.1
+  LRU_GEN_STATS,      // /sys/kernel/debug/lru_gen
+  DAMON,              // DAMON sysfs interface, 5.18
+  CGROUP_V1,
+  CGROUP_V2,
+  COUNT
+};
+
+bool on_procfs(int fd) {
+  struct statfs fs;
+  return fstatfs(fd, &fs) == 0 && fs.f_type == PROC_SUPER_MAGIC;
+}
+
+/**
+ * Arms a PSI trigger on an open pressure file for stall_ms of stall per
+ * second. Without CAP_SYS_RESOURCE the kernel only takes windows in 2 s
+ * steps, then the same share of a 2 s window is used.
+ */
+bool arm_psi_trigger(int fd, int stall_ms) {
+  for (int window_s : {1, 2}) {
+    char trigger[48];
+    snprintf(trigger, sizeof(trigger), "some %d %d",
+             stall_ms * 1000 * window_s, window_s * 1000000);
+    if (::write(fd, trigger, strlen(trigger) + 1) > 0) return true;
+    if (errno != EINVAL) return false;
+  }
+  return false;
+}
+
+/**
+ * Probes the kernel once, on first use, so every subsystem picks its
+ * implementation up front instead of finding out by failing at runtime.
+ *
+ * DYNV_CAPS simulates other kernels on a Linux host: a comma separated list
+ * where "name" or "+name" adds a capability, "-name" removes it and "none"
+ * drops everything probed so far, e.g. DYNV_CAPS=none,psi,zram.
+ */
+class KernelCapabilities {
+ public:
+  static constexpr const char *names[] = {
+      "psi", "psi_trigger", "zram", "zram_multi_stream", "zram_recompress",
+      "zram_writeback", "zram_dedup", "pidfd", "process_madvise", "mglru",
+      "lru_gen_stats", "damon", "cgroup_v1", "cgroup_v2"};
+  static_assert(size(names) == static_cast<size_t>(Capability::COUNT));
+
+  bool has(Capability cap) const { return bitmap() & bit(cap); }
+
+  uint32_t bitmap() const {
+    call_once(probed,
+              [this] { const_cast<KernelCapabilities *>(this)->probe(); });
+    return bits;
+  }
+
+  // Set or cleared by DYNV_CAPS rather than probed
+  bool simulated(Capability cap) const {
+    bitmap();
+    return forced & bit(cap);
+  }
+
+  /**
+   * The implementation each subsystem runs with on this kernel, whether or
+   * not the config enables it.
+   */
+  string selection() const {
+    bitmap();
+    return describe_selection();
+  }
+
+ private:
+  mutable once_flag probed;
+  uint32_t bits = 0;
+  uint32_t forced = 0;
+
+  static uint32_t bit(Capability cap) {
+    return 1u << static_cast<int>(cap);
+  }
+
+  void set(Capability cap, bool present) {
+    if (present) bits |= bit(cap);
+  }
+
+  string describe_selection() const {
+    auto has = [this](Capability cap) { return (bits & bit(cap)) != 0; };
+    string line;
+    line += has(Capability::PSI) ? "pressure psi" : "pressure mem_pressure";
+    line += has(Capability::PSI_TRIGGER) ? ", wakeup psi trigger"
+                                         : ", wakeup 1 s tick";
+    line += has(Capability::PROCESS_MADVISE) && has(Capability::PIDFD)
+                ? ", reclaim process_madvise"
+                : ", reclaim off";
+    line += has(Capability::LRU_GEN_STATS) ? ", working set lru_gen"
+                                           : ", working set off";
+    line += has(Capability::DAMON) ? ", cold memory damon" : ", cold memory off";
+    line += has(Capability::ZRAM_RECOMPRESS) ? ", zram recompression"
+                                             : ", zram single algorithm";
+    line += has(Capability::PIDFD) ? ", supervisor pidfd"
+                                   : ", supervisor waitpid";
+    return line;
+  }
+
+  void probe() {
+    auto start = steady_clock::now();
+    probe_psi();
+
+    string zram = ZRAM_SYSFS_DIR + "/zram0";
+    auto zram_attr = [&](const char *name) {
+      return access((zram + "/" + name).c_str(), F_OK) == 0;
+    };
+    set(Capability::ZRAM,
+        zram_attr("disksize") ||
+            access(root_path("/sys/class/zram-control").c_str(), F_OK) == 0);
+    set(Capability::ZRAM_MULTI_STREAM, zram_attr("max_comp_streams"));
+    set(Capability::ZRAM_RECOMPRESS, zram_attr("recomp_algorithm"));
+    set(Capability::ZRAM_WRITEBACK, zram_attr("backing_dev"));
+    set(Capability::ZRAM_DEDUP, zram_attr("use_dedup"));
+
+    // Host syscalls, a fixture tree can't stand in for these
+    int pidfd = syscall(__NR_pidfd_open, getpid(), 0);
+    set(Capability::PIDFD, pidfd >= 0);
+    if (pidfd >= 0) {
+      // An empty vector only validates the advice
+      bool rejected = syscall(__NR_process_madvise, pidfd, nullptr, 0,
+                              MADV_PAGEOUT, 0) < 0 &&
+                      (errno == ENOSYS || errno == EINVAL);
+      set(Capability::PROCESS_MADVISE, !rejected);
+      close(pidfd);
+    }
+
+    char enabled[16] = {};
+    int fd = open(root_path("/sys/kernel/mm/lru_gen/enabled").c_str(),
+                  O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      read(fd, enabled, sizeof(enabled) - 1);
+      close(fd);
+    }
+    set(Capability::MGLRU,
+        enabled[0] == 'y' || strtoul(enabled, nullptr, 0) != 0);
+    set(Capability::LRU_GEN_STATS,
+        access(root_path("/sys/kernel/debug/lru_gen").c_str(), R_OK) == 0);
+    set(Capability::DAMON,
+        access(root_path("/sys/kernel/mm/damon/admin").c_str(), F_OK) == 0);
+    probe_cgroups();
+
+    apply_overrides();
+    log(duration<double, milli>(steady_clock::now() - start).count());
+  }
+
+  void probe_psi() {
+    for (const char *resource : PsiSample::resources) {
+      string path = root_path("/proc/pressure/") + resource;
+      int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) return;
+
+      char buf[256];
+      ssize_t len = read(fd, buf, sizeof(buf) - 1);
+      close(fd);
+      if (len <= 0) return;
+      buf[len] = '\0';
+
+      double avg[2][3];
+      uint64_t total[2];
+      bool has_full;
+      if (!parse_psi(buf, avg, total, has_full)) return;
+    }
+    set(Capability::PSI, true);
+
+    // A trigger only lives as long as its fd. Writes to a fixture tree
+    // would land in its files, there the capability comes from DYNV_CAPS.
+    int fd = open(root_path("/proc/pressure/memory").c_str(),
+                  O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return;
+    set(Capability::PSI_TRIGGER, on_procfs(fd) && arm_psi_trigger(fd, 150));
+    close(fd);
+  }
+
+  void probe_cgroups() {
+    FILE *mounts = fopen(root_path("/proc/mounts").c_str(), "re");
+    if (!mounts) return;
+    char line[512];
+    while (fgets(line, sizeof(line), mounts)) {
+      char type[32];
+      if (sscanf(line, "%*s %*s %31s", type) != 1) continue;
+      if (strcmp(type, "cgroup") == 0) set(Capability::CGROUP_V1, true);
+      if (strcmp(type, "cgroup2") == 0) set(Capability::CGROUP_V2, true);
+    }
+    fclose(mounts);
+  }
+
+  void apply_overrides() {
+    const char *spec = getenv("DYNV_CAPS");
+    if (!spec) return;
+
+    uint32_t probed_bits = bits;
+    stringstream list(spec);
+    string token;
+    while (getline(list, token, ',')) {
+      if (token.empty()) continue;
+      if (token == "none") {
+        bits = 0;
+        continue;
+      }
+      bool present = token[0] != '-';
+      string name = token[0] == '-' || token[0] == '+' ? token.substr(1) : token;
+      auto found = find_if(begin(names), end(names),
+                           [&](const char *n) { return name == n; });
+      if (found == end(names)) {
+        ALOGW("Unknown capability in DYNV_CAPS: %s", name.c_str());
+        continue;
+      }
+      uint32_t mask = 1u << (found - begin(names));
+      bits = present ? bits | mask : bits & ~mask;
+    }
+    forced = bits ^ probed_bits;
+  }
+
+  void log(double probe_ms) const {
+    string present, missing;
+    for (size_t i = 0; i < size(names); ++i) {
+      string &list = bits & (1u << i) ? present : missing;
+      if (!list.empty()) list += " ";
+      list += names[i];
+      if (forced & (1u << i)) list += "*";
+    }
+    ALOGI("Kernel capabilities 0x%04x in %.2f ms: %s", bits, probe_ms,
+          present.c_str());
+    if (!missing.empty()) ALOGI("Kernel lacks: %s", missing.c_str());
+    if (forced) ALOGI("Capabilities marked * are simulated by DYNV_CAPS.");
+    ALOGI("Selected: %s", describe_selection().c_str());
+  }
+};
+
+KernelCapabilities kernel_caps;
+
+/**
+ * Wakes the control loop when memory stalls pass a threshold within a
+ * second, so a pressure spike doesn't wait out the rest of the tick. Only
+ * armed where the kernel supports PSI triggers.
+ */
+class PressureTrigger {
+ public:
+  explicit PressureTrigger(int stall_ms) {
+    if (stall_ms <= 0 || !kernel_caps.has(Capability::PSI_TRIGGER)) return;
+
+    string path = root_path("/proc/pressure/memory");
+    fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd >= 0 && !on_procfs(fd)) {
+      ALOGI("PSI trigger simulated, %s is not procfs.", path.c_str());
+      close(fd);
+      fd = -1;
+      return;
+    }
+
+    if (fd < 0 || !arm_psi_trigger(fd, min(stall_ms, 1000))) {
+      ALOGW("Cannot arm PSI trigger (%s), waking once per tick.",
+            strerror(errno));
+      if (fd >= 0) close(fd);
+      fd = -1;
+      return;
+    }
+    ALOGI("PSI trigger: %d ms of memory stall per second", stall_ms);
+  }
+
+  ~PressureTrigger() {
+    if (fd >= 0) close(fd);
+  }
+
+  /**
+   * True once the threshold was crossed since the last call, never blocks.
+   */
+  bool fired() {
+    if (fd < 0) return false;
+
+    pollfd pfd{fd, POLLPRI, 0};
+    if (poll(&pfd, 1, 0) <= 0) return false;
+    if (pfd.revents & POLLERR) {
+      ALOGW("PSI trigger lost, waking once per tick.");
+      close(fd);
+      fd = -1;
+      return false;
+    }
+    return pfd.revents & POLLPRI;
+  }
+
+ private:
+  int fd = -1;
+};
+
+struct SchedulingConfig {
+  bool enable = true;
+  string control_cores = "little";
+  string worker_policy = "idle";
+  int worker_nice = 19;
+  bool worker_ioprio_idle = true;
+  int urgent_nice = -10;
+  int report_interval = 3600;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(enable, control_cores, worker_policy, worker_nice,
+            worker_ioprio_idle, urgent_nice, report_interval);
+  }
+
+  void load_from_yaml(const YAML::Node &config) {
+    auto node = config["scheduling"];
+    if (!node || !node.IsMap()) {
+      ALOGW("scheduling section not found in config.");
+      return;
+    }
+
+    enable = node["enable"].as<bool>(enable);
+    control_cores = node["control_cores"].as<string>(control_cores);
+    worker_policy = node["worker_policy"].as<string>(worker_policy);
+    worker_nice = clamp(node["worker_nice"].as<int>(worker_nice), -20, 19);
+    worker_ioprio_idle =
+        node["worker_ioprio_idle"].as<bool>(worker_ioprio_idle);
+    urgent_nice = clamp(node["urgent_nice"].as<int>(urgent_nice), -20, 19);
+    report_interval = max(node["report_interval"].as<int>(report_interval), 60);
+
+    ALOGD(
+        "scheduling enable: %d, control_cores: %s, worker_policy: %s, "
+        "worker_nice: %d, worker_ioprio_idle: %d, urgent_nice: %d",
+        enable, control_cores.c_str(), worker_policy.c_str(), worker_nice,
+        worker_ioprio_idle, urgent_nice);
+  }
+};
+
+constexpr int IOPRIO_WHO_PROCESS = 1;
+constexpr int IOPRIO_CLASS_SHIFT = 13;
+constexpr int IOPRIO_CLASS_IDLE = 3;
+
+/**
+ * Places dynv's threads: the control loop on little cores, swapoff and
+ * reclaim work at idle CPU and I/O priority, swapon briefly boosted. Keeps
+ * per-thread CPU time by core type to show where the work actually ran.
+ */
+class SchedulingController {
+ public:
+  void configure(const SchedulingConfig &new_config) {
+    lock_guard<mutex> guard(lock);
+    config = new_config;
+    clusters.clear();
+    for (auto &[capacity, cpus] : cpu_clusters()) clusters.push_back(cpus);
+    last_report = steady_clock::now();
+  }
+
+  /**
+   * Pins the calling thread to the configured control cores.
+   */
+  void place_control_thread() {
+    if (!config.enable || clusters.empty()) return;
+
+    vector<int> cpus;
+    if (config.control_cores == "big") {
+      cpus = clusters.back();
+    } else if (config.control_cores == "little") {
+      cpus = clusters.front();
+    } else {
+      for (const auto &cluster : clusters) {
+        cpus.insert(cpus.end(), cluster.begin(), cluster.end());
+      }
+    }
+    set_affinity(cpus);
+  }
+
+  /**
+   * Lowers the calling thread to worker priority for good, used by the
+   * swapoff threads. Child processes inherit it.
+   */
+  void demote_worker() {
+    if (!config.enable) return;
+    if (!clusters.empty()) set_affinity(clusters.front());
+    apply_worker_priority();
+  }
+
+  /**
+   * Runs work on the calling thread at worker priority, restoring the
+   * previous policy, nice and I/O priority afterwards.
+   */
+  template <typename F>
+  auto as_worker(F &&work) {
+    if (!config.enable) return work();
+    SavedPriority saved = save();
+    apply_worker_priority();
+    auto restore = make_scope_exit([&] { this->restore(saved); });
+    return work();
+  }
+
+  /**
+   * Runs work on every core at urgent nice, for swapon under pressure.
+   */
+  template <typename F>
+  auto as_urgent(F &&work) {
+    if (!config.enable) return work();
+    SavedPriority saved = save();
+    vector<int> all;
+    for (const auto &cluster : clusters) {
+      all.insert(all.end(), cluster.begin(), cluster.end());
+    }
+    set_affinity(all);
+    setpriority(PRIO_PROCESS, gettid(), config.urgent_nice);
+    auto restore = make_scope_exit([&] {
+      this->restore(saved);
+      place_control_thread();
+    });
+    return work();
+  }
+
+  /**
+   * Adds the calling thread's CPU time since its last call, attributed to
+   * the core type it is running on now.
+   */
+  void account(const char *name) {
+    static thread_local double last_ms = 0;
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    double now_ms = ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+    add(name, sched_getcpu(), now_ms - last_ms);
+    last_ms = now_ms;
+  }
+
+  /**
+   * Adds CPU time of a child process run by the calling thread. Workers
+   * are pinned to one core type, so the current core stands for it.
+   */
+  void account_child(const char *name, double cpu_ms) {
+    add(name, sched_getcpu(), cpu_ms);
+  }
+
+  void report() {
+    lock_guard<mutex> guard(lock);
+    auto now = steady_clock::now();
+    if (now - last_report < seconds(config.report_interval)) return;
+    last_report = now;
+
+    for (auto &[name, per_cluster] : cpu_ms) {
+      string line;
+      for (size_t i = 0; i < per_cluster.size(); ++i) {
+        char part[48];
+        snprintf(part, sizeof(part), "%s%s %.2fs", line.empty() ? "" : ", ",
+                 cluster_name(i).c_str(), per_cluster[i] / 1000);
+        line += part;
+      }
+      ALOGI("CPU time of %s by core type: %s", name.c_str(), line.c_str());
+      fill(per_cluster.begin(), per_cluster.end(), 0);
+    }
+  }
+
+ private:
+  struct SavedPriority {
+    int policy;
+    int nice;
+    int ioprio;
+  };
+
+  template <typename F>
+  struct ScopeExit {
+    F f;
+    ~ScopeExit() { f(); }
+  };
+  template <typename F>
+  static ScopeExit<F> make_scope_exit(F f) {
+    return {std::move(f)};
+  }
+
+  mutex lock;
+  SchedulingConfig config;
+  vector<vector<int>> clusters;
+  map<string, vector<double>> cpu_ms;
+  steady_clock::time_point last_report;
+
+  string cluster_name(size_t index) const {
+    if (clusters.size() == 1) return "all";
+    if (index == 0) return "little";
+    if (index + 1 == clusters.size()) return "big";
+    return clusters.size() == 3 ? "mid" : "cluster" + to_string(index);
+  }
+
+  void add(const char *name, int cpu, double ms) {
+    lock_guard<mutex> guard(lock);
+    auto &per_cluster = cpu_ms[name];
+    per_cluster.resize(clusters.size());
+    for (size_t i = 0; i < clusters.size(); ++i) {
+      if (contains(cpu, clusters[i])) {
+        per_cluster[i] += ms;
+        return;
+      }
+    }
+  }
+
+  static void set_affinity(const vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      ALOGW_ONCE("sched_setaffinity", "sched_setaffinity failed: %s",
+                 strerror(errno));
+    }
+  }
+
+  static SavedPriority save() {
+    errno = 0;
+    return {sched_getscheduler(0), getpriority(PRIO_PROCESS, gettid()),
+            static_cast<int>(
+                syscall(__NR_ioprio_get, IOPRIO_WHO_PROCESS, gettid()))};
+  }
+
+  static void restore(const SavedPriority &saved) {
+    sched_param param{};
+    sched_setscheduler(0, saved.policy, &param);
+    setpriority(PRIO_PROCESS, gettid(), saved.nice);
+    if (saved.ioprio >= 0) {
+      syscall(__NR_ioprio_set, IOPRIO_WHO_PROCESS, gettid(), saved.ioprio);
+    }
+  }
+
+  void apply_worker_priority() {
+    sched_param param{};
+    if (config.worker_policy == "idle") {
+      if (sched_setscheduler(0, SCHED_IDLE, &param) != 0) {
+        ALOGW_ONCE("sched_idle", "SCHED_IDLE unavailable: %s",
+                   strerror(errno));
+        setpriority(PRIO_PROCESS, gettid(), config.worker_nice);
+      }
+    } else {
+      setpriority(PRIO_PROCESS, gettid(), config.worker_nice);
+    }
+
+    if (config.worker_ioprio_idle &&
+        syscall(__NR_ioprio_set, IOPRIO_WHO_PROCESS, gettid(),
+                IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0) {
+      ALOGW_ONCE("ioprio", "ioprio_set failed: %s", strerror(errno));
+    }
+  }
+};
+
+SchedulingController sched_control;
+
+/**
+ * Full path of a program: under SYSTEM_BIN on Android, the first match in
+ * PATH elsewhere. The name itself when there's none, exec then fails.
+ */
+string find_executable(const string &name) {
+  if (!SYSTEM_BIN.empty()) return SYSTEM_BIN + name;
+  const char *path = getenv("PATH");
+  stringstream dirs(path ? path : "/usr/bin:/bin");
+  string dir;
+  while (getline(dirs, dir, ':')) {
+    string candidate = (dir.empty() ? "." : dir) + "/" + name;
+    if (access(candidate.c_str(), X_OK) == 0) return candidate;
+  }
+  return name;
+}
+
+/**
+ * Runs a shell command like system() and reports the CPU time the command
+ * used, so work done in child processes can be accounted to a thread.
+ */
+int run_accounted(const string &command, double &cpu_ms) {
+  pid_t child = fork();
+  if (child == 0) {
+    execl(SHELL.c_str(), "sh", "-c", command.c_str(), nullptr);
+    _exit(127);
+  }
+  if (child < 0) return -1;
+
+  int status = -1;
+  rusage usage{};
+  while (wait4(child, &status, 0, &usage) < 0 && errno == EINTR) {
+  }
+  cpu_ms = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+  return status;
+}
+
+/**
+ * Swap operation counters, updated by the control loop and the swapoff
+ * threads and read by the metrics endpoint.
+ */
+struct SwapStats {
+  struct Counter {
+    atomic<uint64_t> count{0};
+    atomic<uint64_t> failures{0};
+    atomic<uint64_t> duration_us{0};
+
+    void record(bool ok, steady_clock::time_point start) {
+      count.fetch_add(1, memory_order_relaxed);
+      if (!ok) failures.fetch_add(1, memory_order_relaxed);
+      duration_us.fetch_add(
+          duration_cast<microseconds>(steady_clock::now() - start).count(),
+          memory_order_relaxed);
+    }
+  };
+
+  Counter swapon[SWAP_TIER_COUNT];
+  Counter swapoff[SWAP_TIER_COUNT];
+};
+
+SwapStats swap_stats;
+
+/**
+ * How hard the control loop works and how well the headroom SLO holds.
+ * Kept in every mode, so the SLO controller can be compared with the
+ * threshold tables.
+ */
+struct ControlStats {
+  atomic<uint64_t> swappiness_change{0};  // Sum of |new - old swappiness|
+  atomic<uint64_t> reclaimed_pages{0};
+  atomic<uint64_t> available_violation_us{0};
+  atomic<uint64_t> psi_violation_us{0};
+  atomic<uint64_t> pressure_wakeups{0};  // Ticks started by a PSI trigger
+  atomic<int> effort_permille{-1};  // SLO controller output, -1 without it
+};
+
+ControlStats control_stats;
+
+/**
+ * Latency of the control loop stages: sample and decide run on the control
+ * thread each tick, actuate is measured per action from the decision to
+ * the action being done, power per screen and doze probe.
+ */
+struct PipelineStats {
+  struct Stage {
+    atomic<uint64_t> runs{0};
+    atomic<uint64_t> total_us{0};
+    atomic<uint64_t> max_us{0};
+
+    void record(steady_clock::time_point start) {
+      uint64_t us =
+          duration_cast<microseconds>(steady_clock::now() - start).count();
+      runs.fetch_add(1, memory_order_relaxed);
+      total_us.fetch_add(us, memory_order_relaxed);
+      if (us > max_us.load(memory_order_relaxed)) {
+        max_us.store(us, memory_order_relaxed);
+      }
+    }
+  };
+
+  Stage sample, decide, actuate, power;
+  atomic<uint64_t> coalesced{0};
+  atomic<uint32_t> queue_depth{0};
+  atomic<uint32_t> max_queue_depth{0};
+
+  void report() const {
+    const pair<const char *, const Stage *> stages[] = {
+        {"sample", &sample}, {"decide", &decide},
+        {"actuate", &actuate}, {"power", &power}};
+    string line;
+    for (const auto &[name, stage] : stages) {
+      uint64_t runs = stage->runs.load(memory_order_relaxed);
+      if (runs == 0) continue;
+      char part[96];
+      snprintf(part, sizeof(part), "%s%s avg %.2f ms max %.2f ms",
+               line.empty() ? "" : ", ", name,
+               stage->total_us.load(memory_order_relaxed) / 1e3 / runs,
+               stage->max_us.load(memory_order_relaxed) / 1e3);
+      line += part;
+    }
+    ALOGI("Pipeline: %s; queue max %u, %llu actions coalesced", line.c_str(),
+          max_queue_depth.load(memory_order_relaxed),
+          static_cast<unsigned long long>(
+              coalesced.load(memory_order_relaxed)));
+  }
+};
+
+PipelineStats pipeline_stats;
+
+/**
+ * Actuation stage of the control loop. Decisions are queued here and
+ * applied on a thread of its own, so a slow swapon or sysfs write never
+ * delays the next sample. Actions are keyed: a newer action replaces a
+ * queued one with the same key, so only the latest swappiness is written.
+ * Before start() actions run right away on the caller.
+ */
+class Actuator {
+ public:
+  void start() {
+    worker = thread([this] { run(); });
+  }
+
+  // Applies what's still queued, then stops
+  void stop() {
+    {
+      lock_guard<mutex> guard(lock);
+      stopping = true;
+    }
+    wake.notify_one();
+    if (worker.joinable()) worker.join();
+  }
+
+  void submit(const string &key, function<void()> action) {
+    if (!worker.joinable()) {
+      auto start = steady_clock::now();
+      action();
+      pipeline_stats.actuate.record(start);
+      return;
+    }
+
+    {
+      lock_guard<mutex> guard(lock);
+      auto queued = find_if(queue.begin(), queue.end(),
+                            [&](const Entry &e) { return e.key == key; });
+      if (queued != queue.end()) {
+        queued->action = move(action);
+        pipeline_stats.coalesced.fetch_add(1, memory_order_relaxed);
+      } else {
+        queue.push_back({key, move(action), steady_clock::now()});
+        update_depth();
+      }
+    }
+    wake.notify_one();
+  }
+
+  // Whether an action with this key is queued or running
+  bool pending(const string &key) {
+    lock_guard<mutex> guard(lock);
+    return key == running_key ||
+           any_of(queue.begin(), queue.end(),
+                  [&](const Entry &e) { return e.key == key; });
+  }
+
+  // Waits until every queued action is done
+  void flush() {
+    unique_lock<mutex> guard(lock);
+    done.wait(guard, [&] { return queue.empty() && running_key.empty(); });
+  }
+
+ private:
+  struct Entry {
+    string key;
+    function<void()> action;
+    steady_clock::time_point submitted;
+  };
+
+  thread worker;
+  mutex lock;
+  condition_variable wake;
+  condition_variable done;
+  deque<Entry> queue;
+  string running_key;
+  bool stopping = false;
+
+  void update_depth() {
+    uint32_t depth = queue.size();
+    pipeline_stats.queue_depth.store(depth, memory_order_relaxed);
+    if (depth > pipeline_stats.max_queue_depth.load(memory_order_relaxed)) {
+      pipeline_stats.max_queue_depth.store(depth, memory_order_relaxed);
+    }
+  }
+
+  void run() {
+    unique_lock<mutex> guard(lock);
+    while (true) {
+      wake.wait(guard, [&] { return stopping || !queue.empty(); });
+      if (queue.empty()) break;
+
+      Entry entry = move(queue.front());
+      queue.pop_front();
+      running_key = entry.key;
+      update_depth();
+      guard.unlock();
+
+      entry.action();
+      pipeline_stats.actuate.record(entry.submitted);
+      sched_control.account("actuator");
+
+      guard.lock();
+      running_key.clear();
+      done.notify_all();
+    }
+  }
+};
+
+Actuator actuator;
+
+// Function to perform swapoff on a single device
+void swapoff_th(const string &device) {
+  string command = SYSTEM_BIN + "swapoff " + device;
+  sched_control.demote_worker();
+
+  auto swap = swap_model.find_active(device);
+  int tier = swap ? static_cast<int>(swap->tier) : -1;
+  int number = swap ? swap->number : -1;
+  auto start = steady_clock::now();
+
+  double cpu_ms = 0;
+  int status = run_accounted(command, cpu_ms);
+  sched_control.account_child("swapoff", cpu_ms);
+  if (tier >= 0) swap_stats.swapoff[tier].record(status == 0, start);
+
+  if (status == 0) {
+    ALOGI("Swap: %s is turned off.", device.c_str());
+    journal.append(JournalType::SWAPOFF_DONE, 0, tier, number);
+    swap_model.mark_inactive(device);
+    remove_element(device, &swapoff_tracker);
+  } else {
+    journal.append(JournalType::SWAPOFF_DONE, JOURNAL_FAILED, tier, number);
+    remove_element(device, &swapoff_tracker);
+    ALOGE("Failed: Turn off %s", device.c_str());
+  }
+}
+
+bool swapoff_(const string &device, vector<thread> &threads,
+              optional<string> message = nullopt) {
+  bool cntn_the_swap = contains(device, swapoff_tracker);
+
+  if (!cntn_the_swap) {
+    ALOGI("[THREAD] Swapoff: %s. %s", device.c_str(),
+          message ? message->c_str() : "");
+    if (auto swap = swap_model.find_active(device)) {
+      journal.append(JournalType::SWAPOFF, 0, static_cast<int>(swap->tier),
+                     swap->number, swap->used_mb());
+    }
+    safe_push_back(device, swapoff_tracker);
+    threads.emplace_back(swapoff_th, device);
+    return true;
+  } else {
+    return false;
+  }
+}
+
+bool swapon(const string device, int priority) {
+  string command =
+      SYSTEM_BIN + "swapon -p " + to_string(priority) + " " + device;
+
+  if (system(command.c_str()) == 0) {
+    ALOGI("SWAPON: %s, priority: %d", device.c_str(), priority);
+
+    return true;
+  } else {
+    ALOGE("Failed: turn on swap %s", device.c_str());
+
+    return false;
+  }
+}
+
+/**
+ * Parses `dumpsys deviceidle get deep`, which prints the deep idle state
+ * alone: IDLE, ACTIVE, IDLE_PENDING and so on.
+ */
+bool parse_deep_idle(const char *output) {
+  while (isspace(static_cast<unsigned char>(*output))) output++;
+  size_t len = strlen(output);
+  while (len > 0 && isspace(static_cast<unsigned char>(output[len - 1]))) {
+    len--;
+  }
+  return len == 4 && strncmp(output, "IDLE", 4) == 0;
+}
+
+/**
+ * Parses `dumpsys power`: asleep when the display's wakefulness is Asleep.
+ */
+bool parse_asleep(const char *output) {
+  return strstr(output, "mWakefulness=Asleep") != nullptr;
+}
+
+bool is_doze_mode() {
+  FILE *pipe = popen("dumpsys deviceidle get deep", "r");
+  if (!pipe) {
+    cerr << "Failed to check Doze Mode!" << endl;
+    return false;
+  }
+
+  char buffer[128];
+  string result = "";
+
+  while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
+    result += buffer;
+  }
+
+  pclose(pipe);
+  return parse_deep_idle(result.c_str());
+}
+
+bool is_sleep_mode() {
+  FILE *pipe = popen("dumpsys power", "r");
+  if (!pipe) {
+    cerr << "Failed to check Sleep Mode!" << endl;
+    return false;
+  }
+
+  char buffer[128];
+  string result = "";
+
+  while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
+    result += buffer;
+  }
+
+  pclose(pipe);
+  return parse_asleep(result.c_str());
+}
+
+/**
+ * Screen and doze state, refreshed every second by a thread of its own
+ * because each probe runs dumpsys. The control loop and the swapoff timer
+ * read the cached values; before start() they probe directly.
+ */
+class PowerStateSampler {
+ public:
+  void start() {
+    refresh();
+    worker = thread([this] {
+      while (running && !stopping) {
+        for (int i = 0; i < 10 && running && !stopping; ++i) {
+          this_thread::sleep_for(milliseconds(100));
+        }
+        refresh();
+      }
+    });
+  }
+
+  void stop() {
+    stopping = true;
+    if (worker.joinable()) worker.join();
+  }
+
+  bool sleeping() const {
+    return worker.joinable() ? asleep.load() : is_sleep_mode();
+  }
+  bool doze() const { return worker.joinable() ? dozing.load() : is_doze_mode(); }
+
+ private:
+  thread worker;
+  atomic<bool> stopping{false};
+  atomic<bool> asleep{false};
+  atomic<bool> dozing{false};
+
+  void refresh() {
+    auto start = steady_clock::now();
+    dozing = is_doze_mode();
+    asleep = is_sleep_mode();
+    pipeline_stats.power.record(start);
+  }
+};
+
+PowerStateSampler power_state;
+
+void sleeper(int seconds, function<void()> on_complete = nullptr,
+             function<bool()> interrupt_check = nullptr) {
+  sleeper_alive = true;
+  bool interrupted = false;
+
+  auto deadline = steady_clock::now() + chrono::seconds(seconds);
+  ALOGI("Sleep for %d seconds...", seconds);
+
+  while (steady_clock::now() < deadline) {
+    this_thread::sleep_for(milliseconds(100));
+
+    if (!running || (interrupt_check && interrupt_check())) {
+      interrupted = true;
+      break;
+    }
+  }
+
+  if (!interrupted && on_complete) {
+    ALOGD("Sleep completed.");
+    on_complete();
+  }
+
+  sleeper_alive = false;
+}
+
+void start_swapoff_timer_if_idle(int wait_timeout) {
+  if (is_swapoff_session || !power_state.sleeping() || sleeper_alive) return;
+  thread([=] {
+    sleeper(
+        wait_timeout,
+        [] {
+          is_swapoff_session = true;
+          journal.append(JournalType::TIMER_FIRE);
+          ALOGI_ONCE("swapoff_session", "Swapoff session started...");
+          ALOG_RESET("swapoff_timer");
+        },
+        [] {
+          if (!power_state.sleeping()) {
+            ALOGI("Device woke before timeout, swapoff canceled.");
+            journal.append(JournalType::TIMER_CANCEL);
+            ALOG_RESET("swapoff_timer");
+            ALOG_RESET("swapoff_session");
+            return true;
+          }
+          return false;
+        });
+  }).detach();
+
+  journal.append(JournalType::TIMER_START, 0, wait_timeout);
+  ALOGI_ONCE("swapoff timer", "Idle detected. Timer for swapoff initiated...");
+}
+
+struct Config {
+  float config_version;
+  int swappiness_max;
+  int swappiness_min;
+  int zram_activation_threshold;
+  int zram_deactivation_threshold;
+  int swap_activation_threshold;
+  int swap_deactivation_threshold;
+  int swap_deactivation_time;
+  bool deactivate_in_sleep;
+  string threshold_type;
+  int psi_trigger_ms;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(config_version, swappiness_max, swappiness_min,
+            zram_activation_threshold, zram_deactivation_threshold,
+            swap_activation_threshold, swap_deactivation_threshold,
+            swap_deactivation_time, deactivate_in_sleep, threshold_type,
+            psi_trigger_ms);
+  }
+
+  void load_from_yaml(const YAML::Node &root) {
+    config_version = read_config(root, ".config_version", -1.0);
+    swappiness_max =
+        read_config(root, ".dynamic_swappiness.swappiness_range.max", 100);
+    swappiness_min =
+        read_config(root, ".dynamic_swappiness.swappiness_range.min", 80);
+    zram_activation_threshold =
+        read_config(root, ".virtual_memory.zram.activation_threshold", 70);
+    zram_deactivation_threshold =
+        read_config(root, ".virtual_memory.zram.deactivation_threshold", 50);
+    swap_activation_threshold =
+        read_config(root, ".virtual_memory.swap.activation_threshold", 90);
+    swap_deactivation_threshold =
+        read_config(root, ".virtual_memory.swap.deactivation_threshold", 50);
+    swap_deactivation_time = read_config(root, ".virtual_memory.wait_timeout", 10);
+    deactivate_in_sleep =
+        read_config(root, ".virtual_memory.deactivate_in_sleep", true);
+    threshold_type =
+        read_config(root, ".dynamic_swappiness.threshold_type", string("psi"));
+    psi_trigger_ms =
+        read_config(root, ".dynamic_swappiness.psi_trigger_ms", 100);
+  }
+};
+
+struct SwapTierConfig {
+  array<SwapTierPolicy, SWAP_TIER_COUNT> policies{};
+  vector<string> backing_devices;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(policies, backing_devices);
+  }
+
+  void load_from_yaml(const Config &config, const YAML::Node &root) {
+    policies[static_cast<int>(SwapTier::ZRAM)] = {
+        config.zram_activation_threshold, config.zram_deactivation_threshold,
+        32767};
+    policies[static_cast<int>(SwapTier::FILE)] = {
+        config.swap_activation_threshold, config.swap_deactivation_threshold,
+        10000};
+
+    SwapTierPolicy backing = {90, 40, 20000};
+    auto node =
+        root["virtual_memory"] ? root["virtual_memory"]["backing"] : YAML::Node();
+    if (node && node.IsMap()) {
+      backing.activation_threshold =
+          node["activation_threshold"].as<int>(backing.activation_threshold);
+      backing.deactivation_threshold = node["deactivation_threshold"].as<int>(
+          backing.deactivation_threshold);
+      if (node["devices"] && node["devices"].IsSequence()) {
+        backing_devices = node["devices"].as<vector<string>>();
+      }
+    }
+    policies[static_cast<int>(SwapTier::BACKING)] = backing;
+
+    for (int i = 0; i < SWAP_TIER_COUNT; ++i) {
+      ALOGD("Swap tier %s: activation %d%%, deactivation %dMB, priority %d",
+            tier_name(static_cast<SwapTier>(i)),
+            policies[i].activation_threshold,
+            policies[i].deactivation_threshold, policies[i].base_priority);
+    }
+  }
+};
+
+struct PressureMapping {
+  vector<pair<int, int>> cpu;
+  vector<pair<int, int>> memory;
+  vector<pair<int, int>> io;
+  vector<pair<int, int>> mem_pressure;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(cpu, memory, io, mem_pressure);
+  }
+};
+
+struct DynamicSwappinessConfig {
+  int min_swappiness;
+  int max_swappiness;
+  Config _config;
+  string threshold_type = _config.threshold_type;
+  PressureMapping pressure_mapping;
+  string mode;
+  int levels;
+  int cpu_max;
+  int cpu_min;
+  int mem_max;
+  int mem_min;
+  int io_max;
+  int io_min;
+  string cpu_time_window;
+  string mem_time_window;
+  string io_time_window;
+  string cpu_level;
+  string mem_level;
+  string io_level;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    // _config only supplies defaults while loading
+    archive(min_swappiness, max_swappiness, threshold_type, pressure_mapping,
+            mode, levels, cpu_max, cpu_min, mem_max, mem_min, io_max, io_min,
+            cpu_time_window, mem_time_window, io_time_window, cpu_level,
+            mem_level, io_level);
+  }
+
+  string pressure_to_string(const vector<pair<int, int>> &pressure_vec) {
+    stringstream ss;
+    for (size_t i = 0; i < pressure_vec.size(); ++i) {
+      ss << "[" << pressure_vec[i].first << "," << pressure_vec[i].second
+         << "]";
+      if (i != pressure_vec.size() - 1) {
+        ss << ", ";
+      }
+    }
+    return ss.str();
+  }
+
+  void load_from_yaml(const YAML::Node &config) {
+    ALOGD("Loading DynamicSwappinessConfig from YAML...");
+    auto dyn = config["dynamic_swappiness"];
+    if (!dyn) {
+      ALOGW("dynamic_swappiness section not found in config.");
+      return;
+    }
+
+    threshold_type = (dyn["threshold_type"] && dyn["threshold_type"].IsScalar())
+                         ? dyn["threshold_type"].as<string>()
+                         : "psi";
+    if (dyn["swappiness_range"] && dyn["swappiness_range"].IsMap()) {
+      min_swappiness = (dyn["swappiness_range"]["min"] &&
+                        dyn["swappiness_range"]["min"].IsScalar())
+                           ? dyn["swappiness_range"]["min"].as<int>()
+                           : _config.swappiness_min;
+      max_swappiness = (dyn["swappiness_range"]["max"] &&
+                        dyn["swappiness_range"]["max"].IsScalar())
+                           ? dyn["swappiness_range"]["max"].as<int>()
+                           : _config.swappiness_max;
+    } else {
+      min_swappiness = _config.swappiness_min;
+      max_swappiness = _config.swappiness_max;
+    }
+    // The bounds end up in std::clamp, which needs min <= max
+    if (min_swappiness > max_swappiness) {
+      ALOGW("swappiness_range min %d is above max %d, swapped.",
+            min_swappiness, max_swappiness);
+      swap(min_swappiness, max_swappiness);
+    }
+
+    ALOGD("threshold_type: %s", threshold_type.c_str());
+    ALOGD("min_swappiness: %d, max_swappiness: %d", min_swappiness,
+          max_swappiness);
+
+    auto psi = dyn["threshold_psi"];
+    if (psi) {
+      // Provide default values if not present in YAML
+      pressure_mapping.cpu =
+          psi["cpu_pressure"] && psi["cpu_pressure"].IsSequence()
+              ? parse_pressure_pairs(psi["cpu_pressure"])
+              : vector<pair<int, int>>{
+                    {10, 160}, {20, 120}, {30, 80}, {40, 60}, {80, 40}};
+      pressure_mapping.memory =
+          psi["memory_pressure"] && psi["memory_pressure"].IsSequence()
+              ? parse_pressure_pairs(psi["memory_pressure"])
+              : vector<pair<int, int>>{
+                    {5, 160}, {10, 140}, {15, 100}, {20, 60}, {25, 40}};
+      pressure_mapping.io =
+          psi["io_pressure"] && psi["io_pressure"].IsSequence()
+              ? parse_pressure_pairs(psi["io_pressure"])
+              : vector<pair<int, int>>{
+                    {10, 140}, {15, 100}, {20, 80}, {25, 100}};
+
+      ALOGD("CPU Pressure Mapping: %s",
+            pressure_to_string(pressure_mapping.cpu).c_str());
+      ALOGD("Memory Pressure Mapping: %s",
+            pressure_to_string(pressure_mapping.memory).c_str());
+      ALOGD("IO Pressure Mapping: %s",
+            pressure_to_string(pressure_mapping.io).c_str());
+    } else {
+      ALOGW("threshold_psi section not found in config.");
+    }
 
     auto mem = dyn["threshold_mem_pressure"];
     mode = (psi && psi["mode"] && psi["mode"].IsScalar())
@@ -929,400 +2989,5144 @@ struct DynamicSwappinessConfig {
                          ? psi["auto_io"]["time_window"].as<string>()
                          : "avg60";
 
-    ALOGD("mode: %s, levels: %d", mode.c_str(), levels);
-    ALOGD(
-        "cpu_max: %d, cpu_min: %d, mem_max: %d, mem_min: %d, io_max: %d, "
-        "io_min: %d",
-        cpu_max, cpu_min, mem_max, mem_min, io_max, io_min);
-    ALOGD("cpu_time_window: %s, mem_time_window: %s, io_time_window: %s",
-          cpu_time_window.c_str(), mem_time_window.c_str(),
-          io_time_window.c_str());
+    auto read_level = [&](const char *section) -> string {
+      return (psi && psi[section] && psi[section]["level"] &&
+              psi[section]["level"].IsScalar())
+                 ? psi[section]["level"].as<string>()
+                 : "some";
+    };
+    cpu_level = read_level("auto_cpu");
+    mem_level = read_level("auto_memory");
+    io_level = read_level("auto_io");
+
+    ALOGD("mode: %s, levels: %d", mode.c_str(), levels);
+    ALOGD(
+        "cpu_max: %d, cpu_min: %d, mem_max: %d, mem_min: %d, io_max: %d, "
+        "io_min: %d",
+        cpu_max, cpu_min, mem_max, mem_min, io_max, io_min);
+    ALOGD("cpu_time_window: %s, mem_time_window: %s, io_time_window: %s",
+          cpu_time_window.c_str(), mem_time_window.c_str(),
+          io_time_window.c_str());
+    ALOGD("cpu_level: %s, mem_level: %s, io_level: %s", cpu_level.c_str(),
+          mem_level.c_str(), io_level.c_str());
+  }
+};
+
+/**
+ * Spreads [min_value, max_value] into levels + 1 ascending steps.
+ */
+vector<int> compute_steps(int min_value, int max_value, int levels) {
+  vector<int> steps;
+  double step = (max_value - min_value) / static_cast<double>(levels);
+  for (int i = 0; i <= levels; ++i) {
+    steps.insert(steps.begin(), static_cast<int>(round(max_value - i * step)));
+  }
+  return steps;
+}
+
+/**
+ * Maps pressure within [pressure_min, pressure_max] to a step index: 0 at the
+ * highest pressure, `levels` at the lowest.
+ */
+int pressure_to_level(double pressure, double pressure_min,
+                      double pressure_max, int levels) {
+  pressure = clamp(pressure, pressure_min, pressure_max);
+  double norm = (pressure - pressure_min) / (pressure_max - pressure_min);
+  int index = round((1.0 - norm) * levels);
+  return clamp(index, 0, levels);
+}
+
+/**
+ * Returns the value of the highest threshold the pressure reached in a table
+ * sorted by descending threshold, or -1 if none was reached.
+ */
+int lookup_pressure_table(const vector<pair<int, int>> &table,
+                          double pressure) {
+  for (const auto &[threshold, value] : table) {
+    if (pressure >= threshold) return value;
+  }
+  return -1;
+}
+
+vector<pair<int, int>> sort_desc(const vector<pair<int, int>> &table) {
+  auto sorted = table;
+  sort(sorted.begin(), sorted.end(),
+       [](const auto &a, const auto &b) { return a.first > b.first; });
+  return sorted;
+}
+
+bool psi_available() {
+  for (const char *resource : PsiSample::resources) {
+    if (access(root_path(string("/proc/pressure/") + resource).c_str(),
+               R_OK) != 0) {
+      ALOGW_ONCE("psi_unavailable",
+                 "PSI metrics unavailable. Falling back to mem_pressure.");
+      return false;
+    }
+  }
+  return true;
+}
+
+void log_if_threshold(const char *tag, int swappiness, double cpu, double mem,
+                      double io) {
+  if (swappiness != -1) {
+    ALOGI_ONCE(tag,
+               "[THRESHOLD] [%s] Swappiness: %d | Pressures: CPU=%.2f, "
+               "MEM=%.2f, IO=%.2f",
+               tag, swappiness, cpu, mem, io);
+  } else {
+    ALOG_RESET(tag);
+  }
+}
+
+/**
+ * Swappiness policies. Each one precomputes everything it can from the
+ * config, so evaluate() is straight-line code without string compares or
+ * allocations. SwappinessManager picks one when it is built.
+ */
+class PsiAutoPolicy {
+ public:
+  PsiAutoPolicy(const DynamicSwappinessConfig &config, const PsiSource &cpu,
+                const PsiSource &mem, const PsiSource &io)
+      : inputs{{{cpu, static_cast<double>(config.cpu_min),
+                 static_cast<double>(config.cpu_max), "cpu_pressure",
+                 config.cpu_time_window.c_str()},
+                {mem, static_cast<double>(config.mem_min),
+                 static_cast<double>(config.mem_max), "mem_pressure",
+                 config.mem_time_window.c_str()},
+                {io, static_cast<double>(config.io_min),
+                 static_cast<double>(config.io_max), "io_pressure",
+                 config.io_time_window.c_str()}}},
+        levels(config.levels),
+        steps(compute_steps(config.min_swappiness, config.max_swappiness,
+                            config.levels)) {}
+
+  int evaluate(const PsiSample &psi, int) const {
+    double pressures[3];
+    int values[3];
+    for (int i = 0; i < 3; ++i) {
+      const Input &input = inputs[i];
+      pressures[i] = psi.get(input.source);
+      int index = pressure_to_level(pressures[i], input.min, input.max, levels);
+      values[i] = steps[index];
+      log_level(input, pressures[i], index);
+    }
+
+    int swappiness = min({values[0], values[1], values[2]});
+    log_if_threshold("sparsed_swappiness", swappiness, pressures[0],
+                     pressures[1], pressures[2]);
+    ALOGI_ONCE(
+        "swappiness_eval",
+        "[AUTO MODE] CPU(%s): %.2f → %d, MEM(%s): %.2f → %d, IO(%s): %.2f → "
+        "%d → FINAL: %d",
+        inputs[0].window, pressures[0], values[0], inputs[1].window,
+        pressures[1], values[1], inputs[2].window, pressures[2], values[2],
+        swappiness);
+    return swappiness;
+  }
+
+ private:
+  struct Input {
+    PsiSource source;
+    double min;
+    double max;
+    const char *log_id;
+    const char *window;
+  };
+
+  array<Input, 3> inputs;
+  int levels;
+  vector<int> steps;
+
+  // The step list is only formatted when the message is actually logged
+  void log_level(const Input &input, double pressure, int index) const {
+    if (log_manager.logged(input.log_id)) return;
+
+    double clamped = clamp(pressure, input.min, input.max);
+    double norm = (clamped - input.min) / (input.max - input.min);
+    ostringstream oss;
+    for (size_t i = 0; i < steps.size(); ++i) {
+      if (static_cast<int>(i) == index) {
+        oss << "[" << steps[i] << "]";
+      } else {
+        oss << steps[i];
+      }
+      if (i != steps.size() - 1) oss << " ";
+    }
+
+    ALOGI_ONCE(input.log_id,
+               "[%s] PSI: %.2f normalized to %.4f (reversed: %.4f). "
+               "Using level %d → swappiness %d from steps [%s]",
+               input.log_id, pressure, norm, 1.0 - norm, index, steps[index],
+               oss.str().c_str());
+  }
+};
+
+class PsiManualPolicy {
+ public:
+  PsiManualPolicy(const DynamicSwappinessConfig &config, const PsiSource &cpu,
+                  const PsiSource &mem, const PsiSource &io)
+      : sources{cpu, mem, io},
+        tables{sort_desc(config.pressure_mapping.cpu),
+               sort_desc(config.pressure_mapping.memory),
+               sort_desc(config.pressure_mapping.io)},
+        min_swappiness(config.min_swappiness),
+        max_swappiness(config.max_swappiness) {}
+
+  int evaluate(const PsiSample &psi, int) const {
+    static const char *const tags[] = {"cpu_threshold", "mem_threshold",
+                                       "io_threshold"};
+    double pressures[3];
+    int values[3];
+    for (int i = 0; i < 3; ++i) {
+      pressures[i] = psi.get(sources[i]);
+      values[i] =
+          max(lookup_pressure_table(tables[i], pressures[i]), min_swappiness);
+    }
+
+    int swappiness = max({values[0], values[1], values[2]});
+    for (int i = 0; i < 3; ++i) {
+      log_if_threshold(tags[i], values[i], pressures[0], pressures[1],
+                       pressures[2]);
+    }
+    return (swappiness != -1) ? swappiness : max_swappiness;
+  }
+
+ private:
+  array<PsiSource, 3> sources;
+  array<vector<pair<int, int>>, 3> tables;
+  int min_swappiness;
+  int max_swappiness;
+};
+
+class LegacyPolicy {
+ public:
+  explicit LegacyPolicy(const DynamicSwappinessConfig &config)
+      : table(sort_desc(config.pressure_mapping.mem_pressure)),
+        max_swappiness(config.max_swappiness) {}
+
+  int evaluate(const PsiSample &, int memory_pressure) const {
+    int swappiness = lookup_pressure_table(table, memory_pressure);
+    return (swappiness != -1) ? swappiness : max_swappiness;
+  }
+
+ private:
+  vector<pair<int, int>> table;
+  int max_swappiness;
+};
+
+using SwappinessPolicy = variant<PsiAutoPolicy, PsiManualPolicy, LegacyPolicy>;
+
+const char *policy_name(const SwappinessPolicy &policy) {
+  static const char *const names[] = {"psi-auto", "psi-manual", "legacy"};
+  return names[policy.index()];
+}
+
+class SwappinessManager {
+ public:
+  SwappinessManager(const DynamicSwappinessConfig &config)
+      : config(&config), last_swappiness(-1), policy(select_policy(config)) {
+    ALOGI("Swappiness policy: %s", name());
+  }
+
+  /**
+   * Switches to another config, e.g. an app profile. The policy is rebuilt
+   * here so the next evaluate() costs the same as before.
+   */
+  void use_config(const DynamicSwappinessConfig &next) {
+    if (&next == config) return;
+    config = &next;
+    policy = select_policy(next);
+    reset_threshold_logs();
+  }
+
+  int get_swappiness(const PsiSample &psi, int memory_pressure) {
+    // PSI files are probed again only when reading them failed
+    if (!psi.valid && !holds_alternative<LegacyPolicy>(policy) &&
+        !psi_available()) {
+      policy = LegacyPolicy(*config);
+      ALOGI("Swappiness policy: %s", name());
+    }
+
+    int swappiness = visit(
+        [&](const auto &p) { return p.evaluate(psi, memory_pressure); },
+        policy);
+    return clamp(swappiness, config->min_swappiness, config->max_swappiness);
+  }
+
+  void apply_swappiness(int &swappiness) {
+    if (swappiness != last_swappiness) {
+      ALOGI("Swappiness -> %d", swappiness);
+      journal.append(JournalType::SWAPPINESS, 0, swappiness, last_swappiness);
+      actuator.submit("swappiness",
+                      [swappiness] { write_swappiness(swappiness); });
+      if (last_swappiness >= 0) {
+        control_stats.swappiness_change.fetch_add(
+            abs(swappiness - last_swappiness), memory_order_relaxed);
+      }
+      last_swappiness = swappiness;
+      reset_threshold_logs();
+    }
+  }
+
+  int current_swappiness() const { return last_swappiness; }
+  const DynamicSwappinessConfig &current_config() const { return *config; }
+
+  // The SLO controller sets swappiness itself, the policy is only its fallback
+  const char *name() const {
+    return config->threshold_type == "slo" ? "slo" : policy_name(policy);
+  }
+
+  // False for the legacy policy and the SLO controller, which own their inputs
+  bool reads_psi() const {
+    return config->threshold_type != "slo" &&
+           !holds_alternative<LegacyPolicy>(policy);
+  }
+
+  // Takes over a swappiness already in the kernel without writing it again
+  void resume(int swappiness) { last_swappiness = swappiness; }
+
+ private:
+  const DynamicSwappinessConfig *config;
+  int last_swappiness;
+  SwappinessPolicy policy;
+
+  static SwappinessPolicy select_policy(const DynamicSwappinessConfig &config) {
+    if (config.threshold_type != "psi" || !kernel_caps.has(Capability::PSI)) {
+      return LegacyPolicy(config);
+    }
+
+    // Resolved once, windows are computed by the shared PsiSampler
+    PsiSource cpu = psi_sampler.resolve(PsiResource::CPU,
+                                        config.cpu_time_window, config.cpu_level);
+    PsiSource mem = psi_sampler.resolve(PsiResource::MEMORY,
+                                        config.mem_time_window, config.mem_level);
+    PsiSource io = psi_sampler.resolve(PsiResource::IO, config.io_time_window,
+                                       config.io_level);
+    if (config.mode == "auto") return PsiAutoPolicy(config, cpu, mem, io);
+    return PsiManualPolicy(config, cpu, mem, io);
+  }
+
+  void reset_threshold_logs() {
+    ALOG_RESET("cpu_threshold");
+    ALOG_RESET("mem_threshold");
+    ALOG_RESET("io_threshold");
+    ALOG_RESET("cpu_pressure");
+    ALOG_RESET("mem_pressure");
+    ALOG_RESET("io_pressure");
+    ALOG_RESET("swappiness_eval");
+  }
+};
+
+struct SloConfig {
+  int min_available_mb = 1024;
+  int max_memory_psi = 10;
+  string time_window = "avg10";
+  double gain = 0.02;
+  double proportional = 0.5;
+  int margin = 25;
+  int escalate_after = 10;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(min_available_mb, max_memory_psi, time_window, gain,
+            proportional, margin, escalate_after);
+  }
+
+  void load_from_yaml(const YAML::Node &config) {
+    auto slo = config["dynamic_swappiness"]
+                   ? config["dynamic_swappiness"]["threshold_slo"]
+                   : YAML::Node();
+    if (!slo || !slo.IsMap()) {
+      ALOGW("dynamic_swappiness.threshold_slo section not found in config.");
+      return;
+    }
+
+    min_available_mb =
+        max(slo["min_available_mb"].as<int>(min_available_mb), 1);
+    max_memory_psi = max(slo["max_memory_psi"].as<int>(max_memory_psi), 1);
+    time_window = slo["time_window"].as<string>(time_window);
+    gain = clamp(slo["gain"].as<double>(gain), 0.0, 1.0);
+    proportional = clamp(slo["proportional"].as<double>(proportional), 0.0, 10.0);
+    margin = clamp(slo["margin"].as<int>(margin), 0, 400);
+    escalate_after = max(slo["escalate_after"].as<int>(escalate_after), 1);
+
+    ALOGD(
+        "slo min_available_mb: %d, max_memory_psi: %d (%s), gain: %.3f, "
+        "proportional: %.2f, margin: %d, escalate_after: %d",
+        min_available_mb, max_memory_psi, time_window.c_str(), gain,
+        proportional, margin, escalate_after);
+  }
+};
+
+/**
+ * Headroom SLO controller for threshold_type "slo": keeps MemAvailable above
+ * a floor and memory PSI below a ceiling by moving a single effort value
+ * between 0 and 1, with a PI loop around the floor plus margin.
+ *
+ * Effort maps onto the swappiness range. Effort held at the top while the
+ * floor is still violated asks for another swap device, reclaim runs only
+ * while headroom is under floor plus margin, and swap is drained only when
+ * the pages coming back still leave that much. Above the floor, stalls over
+ * the ceiling are taken as swap thrashing and lower the effort.
+ *
+ * Violations are accounted in every mode; only the controlling mode acts.
+ */
+class SloController {
+ public:
+  SloController(const SloConfig &config, bool controlling)
+      : config(config),
+        active(controlling),
+        source(psi_sampler.resolve(PsiResource::MEMORY, config.time_window,
+                                   "some")),
+        target_mb(config.min_available_mb * (100L + config.margin) / 100) {
+    if (controlling) {
+      control_stats.effort_permille.store(0, memory_order_relaxed);
+      ALOGI("SLO controller: %d MB available, memory PSI below %d",
+            config.min_available_mb, config.max_memory_psi);
+    }
+  }
+
+  void update(const PsiSample &psi, const MemInfo &info) {
+    auto now = steady_clock::now();
+    double dt = last_update == steady_clock::time_point{}
+                    ? 1.0
+                    : duration<double>(now - last_update).count();
+    dt = min(dt, 10.0);
+    last_update = now;
+
+    valid = info.has_available;
+    if (!valid) return;
+    available_mb = info.mem_available >> 10;
+    pressure = psi.valid ? psi.get(source) : NAN;
+    below_floor = available_mb < config.min_available_mb;
+    stalled = !isnan(pressure) && pressure > config.max_memory_psi;
+
+    auto us = static_cast<uint64_t>(dt * 1e6);
+    if (below_floor) {
+      control_stats.available_violation_us.fetch_add(us, memory_order_relaxed);
+    }
+    if (stalled) {
+      control_stats.psi_violation_us.fetch_add(us, memory_order_relaxed);
+    }
+    if (below_floor || stalled) {
+      ALOGW_ONCE("slo_violation",
+                 "SLO violated: %ld MB available (floor %d), memory PSI "
+                 "%.2f (ceiling %d)",
+                 available_mb, config.min_available_mb, pressure,
+                 config.max_memory_psi);
+    } else {
+      ALOG_RESET("slo_violation");
+    }
+    if (!active) return;
+
+    // Positive while headroom is short of the floor plus margin
+    double error = (target_mb - available_mb) / static_cast<double>(target_mb);
+    if (!below_floor && stalled) {
+      error = min(error, (config.max_memory_psi - pressure) /
+                             config.max_memory_psi);
+    }
+    error = clamp(error, -1.0, 1.0);
+    integral = clamp(integral + config.gain * error * dt, 0.0, 1.0);
+    effort = clamp(integral + config.proportional * error, 0.0, 1.0);
+    control_stats.effort_permille.store(lround(effort * 1000),
+                                        memory_order_relaxed);
+
+    saturated_s = below_floor && effort >= 0.99 ? saturated_s + dt : 0;
+  }
+
+  bool controlling() const { return active; }
+
+  int swappiness(const DynamicSwappinessConfig &range) const {
+    return static_cast<int>(
+        lround(range.min_swappiness +
+               effort * (range.max_swappiness - range.min_swappiness)));
+  }
+
+  // Full effort hasn't brought headroom back for escalate_after seconds
+  bool wants_swap() const {
+    return active && saturated_s >= config.escalate_after;
+  }
+
+  void swap_added() { saturated_s = 0; }
+
+  bool wants_reclaim() const {
+    return active && valid && available_mb < target_mb && !stalled;
+  }
+
+  // Whether swapping used_mb back in keeps the SLO
+  bool can_release(long used_mb) const {
+    if (!active) return true;
+    return valid && !stalled && available_mb - used_mb > target_mb;
+  }
+
+  long available() const { return available_mb; }
+
+ private:
+  const SloConfig &config;
+  const bool active;
+  PsiSource source;
+  const long target_mb;
+  bool valid = false;
+  bool below_floor = false;
+  bool stalled = false;
+  long available_mb = 0;
+  double pressure = NAN;
+  double integral = 0;
+  double effort = 0;
+  double saturated_s = 0;
+  steady_clock::time_point last_update{};
+};
+
+struct VmKnobConfig {
+  string name;
+  string path;
+  bool enable = false;
+  PsiResource resource = PsiResource::MEMORY;
+  string time_window = "avg10";
+  string level = "some";
+  int pressure_min = 0;
+  int pressure_max = 20;
+  int min_value;
+  int max_value;
+  bool rise_with_pressure = true;
+  int levels = 4;
+  int min_interval = 10;
+  vector<pair<int, int>> table;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(name, path, enable, resource, time_window, level, pressure_min,
+            pressure_max, min_value, max_value, rise_with_pressure, levels,
+            min_interval, table);
+  }
+};
+
+/**
+ * VM knobs the controller knows how to drive, with the range used when the
+ * config leaves it out. The ranges are starting points, not kernel
+ * defaults: the kernel sizes min_free_kbytes from the RAM at boot and
+ * Android's init may raise it, so that knob is never set below the value
+ * it had at boot (floor_at_boot).
+ */
+static const struct {
+  const char *name;
+  const char *path;
+  int min_value;
+  int max_value;
+  bool rise_with_pressure;
+  bool floor_at_boot;
+} known_vm_knobs[] = {
+    {"watermark_scale_factor", "/proc/sys/vm/watermark_scale_factor", 10, 200,
+     true, false},
+    {"min_free_kbytes", "/proc/sys/vm/min_free_kbytes", 8192, 32768, true,
+     true},
+    {"compaction_proactiveness", "/proc/sys/vm/compaction_proactiveness", 0,
+     20, false, false},
+    {"page-cluster", "/proc/sys/vm/page-cluster", 0, 3, false, false},
+    {"vfs_cache_pressure", "/proc/sys/vm/vfs_cache_pressure", 100, 200, true,
+     false},
+    {"min_ttl_ms", "/sys/kernel/mm/lru_gen/min_ttl_ms", 0, 1000, true, false},
+};
+
+// "<boot_id>" then "<knob> <value>" lines, the boot values of floored knobs
+const string VM_KNOB_BOOT_FILE = LOG_FOLDER + "/vm_knobs.boot";
+
+struct VmKnobsConfig {
+  bool enable = false;
+  vector<VmKnobConfig> knobs;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(enable, knobs);
+  }
+
+  void load_from_yaml(const YAML::Node &config) {
+    auto section = config["vm_knobs"];
+    if (!section || !section.IsMap()) {
+      ALOGW("vm_knobs section not found in config.");
+      return;
+    }
+    enable = section["enable"] && section["enable"].as<bool>();
+
+    for (const auto &known : known_vm_knobs) {
+      auto node = section[known.name];
+      if (!node || !node.IsMap()) continue;
+
+      VmKnobConfig knob;
+      knob.name = known.name;
+      knob.path = root_path(known.path);
+      knob.enable = node["enable"] && node["enable"].as<bool>();
+      knob.min_value = known.min_value;
+      knob.max_value = known.max_value;
+      knob.rise_with_pressure = known.rise_with_pressure;
+
+      string resource =
+          node["resource"] ? node["resource"].as<string>() : "memory";
+      knob.resource = resource == "cpu"  ? PsiResource::CPU
+                      : resource == "io" ? PsiResource::IO
+                                         : PsiResource::MEMORY;
+      if (node["time_window"])
+        knob.time_window = node["time_window"].as<string>();
+      if (node["level"]) knob.level = node["level"].as<string>();
+      if (node["pressure"] && node["pressure"].IsMap()) {
+        knob.pressure_min = node["pressure"]["min"].as<int>(knob.pressure_min);
+        knob.pressure_max = node["pressure"]["max"].as<int>(knob.pressure_max);
+      }
+      if (node["range"] && node["range"].IsMap()) {
+        knob.min_value = node["range"]["min"].as<int>(knob.min_value);
+        knob.max_value = node["range"]["max"].as<int>(knob.max_value);
+      }
+      if (node["direction"])
+        knob.rise_with_pressure = node["direction"].as<string>() != "down";
+      knob.levels = max(node["levels"].as<int>(knob.levels), 1);
+      knob.min_interval = node["min_interval"].as<int>(knob.min_interval);
+      knob.table = sort_desc(parse_pressure_pairs(node["table"]));
+
+      if (knob.pressure_max <= knob.pressure_min) {
+        ALOGW("vm_knobs.%s: pressure max must be above min, disabled.",
+              knob.name.c_str());
+        knob.enable = false;
+      }
+
+      ALOGD(
+          "vm_knob %s enable: %d, pressure: [%d, %d], range: [%d, %d], "
+          "levels: %d, min_interval: %d, table entries: %zu",
+          knob.name.c_str(), knob.enable, knob.pressure_min, knob.pressure_max,
+          knob.min_value, knob.max_value, knob.levels, knob.min_interval,
+          knob.table.size());
+      if (knob.enable) knobs.push_back(knob);
+    }
+  }
+};
+
+/**
+ * Drives several VM knobs from the same pressure-to-value machinery as
+ * SwappinessManager. Each knob has its own mapping, limits and minimum
+ * interval between writes; all of them read the tick's shared PsiSample.
+ */
+class VmKnobController {
+ public:
+  VmKnobController(const VmKnobsConfig &config) {
+    if (!config.enable) return;
+
+    for (const auto &knob_config : config.knobs) {
+      if (access(knob_config.path.c_str(), W_OK) != 0) {
+        ALOGW("VM knob %s not supported by kernel (%s), skipped.",
+              knob_config.name.c_str(), knob_config.path.c_str());
+        continue;
+      }
+      int index = 0;
+      while (knob_config.name != known_vm_knobs[index].name) index++;
+
+      VmKnobConfig limited = knob_config;
+      if (known_vm_knobs[index].floor_at_boot &&
+          !apply_boot_floor(limited)) {
+        continue;
+      }
+      knobs.push_back({limited, index,
+                       psi_sampler.resolve(limited.resource,
+                                           limited.time_window, limited.level),
+                       SysctlWriter(limited.path),
+                       compute_steps(limited.min_value, limited.max_value,
+                                     limited.levels),
+                       steady_clock::time_point()});
+    }
+  }
+
+  void apply(const PsiSample &psi) {
+    if (!psi.valid) return;
+
+    auto now = steady_clock::now();
+    for (auto &knob : knobs) {
+      const auto &config = knob.config;
+      if (now - knob.last_write < seconds(config.min_interval)) continue;
+
+      double pressure = psi.get(knob.source);
+      int value = evaluate(knob, pressure);
+      if (value != knob.value) {
+        knob.value = value;
+        knob.last_write = now;
+        journal.append(JournalType::VM_KNOB, 0, knob.index, value);
+        ALOGI("VM knob %s -> %d (pressure %.2f)", config.name.c_str(), value,
+              pressure);
+        SysctlWriter *writer = &knob.writer;
+        actuator.submit("vm_knob " + config.name,
+                        [writer, value] { writer->write(value); });
+      }
+    }
+  }
+
+ private:
+  struct Knob {
+    VmKnobConfig config;
+    int index;  // Position in known_vm_knobs, stable across versions
+    PsiSource source;
+    SysctlWriter writer;
+    vector<int> steps;
+    steady_clock::time_point last_write;
+    int value = INT_MIN;  // Last decided, the writer runs on the actuator
+  };
+  vector<Knob> knobs;
+
+  /**
+   * Raises the low end of the knob's range to its boot value. False when
+   * the whole range is below it, the knob is left alone then.
+   */
+  static bool apply_boot_floor(VmKnobConfig &config) {
+    long floor = boot_value(config.name, config.path);
+    if (floor < 0) {
+      ALOGW("VM knob %s: boot value unreadable, skipped.", config.name.c_str());
+      return false;
+    }
+    int &low = config.min_value <= config.max_value ? config.min_value
+                                                    : config.max_value;
+    int high = max(config.min_value, config.max_value);
+    if (floor >= high) {
+      ALOGW("VM knob %s: boot value %ld is not below the range max %d, "
+            "skipped.",
+            config.name.c_str(), floor, high);
+      return false;
+    }
+    if (floor > low) {
+      ALOGI("VM knob %s: range starts at the boot value %ld instead of %d.",
+            config.name.c_str(), floor, low);
+      low = floor;
+    }
+    return true;
+  }
+
+  /**
+   * The knob's value at boot, read by the first worker of this boot and
+   * kept in VM_KNOB_BOOT_FILE, so a restarted worker doesn't mistake what
+   * its predecessor wrote for it.
+   */
+  static long boot_value(const string &name, const string &path) {
+    string boot_id, recorded_boot_id;
+    ifstream(root_path("/proc/sys/kernel/random/boot_id")) >> boot_id;
+
+    map<string, long> values;
+    ifstream recorded(VM_KNOB_BOOT_FILE);
+    if (recorded >> recorded_boot_id && recorded_boot_id == boot_id) {
+      string knob;
+      long value;
+      while (recorded >> knob >> value) values[knob] = value;
+    }
+    auto found = values.find(name);
+    if (found != values.end()) return found->second;
+
+    long value = read_long(path);
+    if (value < 0) return -1;
+    values[name] = value;
+    ofstream out(VM_KNOB_BOOT_FILE);
+    out << boot_id << "\n";
+    for (const auto &[knob, recorded_value] : values) {
+      out << knob << " " << recorded_value << "\n";
+    }
+    return value;
+  }
+
+  static int evaluate(const Knob &knob, double pressure) {
+    const auto &config = knob.config;
+    int value;
+
+    if (!config.table.empty()) {
+      value = lookup_pressure_table(config.table, pressure);
+      if (value == -1) {
+        value = config.rise_with_pressure ? config.min_value : config.max_value;
+      }
+    } else {
+      // Level 0 is the highest pressure, steps ascend from min_value
+      int level = pressure_to_level(pressure, config.pressure_min,
+                                    config.pressure_max, config.levels);
+      value = config.rise_with_pressure ? knob.steps[config.levels - level]
+                                        : knob.steps[level];
+    }
+    return clamp(value, min(config.min_value, config.max_value),
+                 max(config.min_value, config.max_value));
+  }
+};
+
+struct ReclaimConfig {
+  bool enable = false;
+  int min_oom_score_adj = 900;
+  int budget_mb = 64;
+  int batch_size = 32;
+  int abort_psi = 10;
+  int idle_psi = 1;
+  int report_interval = 60;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(enable, min_oom_score_adj, budget_mb, batch_size, abort_psi,
+            idle_psi, report_interval);
+  }
+
+  void load_from_yaml(const YAML::Node &config) {
+    auto reclaim = config["virtual_memory"]
+                       ? config["virtual_memory"]["reclaim"]
+                       : YAML::Node();
+    if (!reclaim || !reclaim.IsMap()) {
+      ALOGW("virtual_memory.reclaim section not found in config.");
+      return;
+    }
+
+    auto get_int = [&](const char *key, int fallback) {
+      return reclaim[key] && reclaim[key].IsScalar() ? reclaim[key].as<int>()
+                                                     : fallback;
+    };
+
+    enable = reclaim["enable"] && reclaim["enable"].IsScalar()
+                 ? reclaim["enable"].as<bool>()
+                 : enable;
+    min_oom_score_adj = get_int("min_oom_score_adj", min_oom_score_adj);
+    budget_mb = max(get_int("budget_mb", budget_mb), 1);
+    batch_size = clamp(get_int("batch_size", batch_size), 1, IOV_MAX);
+    abort_psi = get_int("abort_psi", abort_psi);
+    idle_psi = get_int("idle_psi", idle_psi);
+    report_interval = max(get_int("report_interval", report_interval), 1);
+
+    ALOGD(
+        "reclaim enable: %d, min_oom_score_adj: %d, budget_mb: %d, "
+        "batch_size: %d, abort_psi: %d, idle_psi: %d",
+        enable, min_oom_score_adj, budget_mb, batch_size, abort_psi, idle_psi);
+  }
+};
+
+// Columns of zram mm_stat dynv knows, in kernel order
+enum MmStat {
+  MM_ORIG_DATA_SIZE,
+  MM_COMPR_DATA_SIZE,
+  MM_MEM_USED_TOTAL,
+  MM_MEM_LIMIT,
+  MM_MEM_USED_MAX,
+  MM_SAME_PAGES,
+  MM_PAGES_COMPACTED,
+  MM_HUGE_PAGES,
+  MM_STAT_FIELDS
+};
+
+/**
+ * Parses a zram mm_stat line. Kernels append columns over time, the ones
+ * this kernel doesn't have are set to -1 and later ones are ignored.
+ *
+ * @return Columns parsed, 0 when fewer than the first three.
+ */
+int parse_mm_stat(const char *buf, long long values[MM_STAT_FIELDS]) {
+  const char *cursor = buf;
+  int parsed = 0;
+  for (; parsed < MM_STAT_FIELDS; ++parsed) {
+    char *end;
+    values[parsed] = strtoll(cursor, &end, 10);
+    if (end == cursor) break;
+    cursor = end;
+  }
+  for (int f = parsed; f < MM_STAT_FIELDS; ++f) values[f] = -1;
+  return parsed > MM_MEM_USED_TOTAL ? parsed : 0;
+}
+
+/**
+ * Reads mm_stat of the zram device at sysfs, e.g. /sys/block/zram0.
+ */
+bool read_mm_stat(const string &sysfs, long long values[MM_STAT_FIELDS]) {
+  int fd = open((sysfs + "/mm_stat").c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  char buf[256];
+  ssize_t len = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (len <= 0) return false;
+  buf[len] = '\0';
+  return parse_mm_stat(buf, values) > 0;
+}
+
+/**
+ * Sums compr_data_size (2nd column of mm_stat) of every zram device, in bytes.
+ */
+long get_zram_compressed_size() {
+  long total = 0;
+  DIR *dir = opendir(ZRAM_SYSFS_DIR.c_str());
+  if (!dir) return 0;
+
+  while (dirent *entry = readdir(dir)) {
+    if (strncmp(entry->d_name, "zram", 4) != 0) continue;
+
+    long long values[MM_STAT_FIELDS];
+    if (read_mm_stat((ZRAM_SYSFS_DIR + "/") + entry->d_name, values)) {
+      total += values[MM_COMPR_DATA_SIZE];
+    }
+  }
+  closedir(dir);
+  return total;
+}
+
+/**
+ * Private anonymous mappings: no backing inode and either no name, the
+ * heap or an [anon:...] name given by the ART/bionic allocators.
+ */
+bool is_anon_vma(const char *line) {
+  unsigned long start, end, offset, inode;
+  char perms[5], dev[16];
+  int name_pos = 0;
+  if (sscanf(line, "%lx-%lx %4s %lx %15s %lu %n", &start, &end, perms,
+             &offset, dev, &inode, &name_pos) < 6) {
+    return false;
+  }
+  if (inode != 0 || perms[3] != 'p') return false;
+
+  const char *name = line + name_pos;
+  return *name == '\0' || *name == '\n' || strncmp(name, "[heap]", 6) == 0 ||
+         strncmp(name, "[anon:", 6) == 0;
+}
+
+/**
+ * Proactively pages out anonymous memory of background apps with
+ * process_madvise(MADV_PAGEOUT), so cold pages are already in zram before
+ * the next app launch needs the RAM.
+ */
+class ReclaimEngine {
+ public:
+  ReclaimEngine(const ReclaimConfig &config)
+      : config(config),
+        page_size(sysconf(_SC_PAGESIZE)),
+        supported(config.enable),
+        report_start(steady_clock::now()) {
+    if (supported && !(kernel_caps.has(Capability::PIDFD) &&
+                       kernel_caps.has(Capability::PROCESS_MADVISE))) {
+      disable("process_madvise(MADV_PAGEOUT)");
+    }
+    // A short exact window sees a stall building up within a few ticks,
+    // the kernel's avg10 lags behind by several seconds
+    has_psi = supported && kernel_caps.has(Capability::PSI);
+    if (has_psi) abort_source = psi_sampler.resolve(PsiResource::MEMORY, "2s");
+  }
+
+  /**
+   * Memory stall the pass is aborted on, from the tick's sample. NAN without
+   * PSI, the abort check is skipped then.
+   */
+  double abort_pressure(const PsiSample &psi) const {
+    return has_psi && psi.valid ? psi.get(abort_source) : NAN;
+  }
+
+  /**
+   * Runs one budgeted reclaim pass. Candidates are walked across ticks, the
+   * walk restarts from the most expendable app once the queue is drained.
+   *
+   * @param idle True when the device is asleep or memory pressure is low.
+   * @param memory_psi abort_pressure() of the tick that submitted the pass.
+   * @return Pages reclaimed in this pass.
+   */
+  long tick(bool idle, double memory_psi) {
+    if (!supported) return 0;
+
+    report();
+    if (!idle) {
+      queue.clear();
+      return 0;
+    }
+    if (!isnan(memory_psi) && memory_psi >= config.abort_psi) {
+      ALOGI_ONCE("reclaim_abort", "Reclaim aborted, memory PSI rising.");
+      queue.clear();
+      return 0;
+    }
+    ALOG_RESET("reclaim_abort");
+
+    if (queue.empty()) queue = collect_candidates();
+
+    long budget = (static_cast<long>(config.budget_mb) << 20) / page_size;
+    long reclaimed = 0;
+
+    while (!queue.empty() && budget > 0 && supported) {
+      pid_t pid = queue.back();
+      queue.pop_back();
+      long pages = pageout_process(pid, budget);
+      budget -= max(pages, 1L);
+      reclaimed += pages;
+    }
+
+    period_pages += reclaimed;
+    control_stats.reclaimed_pages.fetch_add(reclaimed, memory_order_relaxed);
+    if (reclaimed > 0) journal.append(JournalType::RECLAIM, 0, reclaimed);
+    return reclaimed;
+  }
+
+ private:
+  const ReclaimConfig &config;
+  long page_size;
+  bool supported;
+  vector<pid_t> queue;
+  long period_pages = 0;
+  steady_clock::time_point report_start;
+  bool has_psi = false;
+  PsiSource abort_source;
+
+  void report() {
+    auto elapsed = duration_cast<seconds>(steady_clock::now() - report_start);
+    if (elapsed.count() < config.report_interval) return;
+
+    if (period_pages > 0) {
+      ALOGI("Reclaim: %.1f pages/s over %llds, zram compressed: %ld MB",
+            period_pages / static_cast<double>(elapsed.count()),
+            static_cast<long long>(elapsed.count()),
+            get_zram_compressed_size() >> 20);
+    }
+    period_pages = 0;
+    report_start = steady_clock::now();
+  }
+
+  /**
+   * Background processes ordered so the highest oom_score_adj ends up at the
+   * back of the vector, which is where tick() pops from.
+   */
+  vector<pid_t> collect_candidates() {
+    vector<pair<int, pid_t>> candidates;
+    DIR *proc = opendir(root_path("/proc").c_str());
+    if (!proc) return {};
+
+    pid_t self = getpid();
+    while (dirent *entry = readdir(proc)) {
+      if (!isdigit(entry->d_name[0])) continue;
+
+      pid_t pid = atoi(entry->d_name);
+      if (pid == self) continue;
+
+      long adj = read_long(root_path("/proc/") + entry->d_name + "/oom_score_adj",
+                           -1000);
+      if (adj >= config.min_oom_score_adj) candidates.emplace_back(adj, pid);
+    }
+    closedir(proc);
+
+    sort(candidates.begin(), candidates.end());
+
+    vector<pid_t> pids;
+    pids.reserve(candidates.size());
+    for (const auto &candidate : candidates) pids.push_back(candidate.second);
+    return pids;
+  }
+
+  static long read_rss_anon_kb(pid_t pid) {
+    ifstream status(root_path("/proc/") + to_string(pid) + "/status");
+    string line;
+    while (getline(status, line)) {
+      if (line.compare(0, 8, "RssAnon:") == 0) return atol(line.c_str() + 8);
+    }
+    return -1;
+  }
+
+  /**
+   * Pages out the anonymous VMAs of pid, a batch at a time, until
+   * budget_pages have left its RssAnon. The budget counts pages reclaimed,
+   * the unit tick() charges, not the length advised: much of a VMA can be
+   * unmapped or already in swap.
+   *
+   * @return Pages reclaimed.
+   */
+  long pageout_process(pid_t pid, long budget_pages) {
+    string maps_path = root_path("/proc/") + to_string(pid) + "/maps";
+    FILE *maps = fopen(maps_path.c_str(), "r");
+    if (!maps) return 0;
+
+    int pidfd = syscall(__NR_pidfd_open, pid, 0);
+    if (pidfd < 0) {
+      if (errno == ENOSYS) disable("pidfd_open");
+      fclose(maps);
+      return 0;
+    }
+
+    long rss_before = read_rss_anon_kb(pid);
+    long reclaimed = 0;
+    long advised = 0;  // Pages in the batch not sent yet
+    vector<iovec> batch;
+    batch.reserve(config.batch_size);
+    char line[512];
+
+    auto flush = [&] {
+      if (batch.empty()) return;
+      if (syscall(__NR_process_madvise, pidfd, batch.data(), batch.size(),
+                  MADV_PAGEOUT, 0) < 0 &&
+          (errno == ENOSYS || errno == EINVAL)) {
+        disable("process_madvise(MADV_PAGEOUT)");
+      }
+      batch.clear();
+      advised = 0;
+
+      long rss_after = read_rss_anon_kb(pid);
+      if (rss_before >= 0 && rss_after >= 0 && rss_after < rss_before) {
+        reclaimed = ((rss_before - rss_after) << 10) / page_size;
+      }
+    };
+
+    while (rss_before >= 0 && reclaimed < budget_pages && supported &&
+           fgets(line, sizeof(line), maps)) {
+      if (!is_anon_vma(line)) continue;
+
+      // Large VMAs go in pieces of what is left of the budget
+      unsigned long start, end;
+      sscanf(line, "%lx-%lx", &start, &end);
+      while (start < end && reclaimed < budget_pages && supported) {
+        // What was advised but not resident leaves room for more
+        if (reclaimed + advised >= budget_pages) {
+          flush();
+          continue;
+        }
+        long pages = min<long>((end - start) / page_size,
+                               budget_pages - reclaimed - advised);
+        batch.push_back({reinterpret_cast<void *>(start),
+                         static_cast<size_t>(pages * page_size)});
+        advised += pages;
+        start += pages * page_size;
+
+        if (static_cast<int>(batch.size()) >= config.batch_size) flush();
+      }
+    }
+    flush();
+
+    fclose(maps);
+    close(pidfd);
+    return reclaimed;
+  }
+
+  void disable(const char *what) {
+    ALOGW("%s unsupported by kernel, proactive reclaim disabled.", what);
+    supported = false;
+    queue.clear();
+  }
+};
+
+struct ZramResizeConfig {
+  bool enable = false;
+  int budget_mb = 0;
+  int budget_percent = 25;
+  int min_mb = 256;
+  int max_mb = 4096;
+  int min_change = 10;
+  int check_interval = 60;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(enable, budget_mb, budget_percent, min_mb, max_mb, min_change,
+            check_interval);
+  }
+
+  void load_from_yaml(const YAML::Node &config) {
+    auto resize = config["virtual_memory"] && config["virtual_memory"]["zram"]
+                      ? config["virtual_memory"]["zram"]["resize"]
+                      : YAML::Node();
+    if (!resize || !resize.IsMap()) {
+      ALOGW("virtual_memory.zram.resize section not found in config.");
+      return;
+    }
+
+    auto get_int = [&](const char *key, int fallback) {
+      return resize[key] && resize[key].IsScalar() ? resize[key].as<int>()
+                                                   : fallback;
+    };
+
+    enable = resize["enable"] && resize["enable"].IsScalar()
+                 ? resize["enable"].as<bool>()
+                 : enable;
+    budget_mb = max(get_int("budget_mb", budget_mb), 0);
+    budget_percent = clamp(get_int("budget_percent", budget_percent), 1, 100);
+    min_mb = max(get_int("min_mb", min_mb), 16);
+    max_mb = max(get_int("max_mb", max_mb), min_mb);
+    min_change = clamp(get_int("min_change", min_change), 1, 100);
+    check_interval = max(get_int("check_interval", check_interval), 1);
+
+    ALOGD(
+        "zram resize enable: %d, budget_mb: %d, budget_percent: %d, "
+        "min_mb: %d, max_mb: %d, min_change: %d",
+        enable, budget_mb, budget_percent, min_mb, max_mb, min_change);
+  }
+};
+
+bool write_sysfs(const string &path, const string &value) {
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  bool ok = ::write(fd, value.data(), value.size()) ==
+            static_cast<ssize_t>(value.size());
+  close(fd);
+  return ok;
+}
+
+const string ZRAM_ALGORITHM_FILE = LOG_FOLDER + "/zram.algorithm";
+
+struct ZramAlgorithmConfig {
+  string comp_algorithm = "auto";
+  string recomp_algorithm = "auto";
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(comp_algorithm, recomp_algorithm);
+  }
+
+  void load_from_yaml(const YAML::Node &config) {
+    auto zram = config["virtual_memory"] ? config["virtual_memory"]["zram"]
+                                         : YAML::Node();
+    if (!zram || !zram.IsMap()) return;
+
+    comp_algorithm = zram["comp_algorithm"].as<string>(comp_algorithm);
+    recomp_algorithm = zram["recomp_algorithm"].as<string>(recomp_algorithm);
+    ALOGD("zram comp_algorithm: %s, recomp_algorithm: %s",
+          comp_algorithm.c_str(), recomp_algorithm.c_str());
+  }
+
+  /**
+   * Resolves "auto" to the recommendation saved by --bench-zram --apply.
+   * An empty algorithm leaves the kernel default in place.
+   */
+  pair<string, string> resolve() const {
+    string primary = comp_algorithm, secondary = recomp_algorithm;
+    string recommended_primary, recommended_secondary;
+    ifstream file(ZRAM_ALGORITHM_FILE);
+    file >> recommended_primary >> recommended_secondary;
+
+    if (primary == "auto") primary = recommended_primary;
+    if (secondary == "auto") secondary = recommended_secondary;
+    if (secondary == "none") secondary.clear();
+    return {primary, secondary};
+  }
+
+  /**
+   * Sets the algorithms of a zram device, which must be reset and not yet
+   * have a disksize.
+   */
+  void apply(const string &sysfs) const {
+    auto [primary, secondary] = resolve();
+    if (!primary.empty() &&
+        !write_sysfs(sysfs + "/comp_algorithm", primary)) {
+      ALOGW("Failed to set %s comp_algorithm to %s", sysfs.c_str(),
+            primary.c_str());
+    }
+    if (!secondary.empty() && kernel_caps.has(Capability::ZRAM_RECOMPRESS) &&
+        !write_sysfs(sysfs + "/recomp_algorithm", "algo=" + secondary)) {
+      ALOGW("Failed to set %s recomp_algorithm to %s", sysfs.c_str(),
+            secondary.c_str());
+    }
+  }
+};
+
+/**
+ * Sizes inactive zram devices so the whole pool holds what fits in a RAM
+ * budget at the compression ratio actually observed, instead of a nominal
+ * 1 GB per device. Devices in /proc/swaps are never touched.
+ */
+class ZramResizer {
+ public:
+  ZramResizer(const ZramResizeConfig &config,
+              const ZramAlgorithmConfig &algorithm)
+      : config(config), algorithm(algorithm) {
+    long long total_kb = 0;
+    ifstream meminfo(root_path("/proc/meminfo"));
+    string key;
+    while (meminfo >> key >> total_kb && key != "MemTotal:") {
+      meminfo.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+    long long budget = config.budget_mb > 0
+                           ? static_cast<long long>(config.budget_mb) << 20
+                           : (total_kb << 10) * config.budget_percent / 100;
+    budget_bytes = budget;
+  }
+
+  void tick() {
+    if (!config.enable) return;
+
+    auto now = steady_clock::now();
+    if (now - last_check < seconds(config.check_interval)) return;
+    last_check = now;
+
+    update_ratio();
+
+    vector<SwapDevice> inactive = swap_model.inactive_devices(SwapTier::ZRAM);
+    if (inactive.empty()) return;
+
+    size_t zram_count = inactive.size();
+    for (const auto &device : swap_model.active_devices()) {
+      if (device.tier == SwapTier::ZRAM) ++zram_count;
+    }
+
+    long long target = static_cast<long long>(budget_bytes * ratio) /
+                       static_cast<long long>(zram_count);
+    target = clamp(target, static_cast<long long>(config.min_mb) << 20,
+                   static_cast<long long>(config.max_mb) << 20);
+
+    for (const auto &device : inactive) {
+      long long current = disksize(device);
+      if (current > 0 &&
+          llabs(target - current) * 100 < current * config.min_change) {
+        continue;
+      }
+      resize(device, target);
+    }
+  }
+
+  /**
+   * Resets an inactive zram device to target bytes, with the configured
+   * algorithms, and formats it as swap.
+   *
+   * @return False when /proc/swaps lists the device or a step failed.
+   */
+  bool resize(const SwapDevice &device, long long target) {
+    if (device.number < 0) return false;
+    vector<SwapEntry> swaps = read_proc_swaps();
+    bool in_use = any_of(swaps.begin(), swaps.end(), [&](const SwapEntry &e) {
+      return e.path == device.path;
+    });
+    if (in_use) return false;
+
+    string sysfs = (ZRAM_SYSFS_DIR + "/zram") + to_string(device.number);
+    return resize(device, sysfs, disksize(device), target);
+  }
+
+  // disksize overflows a 32-bit long on armeabi-v7a
+  static long long disksize(const SwapDevice &device) {
+    long long size = 0;
+    ifstream((ZRAM_SYSFS_DIR + "/zram") + to_string(device.number) +
+             "/disksize") >>
+        size;
+    return size;
+  }
+
+ private:
+  const ZramResizeConfig &config;
+  const ZramAlgorithmConfig &algorithm;
+  long long budget_bytes;
+  // Compression ratio assumed until the pool holds enough data to measure it
+  double ratio = 2.0;
+  bool measured = false;
+  steady_clock::time_point last_check{};
+
+  /**
+   * Pool wide ratio of original data to RAM used, smoothed so a single
+   * poorly compressing burst doesn't shrink every device.
+   */
+  void update_ratio() {
+    long long orig = 0, used = 0;
+    DIR *dir = opendir(ZRAM_SYSFS_DIR.c_str());
+    if (!dir) return;
+
+    while (dirent *entry = readdir(dir)) {
+      if (strncmp(entry->d_name, "zram", 4) != 0) continue;
+
+      long long values[MM_STAT_FIELDS];
+      if (read_mm_stat((ZRAM_SYSFS_DIR + "/") + entry->d_name, values)) {
+        orig += values[MM_ORIG_DATA_SIZE];
+        used += values[MM_MEM_USED_TOTAL];
+      }
+    }
+    closedir(dir);
+
+    // Too little data compresses unrepresentatively well
+    if (used <= 0 || orig < (16LL << 20)) return;
+
+    double sample = static_cast<double>(orig) / used;
+    ratio = measured ? ratio * 0.8 + sample * 0.2 : sample;
+    if (!measured) ALOGI("zram compression ratio measured: %.2f", ratio);
+    measured = true;
+  }
+
+  bool resize(const SwapDevice &device, const string &sysfs, long long current,
+              long long target) {
+    ALOGI("Resizing %s: %lld MB -> %lld MB (ratio %.2f, budget %lld MB)",
+          device.path.c_str(), current >> 20, target >> 20, ratio,
+          budget_bytes >> 20);
+
+    bool ok = write_sysfs(sysfs + "/reset", "1");
+    if (ok) algorithm.apply(sysfs);
+    ok = ok && write_sysfs(sysfs + "/disksize", to_string(target)) &&
+              system((SYSTEM_BIN + "mkswap " + device.path + " >/dev/null 2>&1")
+                         .c_str()) == 0;
+
+    journal.append(JournalType::ZRAM_RESIZE, ok ? 0 : JOURNAL_FAILED,
+                   device.number, static_cast<int32_t>(current >> 20),
+                   static_cast<int32_t>(target >> 20));
+    if (!ok) {
+      ALOGE("Failed: resize %s to %lld MB: %s", device.path.c_str(),
+            target >> 20, strerror(errno));
+    }
+    return ok;
+  }
+};
+
+/**
+ * Resizes a real zram device the way ZramResizer does, on a Linux host or
+ * VM as root, e.g. modprobe zram num_devices=2 && dynv --check-zram 1.
+ * Checks that an inactive device swaps at each new size with the
+ * configured algorithm, and that one in /proc/swaps is never reset. The
+ * device must not be in use and is reset when done.
+ */
+int check_zram(int number) {
+  string sysfs = (ZRAM_SYSFS_DIR + "/zram") + to_string(number);
+  string path = ZRAM_DIR + "/zram" + to_string(number);
+  if (access(path.c_str(), F_OK) != 0) {
+    path = root_path("/dev/zram") + to_string(number);
+  }
+  if (access((sysfs + "/disksize").c_str(), F_OK) != 0) {
+    fprintf(stderr, "No zram device at %s\n", sysfs.c_str());
+    return EXIT_FAILURE;
+  }
+  auto swap_kb = [&] {
+    for (const auto &entry : read_proc_swaps()) {
+      if (entry.path == path) return entry.size_kb;
+    }
+    return -1L;
+  };
+  if (swap_kb() >= 0) {
+    fprintf(stderr, "%s is in use as swap, pick another device\n",
+            path.c_str());
+    return EXIT_FAILURE;
+  }
+
+  // The last algorithm the kernel offers, so it differs from the default
+  string algorithms, selected;
+  getline(ifstream(sysfs + "/comp_algorithm"), algorithms);
+  stringstream names(algorithms);
+  for (string name; names >> name;) {
+    selected = name.front() == '[' ? name.substr(1, name.size() - 2) : name;
+  }
+
+  ZramResizeConfig config;
+  ZramAlgorithmConfig algorithm;
+  algorithm.comp_algorithm = selected;
+  algorithm.recomp_algorithm = "";
+  ZramResizer resizer(config, algorithm);
+  SwapDevice device{path, SwapTier::ZRAM, number};
+
+  int failed = 0;
+  auto check = [&](const string &name, bool ok) {
+    printf("%-40s %s\n", name.c_str(), ok ? "ok" : "FAILED");
+    if (!ok) failed++;
+  };
+  auto swapoff_device = [&] {
+    string command = SYSTEM_BIN + "swapoff " + path + " >/dev/null 2>&1";
+    return system(command.c_str()) == 0;
+  };
+
+  for (long long mb : {64LL, 128LL, 32LL}) {
+    string size = to_string(mb) + " MB";
+    bool resized = resizer.resize(device, mb << 20);
+    check("resize inactive to " + size,
+          resized && ZramResizer::disksize(device) == mb << 20);
+
+    string current;
+    getline(ifstream(sysfs + "/comp_algorithm"), current);
+    check("comp_algorithm " + selected + " at " + size,
+          current.find("[" + selected + "]") != string::npos);
+
+    // The swap header takes the first page
+    bool on = resized && swapon(path, 0);
+    long kb = swap_kb();
+    check("swapon at " + size, on && kb > (mb << 10) - 64 && kb <= mb << 10);
+    if (!on) continue;
+
+    check("active device left alone",
+          !resizer.resize(device, (mb * 2) << 20) &&
+              ZramResizer::disksize(device) == mb << 20 &&
+              swap_kb() == kb);
+    check("swapoff at " + size, swapoff_device());
+  }
+
+  write_sysfs(sysfs + "/reset", "1");
+  printf("%d failed\n", failed);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+struct DamonConfig {
+  bool enable = false;
+  string target = "system";
+  int min_oom_score_adj = 900;
+  int max_targets = 16;
+  int sample_ms = 20;
+  int aggr_ms = 1000;
+  int min_regions = 10;
+  int max_regions = 200;
+  int cold_age = 120;
+  int update_interval = 30;
+  bool pageout = true;
+  int pageout_mb = 64;
+  int quota_ms = 20;
+  int quota_interval_ms = 1000;
+  bool record = false;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(enable, target, min_oom_score_adj, max_targets, sample_ms,
+            aggr_ms, min_regions, max_regions, cold_age, update_interval,
+            pageout, pageout_mb, quota_ms, quota_interval_ms, record);
+  }
+
+  void load_from_yaml(const YAML::Node &config) {
+    auto damon = config["virtual_memory"] ? config["virtual_memory"]["damon"]
+                                          : YAML::Node();
+    if (!damon || !damon.IsMap()) {
+      ALOGW("virtual_memory.damon section not found in config.");
+      return;
+    }
+
+    auto get_int = [&](const char *key, int fallback) {
+      return damon[key] && damon[key].IsScalar() ? damon[key].as<int>()
+                                                 : fallback;
+    };
+    auto get_bool = [&](const char *key, bool fallback) {
+      return damon[key] && damon[key].IsScalar() ? damon[key].as<bool>()
+                                                 : fallback;
+    };
+
+    enable = get_bool("enable", enable);
+    target = damon["target"] && damon["target"].IsScalar()
+                 ? damon["target"].as<string>()
+                 : target;
+    if (target != "system" && target != "background") {
+      ALOGW("Invalid damon target: %s. Using system.", target.c_str());
+      target = "system";
+    }
+    min_oom_score_adj = get_int("min_oom_score_adj", min_oom_score_adj);
+    max_targets = max(get_int("max_targets", max_targets), 1);
+    sample_ms = max(get_int("sample_ms", sample_ms), 1);
+    aggr_ms = max(get_int("aggr_ms", aggr_ms), sample_ms);
+    min_regions = max(get_int("min_regions", min_regions), 3);
+    max_regions = max(get_int("max_regions", max_regions), min_regions);
+    cold_age = max(get_int("cold_age", cold_age), 1);
+    update_interval = max(get_int("update_interval", update_interval), 1);
+    pageout = get_bool("pageout", pageout);
+    pageout_mb = max(get_int("pageout_mb", pageout_mb), 1);
+    quota_ms = max(get_int("quota_ms", quota_ms), 1);
+    quota_interval_ms =
+        max(get_int("quota_interval_ms", quota_interval_ms), 10);
+    record = get_bool("record", record);
+
+    ALOGD(
+        "damon enable: %d, target: %s, sample_ms: %d, aggr_ms: %d, "
+        "cold_age: %d, pageout: %d, pageout_mb: %d",
+        enable, target.c_str(), sample_ms, aggr_ms, cold_age, pageout,
+        pageout_mb);
+  }
+};
+
+/**
+ * One DAMON monitoring region. nr_accesses counts the samples that saw an
+ * access in the last aggregation interval, age is in aggregation intervals.
+ */
+struct DamonRegion {
+  unsigned long start, end;
+  unsigned int nr_accesses, age;
+};
+
+/**
+ * Regions of one DAMON update, with the free and anonymous memory at that
+ * moment. Written as text: a header line, then one
+ * "start end nr_accesses age" line per region. vaddr snapshots cover the
+ * mappings of monitored processes rather than physical memory; headers
+ * without ops= come from paddr.
+ */
+struct DamonSnapshot {
+  long sample_us = 0;
+  long aggr_us = 0;
+  uint64_t free_kb = 0;
+  uint64_t anon_kb = 0;
+  bool vaddr = false;
+  vector<DamonRegion> regions;
+
+  bool write(const string &path) const {
+    string tmp = path + ".tmp";
+    FILE *out = fopen(tmp.c_str(), "w");
+    if (!out) return false;
+
+    fprintf(out,
+            "# dynv damon snapshot v1 sample_us=%ld aggr_us=%ld "
+            "free_kb=%llu anon_kb=%llu ops=%s\n",
+            sample_us, aggr_us, static_cast<unsigned long long>(free_kb),
+            static_cast<unsigned long long>(anon_kb),
+            vaddr ? "vaddr" : "paddr");
+    for (const auto &region : regions) {
+      fprintf(out, "%lx %lx %u %u\n", region.start, region.end,
+              region.nr_accesses, region.age);
+    }
+    bool ok = fclose(out) == 0;
+    return ok && rename(tmp.c_str(), path.c_str()) == 0;
+  }
+
+  bool read(const string &path) {
+    ifstream in(path);
+    if (!in) return false;
+    stringstream content;
+    content << in.rdbuf();
+    return parse(content.str().c_str());
+  }
+
+  /**
+   * Parses the text written by write(). Malformed region lines are skipped.
+   *
+   * @return False without a v1 header.
+   */
+  bool parse(const char *buf) {
+    unsigned long long free, anon;
+    bool ok = sscanf(buf,
+                     "# dynv damon snapshot v1 sample_us=%ld aggr_us=%ld "
+                     "free_kb=%llu anon_kb=%llu",
+                     &sample_us, &aggr_us, &free, &anon) == 4;
+    free_kb = ok ? free : 0;
+    anon_kb = ok ? anon : 0;
+    const char *ops = strstr(buf, " ops=vaddr");
+    vaddr = ok && ops && ops < buf + strcspn(buf, "\n");
+    regions.clear();
+    if (!ok) return false;
+
+    DamonRegion region;
+    for (const char *line = strchr(buf, '\n'); line && *++line;
+         line = strchr(line, '\n')) {
+      // One line at a time, sscanf would otherwise read on into the next
+      char text[128];
+      size_t len = min(strcspn(line, "\n"), sizeof(text) - 1);
+      memcpy(text, line, len);
+      text[len] = '\0';
+      if (sscanf(text, "%lx %lx %u %u", &region.start, &region.end,
+                 &region.nr_accesses, &region.age) == 4 &&
+          region.end > region.start) {
+        regions.push_back(region);
+      }
+    }
+    return true;
+  }
+};
+
+/**
+ * Cold memory in a snapshot: bytes not accessed for at least cold_age
+ * seconds. Only anonymous memory goes to swap, so the swappable part is at
+ * most all anonymous memory. Physical monitoring also sees free pages,
+ * which are never accessed either, so there it's the cold bytes beyond
+ * free memory. Process mappings hold no free pages. Shared by the live
+ * monitor and replay.
+ */
+struct ColdEstimate {
+  uint64_t total_bytes = 0;
+  uint64_t cold_bytes = 0;
+  uint64_t swappable_bytes = 0;
+  size_t regions = 0;
+
+  static ColdEstimate from_snapshot(const DamonSnapshot &snapshot,
+                                    int cold_age) {
+    ColdEstimate estimate;
+    uint64_t cold_intervals = static_cast<uint64_t>(cold_age) * 1000000 /
+                              max(snapshot.aggr_us, 1L);
+    for (const auto &region : snapshot.regions) {
+      uint64_t size = region.end - region.start;
+      estimate.total_bytes += size;
+      if (region.nr_accesses == 0 && region.age >= cold_intervals) {
+        estimate.cold_bytes += size;
+      }
+    }
+    estimate.regions = snapshot.regions.size();
+
+    uint64_t free = snapshot.vaddr ? 0 : snapshot.free_kb << 10;
+    estimate.swappable_bytes =
+        min(estimate.cold_bytes > free ? estimate.cold_bytes - free : 0,
+            static_cast<uint64_t>(snapshot.anon_kb << 10));
+    return estimate;
+  }
+};
+
+const string DAMON_SNAPSHOT_FILE = LOG_FOLDER + "/damon.snapshot";
+const string DAMON_KDAMOND_FILE = LOG_FOLDER + "/damon.kdamond";
+
+/**
+ * Monitors memory access patterns with DAMON through its sysfs interface
+ * and keeps an estimate of how much memory is cold. Runs one kdamond with
+ * two schemes: a "stat" scheme matching every region, whose tried regions
+ * give the access pattern, and a cold memory scheme that is switched to
+ * "pageout" while the screen is off, bounded by size and CPU quotas.
+ */
+class DamonMonitor {
+ public:
+  DamonMonitor(const DamonConfig &config)
+      : config(config),
+        kdamonds(root_path("/sys/kernel/mm/damon/admin/kdamonds")),
+        target(config.target),
+        supported(config.enable) {}
+
+  /**
+   * Starts monitoring on the first call, then refreshes the estimate every
+   * update_interval seconds and follows the screen state.
+   */
+  void tick(bool sleeping) {
+    if (!supported) return;
+
+    auto now = steady_clock::now();
+    if (!monitoring) {
+      if (now < retry_at) return;
+      retry_at = now + seconds(60);
+      if (!start(sleeping)) return;
+      last_update = now;
+      return;
+    }
+
+    if (config.pageout && sleeping != pageout_active) {
+      set_pageout(sleeping);
+    }
+
+    if (now - last_update < seconds(config.update_interval)) return;
+    last_update = now;
+
+    // A vaddr kdamond stops by itself once all its targets exit
+    if (read_state() != "on") {
+      ALOGI("DAMON stopped, restarting.");
+      monitoring = false;
+      cold_estimate_mb = -1;
+      return;
+    }
+    vector<pid_t> pids =
+        target == "background" ? candidates() : vector<pid_t>();
+    if (target == "background" && pids != targets) {
+      if (!set_targets(pids) || !write_state("commit")) {
+        ALOGW("DAMON target update failed: %s", strerror(errno));
+      }
+    }
+    update_estimate();
+  }
+
+  /**
+   * @return Cold memory in MB, -1 while unknown.
+   */
+  long cold_mb() const { return cold_estimate_mb.load(memory_order_relaxed); }
+
+  /**
+   * True when the cold memory estimate doesn't fit in free_mb of swap.
+   */
+  bool needs_room(long free_mb) const {
+    long cold = cold_mb();
+    return cold >= 0 && cold > free_mb;
+  }
+
+ private:
+  const DamonConfig &config;
+  const string kdamonds;
+  long index = -1;
+  string kdamond;
+  string context;
+  string target;
+  bool supported;
+  bool monitoring = false;
+  bool pageout_active = false;
+  // Written by tick() on the actuator, read by the control loop
+  atomic<long> cold_estimate_mb{-1};
+  unsigned long last_applied = 0;
+  vector<pid_t> targets;
+  steady_clock::time_point retry_at{};
+  steady_clock::time_point last_update{};
+
+  string scheme(int index) const {
+    return context + "/schemes/" + to_string(index);
+  }
+
+  bool write(const string &path, const string &value) {
+    if (write_sysfs(path, value)) return true;
+    ALOGD("DAMON write %s = %s failed: %s", path.c_str(), value.c_str(),
+          strerror(errno));
+    return false;
+  }
+
+  bool write_state(const string &state) { return write(kdamond + "/state", state); }
+
+  string read_state() const {
+    ifstream file(kdamond + "/state");
+    string state;
+    file >> state;
+    return state;
+  }
+
+  static unsigned long read_ulong(const string &path, bool &ok) {
+    ifstream file(path);
+    unsigned long value = 0;
+    ok = static_cast<bool>(file >> value);
+    return value;
+  }
+
+  bool start(bool sleeping) {
+    if (!kernel_caps.has(Capability::DAMON)) {
+      ALOGW("DAMON sysfs interface not available, damon disabled.");
+      supported = false;
+      return false;
+    }
+
+    if (!claim()) return false;
+    // Ours, so it's fine to stop it for setup, e.g. after a crash left it on
+    if (read_state() == "on") write_state("off");
+    if (!write(kdamond + "/contexts/nr_contexts", "1")) {
+      ALOGW("DAMON setup failed, retrying in a minute.");
+      return false;
+    }
+
+    // Kernels may build DAMON with physical address monitoring only
+    ifstream avail(context + "/avail_operations");
+    string operations((istreambuf_iterator<char>(avail)),
+                      istreambuf_iterator<char>());
+    if (target == "background" && avail &&
+        operations.find("vaddr") == string::npos) {
+      ALOGW("DAMON has no vaddr operations, monitoring system memory.");
+      target = "system";
+    }
+
+    vector<pid_t> pids;
+    if (target == "background") {
+      pids = candidates();
+      if (pids.empty()) return false;
+    }
+
+    long sample_us = config.sample_ms * 1000L;
+    long aggr_us = config.aggr_ms * 1000L;
+    string attrs = context + "/monitoring_attrs";
+    bool ok =
+        write(context + "/operations",
+              target == "system" ? "paddr" : "vaddr") &&
+        write(attrs + "/intervals/sample_us", to_string(sample_us)) &&
+        write(attrs + "/intervals/aggr_us", to_string(aggr_us)) &&
+        write(attrs + "/intervals/update_us", to_string(aggr_us * 10)) &&
+        write(attrs + "/nr_regions/min", to_string(config.min_regions)) &&
+        write(attrs + "/nr_regions/max", to_string(config.max_regions)) &&
+        (target == "system" ? set_system_target() : set_targets(pids)) &&
+        write(context + "/schemes/nr_schemes", "2") &&
+        set_scheme(0, "stat", 0, UINT_MAX) &&
+        set_scheme(1, config.pageout && sleeping ? "pageout" : "stat", 0,
+                   0) &&
+        set_age(1, config.cold_age * 1000L / config.aggr_ms, UINT_MAX) &&
+        set_quotas(1) && write_state("on");
+    if (!ok) {
+      ALOGW("DAMON setup failed, retrying in a minute.");
+      return false;
+    }
+
+    monitoring = true;
+    pageout_active = config.pageout && sleeping;
+    last_applied = 0;
+    ALOGI("DAMON monitoring %s memory, cold after %ds",
+          target.c_str(), config.cold_age);
+    return true;
+  }
+
+  /**
+   * Picks the kdamond dynv runs on: one an earlier start or a dynv run
+   * since boot created, else a new one. Creating one rewrites every
+   * kdamond directory, so that only happens while there are none and
+   * DAMON in use by other tools is left alone.
+   */
+  bool claim() {
+    long existing = read_long(kdamonds + "/nr_kdamonds", 0);
+    if (index >= 0 && index < existing) return true;
+
+    string boot_id, owner_boot_id;
+    long owned = -1;
+    ifstream(root_path("/proc/sys/kernel/random/boot_id")) >> boot_id;
+    ifstream(DAMON_KDAMOND_FILE) >> owner_boot_id >> owned;
+    if (boot_id.empty() || owner_boot_id != boot_id || owned < 0 ||
+        owned >= existing) {
+      if (existing > 0) {
+        ALOGW("DAMON has %ld kdamonds of another tool, waiting.", existing);
+        return false;
+      }
+      if (!write(kdamonds + "/nr_kdamonds", "1")) {
+        ALOGW("DAMON setup failed, retrying in a minute.");
+        return false;
+      }
+      owned = 0;
+      ofstream(DAMON_KDAMOND_FILE) << boot_id << " " << owned << "\n";
+    }
+    index = owned;
+    kdamond = kdamonds + "/" + to_string(index);
+    context = kdamond + "/contexts/0";
+    return true;
+  }
+
+  /**
+   * Physical address monitoring of every System RAM range, so holes in the
+   * address space never count as cold memory.
+   */
+  bool set_system_target() {
+    FILE *iomem = fopen(root_path("/proc/iomem").c_str(), "r");
+    if (!iomem) return false;
+
+    vector<pair<unsigned long, unsigned long>> ranges;
+    unsigned long start, end;
+    char line[256];
+    int name_pos;
+    while (fgets(line, sizeof(line), iomem)) {
+      if (line[0] == ' ') continue;  // Top level ranges only
+      name_pos = 0;
+      if (sscanf(line, "%lx-%lx : %n", &start, &end, &name_pos) >= 2 &&
+          name_pos && strncmp(line + name_pos, "System RAM", 10) == 0) {
+        ranges.emplace_back(start, end + 1);
+      }
+    }
+    fclose(iomem);
+    if (ranges.empty()) {
+      ALOGW("No System RAM range in /proc/iomem for DAMON.");
+      return false;
+    }
+
+    string dir = context + "/targets/0";
+    bool ok = write(context + "/targets/nr_targets", "1") &&
+              write(dir + "/regions/nr_regions", to_string(ranges.size()));
+    for (size_t i = 0; ok && i < ranges.size(); ++i) {
+      string region = dir + "/regions/" + to_string(i);
+      ok = write(region + "/start", to_string(ranges[i].first)) &&
+           write(region + "/end", to_string(ranges[i].second));
+    }
+    return ok;
+  }
+
+  bool set_targets(const vector<pid_t> &pids) {
+    if (!write(context + "/targets/nr_targets", to_string(pids.size()))) {
+      return false;
+    }
+    for (size_t i = 0; i < pids.size(); ++i) {
+      // vaddr derives regions from the mappings, drop any left from paddr
+      string dir = context + "/targets/" + to_string(i);
+      if (!write(dir + "/pid_target", to_string(pids[i])) ||
+          !write(dir + "/regions/nr_regions", "0")) {
+        return false;
+      }
+    }
+    targets = pids;
+    return true;
+  }
+
+  /**
+   * Most expendable background apps, up to max_targets, sorted by pid so
+   * the set compares equal across ticks.
+   */
+  vector<pid_t> candidates() const {
+    vector<pair<long, pid_t>> found;
+    DIR *proc = opendir(root_path("/proc").c_str());
+    if (!proc) return {};
+
+    while (dirent *entry = readdir(proc)) {
+      if (!isdigit(entry->d_name[0])) continue;
+      long adj = read_long(
+          root_path("/proc/") + entry->d_name + "/oom_score_adj", -1000);
+      if (adj >= config.min_oom_score_adj) {
+        found.emplace_back(-adj, atoi(entry->d_name));
+      }
+    }
+    closedir(proc);
+
+    sort(found.begin(), found.end());
+    if (found.size() > static_cast<size_t>(config.max_targets)) {
+      found.resize(config.max_targets);
+    }
+
+    vector<pid_t> pids;
+    for (const auto &candidate : found) pids.push_back(candidate.second);
+    sort(pids.begin(), pids.end());
+    return pids;
+  }
+
+  bool set_scheme(int index, const string &action, unsigned int min_accesses,
+                  unsigned int max_accesses) {
+    string pattern = scheme(index) + "/access_pattern";
+    return write(scheme(index) + "/action", action) &&
+           write(pattern + "/sz/min", "0") &&
+           write(pattern + "/sz/max", to_string(ULONG_MAX)) &&
+           write(pattern + "/nr_accesses/min", to_string(min_accesses)) &&
+           write(pattern + "/nr_accesses/max", to_string(max_accesses)) &&
+           set_age(index, 0, UINT_MAX);
+  }
+
+  bool set_age(int index, unsigned long min_age, unsigned long max_age) {
+    string age = scheme(index) + "/access_pattern/age";
+    return write(age + "/min", to_string(min_age)) &&
+           write(age + "/max", to_string(max_age));
+  }
+
+  /**
+   * Bounds pageout by size and CPU time per interval, oldest regions first.
+   */
+  bool set_quotas(int index) {
+    string quotas = scheme(index) + "/quotas";
+    return write(quotas + "/bytes",
+                 to_string(static_cast<unsigned long>(config.pageout_mb)
+                           << 20)) &&
+           write(quotas + "/ms", to_string(config.quota_ms)) &&
+           write(quotas + "/reset_interval_ms",
+                 to_string(config.quota_interval_ms)) &&
+           write(quotas + "/weights/age_permil", "1000");
+  }
+
+  void set_pageout(bool enable) {
+    if (write(scheme(1) + "/action", enable ? "pageout" : "stat") &&
+        write_state("commit")) {
+      pageout_active = enable;
+      ALOGI("DAMON pageout of cold memory %s", enable ? "on" : "off");
+    }
+  }
+
+  void update_estimate() {
+    if (!write_state("update_schemes_tried_regions")) return;
+
+    // Region directories are numbered, but not necessarily from 0
+    string tried = scheme(0) + "/tried_regions";
+    DIR *dir = opendir(tried.c_str());
+    if (!dir) return;
+    DamonSnapshot snapshot;
+    snapshot.sample_us = config.sample_ms * 1000L;
+    snapshot.aggr_us = config.aggr_ms * 1000L;
+    snapshot.regions.reserve(config.max_regions);
+    while (dirent *entry = readdir(dir)) {
+      if (!isdigit(entry->d_name[0])) continue;
+      string path = tried + "/" + entry->d_name;
+      bool ok[4];
+      DamonRegion region;
+      region.start = read_ulong(path + "/start", ok[0]);
+      region.end = read_ulong(path + "/end", ok[1]);
+      region.nr_accesses = read_ulong(path + "/nr_accesses", ok[2]);
+      region.age = read_ulong(path + "/age", ok[3]);
+      if (ok[0] && ok[1] && ok[2] && ok[3] && region.end > region.start) {
+        snapshot.regions.push_back(region);
+      }
+    }
+    closedir(dir);
+    if (snapshot.regions.empty()) return;
+    sort(snapshot.regions.begin(), snapshot.regions.end(),
+         [](const DamonRegion &a, const DamonRegion &b) {
+           return a.start < b.start;
+         });
+
+    MemInfo info;
+    char buf[4096];
+    int fd = open(root_path("/proc/meminfo").c_str(), O_RDONLY | O_CLOEXEC);
+    ssize_t len = fd >= 0 ? pread(fd, buf, sizeof(buf) - 1, 0) : -1;
+    if (fd >= 0) close(fd);
+    if (len <= 0) return;
+    buf[len] = '\0';
+    parse_meminfo(buf, info);
+    snapshot.free_kb = info.mem_free;
+    snapshot.anon_kb = info.anon_pages;
+    snapshot.vaddr = target != "system";
+
+    ColdEstimate estimate =
+        ColdEstimate::from_snapshot(snapshot, config.cold_age);
+    long cold_mb = estimate.swappable_bytes >> 20;
+    cold_estimate_mb.store(cold_mb, memory_order_relaxed);
+
+    // Bytes the pageout scheme applied since the last estimate
+    unsigned long applied = 0;
+    if (write_state("update_schemes_stats")) {
+      bool ok;
+      applied = read_ulong(scheme(1) + "/stats/sz_applied", ok);
+    }
+    unsigned long paged_out = applied >= last_applied ? applied - last_applied
+                                                      : applied;
+    last_applied = applied;
+
+    ALOGD(
+        "DAMON: %llu MB cold of %llu MB in %zu regions, %ld MB swappable, "
+        "%lu MB paged out",
+        static_cast<unsigned long long>(estimate.cold_bytes >> 20),
+        static_cast<unsigned long long>(estimate.total_bytes >> 20),
+        estimate.regions, cold_mb, paged_out >> 20);
+    journal.append(JournalType::DAMON, 0, static_cast<int32_t>(cold_mb),
+                   static_cast<int32_t>(estimate.total_bytes >> 20),
+                   static_cast<int32_t>(paged_out >> 20));
+
+    if (config.record && !snapshot.write(DAMON_SNAPSHOT_FILE)) {
+      ALOGW("Failed to write %s: %s", DAMON_SNAPSHOT_FILE.c_str(),
+            strerror(errno));
+    }
+  }
+};
+
+/**
+ * Replays a recorded DAMON snapshot: the cold memory estimate the daemon
+ * would make at the configured cold_age and a few others, for tuning.
+ */
+int damon_replay(const string &path, const string &config_path) {
+  DamonSnapshot snapshot;
+  if (!snapshot.read(path)) {
+    fprintf(stderr, "Not a dynv damon snapshot: %s\n", path.c_str());
+    return EXIT_FAILURE;
+  }
+
+  DamonConfig config;
+  try {
+    config.load_from_yaml(YAML::LoadFile(config_path));
+  } catch (const std::exception &e) {
+    fprintf(stderr, "Failed to load config, using defaults: %s\n", e.what());
+  }
+
+  ColdEstimate all = ColdEstimate::from_snapshot(snapshot, 1);
+  printf(
+      "%zu %s regions, %llu MB monitored, %llu MB free, %llu MB anonymous, "
+      "sample %ld us, aggregation %ld us\n",
+      all.regions, snapshot.vaddr ? "vaddr" : "paddr",
+      static_cast<unsigned long long>(all.total_bytes >> 20),
+      static_cast<unsigned long long>(snapshot.free_kb >> 10),
+      static_cast<unsigned long long>(snapshot.anon_kb >> 10),
+      snapshot.sample_us, snapshot.aggr_us);
+  printf("%10s %10s %8s %14s\n", "cold_age", "cold_mb", "cold_%",
+         "swappable_mb");
+  vector<int> ages = {30, 60, 120, 300, 600};
+  if (!contains(config.cold_age, ages)) ages.push_back(config.cold_age);
+  sort(ages.begin(), ages.end());
+  for (int age : ages) {
+    ColdEstimate estimate = ColdEstimate::from_snapshot(snapshot, age);
+    printf("%9ds %10llu %7.1f%% %14llu%s\n", age,
+           static_cast<unsigned long long>(estimate.cold_bytes >> 20),
+           all.total_bytes ? estimate.cold_bytes * 100.0 / all.total_bytes : 0,
+           static_cast<unsigned long long>(estimate.swappable_bytes >> 20),
+           age == config.cold_age ? "  (config)" : "");
+  }
+  return EXIT_SUCCESS;
+}
+
+constexpr int WORKING_SET_MAX_AGES = 8;
+
+struct WorkingSetConfig {
+  bool enable = false;
+  vector<int> ages = {10, 60, 300};
+  int swap_age = 60;
+  int headroom = 20;
+  int sample_interval = 30;
+  bool aging = true;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(enable, ages, swap_age, headroom, sample_interval, aging);
+  }
+
+  void load_from_yaml(const YAML::Node &config) {
+    auto ws = config["virtual_memory"]
+                  ? config["virtual_memory"]["working_set"]
+                  : YAML::Node();
+    if (!ws || !ws.IsMap()) {
+      ALOGW("virtual_memory.working_set section not found in config.");
+      return;
+    }
+
+    auto get_int = [&](const char *key, int fallback) {
+      return ws[key] && ws[key].IsScalar() ? ws[key].as<int>() : fallback;
+    };
+
+    enable = ws["enable"] && ws["enable"].IsScalar() ? ws["enable"].as<bool>()
+                                                     : enable;
+    if (ws["ages"] && ws["ages"].IsSequence()) {
+      ages.clear();
+      for (const auto &age : ws["ages"]) {
+        if (static_cast<int>(ages.size()) == WORKING_SET_MAX_AGES) break;
+        ages.push_back(max(age.as<int>(), 1));
+      }
+      sort(ages.begin(), ages.end());
+    }
+    swap_age = max(get_int("swap_age", swap_age), 1);
+    headroom = clamp(get_int("headroom", headroom), 0, 200);
+    sample_interval = max(get_int("sample_interval", sample_interval), 5);
+    aging = ws["aging"] && ws["aging"].IsScalar() ? ws["aging"].as<bool>()
+                                                  : aging;
+
+    ALOGD("working_set enable: %d, swap_age: %d, headroom: %d, aging: %d",
+          enable, swap_age, headroom, aging);
+  }
+};
+
+/**
+ * Pages by MGLRU generation age, summed over every memcg and node. Pages in
+ * generations younger than an age were used within roughly that age.
+ */
+struct WorkingSet {
+  int ages = 0;
+  array<long, WORKING_SET_MAX_AGES> age_ms{};
+  array<uint64_t, WORKING_SET_MAX_AGES> anon_pages{};
+  array<uint64_t, WORKING_SET_MAX_AGES> file_pages{};
+  long swap_age_ms = 0;
+  uint64_t idle_anon_pages = 0;  // Anonymous pages older than swap_age
+  uint64_t total_anon_pages = 0;
+  uint64_t total_file_pages = 0;
+  size_t generations = 0;
+};
+
+/**
+ * Streaming parser for /sys/kernel/debug/lru_gen and lru_gen_full. Input is
+ * fed in chunks of any size and only generation lines are looked at, so
+ * memory stays constant however many memcgs the file lists. The newest
+ * generation of each lruvec is remembered for proactive aging.
+ *
+ *   memcg  ID  PATH
+ *    node  NID
+ *           SEQ     AGE_MS  NR_ANON  NR_FILE
+ *
+ * lru_gen_full adds tier and mm_walk lines, which are indented deeper than
+ * generation lines.
+ */
+class LruGenParser {
+ public:
+  struct Lruvec {
+    unsigned long memcg;
+    int node;
+    unsigned long max_seq;
+  };
+
+  LruGenParser(WorkingSet &out, vector<Lruvec> *lruvecs = nullptr)
+      : out(out), lruvecs(lruvecs) {}
+
+  void feed(const char *data, size_t len) {
+    const char *end = data + len;
+    while (data < end) {
+      const char *newline = static_cast<const char *>(
+          memchr(data, '\n', end - data));
+      size_t chunk = (newline ? newline : end) - data;
+
+      if (line_len + chunk < sizeof(line)) {
+        memcpy(line + line_len, data, chunk);
+        line_len += chunk;
+      } else {
+        overflow = true;  // Longer than any line worth parsing
+      }
+      if (!newline) return;
+
+      if (!overflow) {
+        line[line_len] = '\0';
+        parse_line(line);
+      }
+      line_len = 0;
+      overflow = false;
+      data = newline + 1;
+    }
+  }
+
+  void finish() {
+    if (line_len > 0 && !overflow) {
+      line[line_len] = '\0';
+      parse_line(line);
+    }
+    line_len = 0;
+  }
+
+ private:
+  WorkingSet &out;
+  vector<Lruvec> *lruvecs;
+  char line[256];
+  size_t line_len = 0;
+  bool overflow = false;
+  unsigned long memcg = 0;
+
+  void parse_line(const char *p) {
+    int indent = 0;
+    while (*p == ' ') p++, indent++;
+
+    if (strncmp(p, "memcg", 5) == 0) {
+      memcg = strtoul(p + 5, nullptr, 10);
+      return;
+    }
+    if (strncmp(p, "node", 4) == 0) {
+      if (lruvecs) {
+        lruvecs->push_back({memcg, static_cast<int>(strtol(p + 4, nullptr, 10)),
+                            0});
+      }
+      return;
+    }
+    // Generation lines are " %10lu %10u ...", tier lines start at 12
+    if (indent > 11 || !isdigit(*p)) return;
+
+    char *next;
+    unsigned long seq = strtoul(p, &next, 10);
+    if (*next != ' ') return;
+    long age = strtol(next, &next, 10);
+    uint64_t pages[2];
+    for (uint64_t &count : pages) {
+      if (*next != ' ') return;
+      count = strtoull(next, &next, 10);
+      // 'x' marks generations already evicted for this type
+      if (*next == 'x') count = 0;
+      if (*next && *next != ' ') next++;
+    }
+
+    out.generations++;
+    out.total_anon_pages += pages[0];
+    out.total_file_pages += pages[1];
+    for (int i = 0; i < out.ages; ++i) {
+      if (age <= out.age_ms[i]) {
+        out.anon_pages[i] += pages[0];
+        out.file_pages[i] += pages[1];
+      }
+    }
+    if (age > out.swap_age_ms) out.idle_anon_pages += pages[0];
+    if (lruvecs && !lruvecs->empty()) lruvecs->back().max_seq = seq;
+  }
+};
+
+/**
+ * Parses an lru_gen file from the start in 16 KB reads.
+ */
+bool read_lru_gen(int fd, WorkingSet &set,
+                  vector<LruGenParser::Lruvec> *lruvecs = nullptr) {
+  if (lseek(fd, 0, SEEK_SET) < 0) return false;
+
+  LruGenParser parser(set, lruvecs);
+  char buf[16384];
+  ssize_t len;
+  while ((len = read(fd, buf, sizeof(buf))) > 0) parser.feed(buf, len);
+  parser.finish();
+  return len == 0 && set.generations > 0;
+}
+
+/**
+ * Sizes the active zram pool from the MGLRU working set: enough devices for
+ * what is already swapped to zram plus the anonymous memory idle for
+ * swap_age, with headroom. With aging on, a new generation is created in
+ * every lruvec each sample, so generation ages stay close to the sample
+ * interval even when the kernel isn't reclaiming.
+ */
+class WorkingSetEstimator {
+ public:
+  WorkingSetEstimator(const WorkingSetConfig &config)
+      : config(config),
+        path(root_path("/sys/kernel/debug/lru_gen")),
+        page_kb(sysconf(_SC_PAGESIZE) >> 10),
+        supported(config.enable) {
+    if (supported && !kernel_caps.has(Capability::LRU_GEN_STATS)) {
+      ALOGW("No MGLRU stats at %s, working set sizing disabled.",
+            path.c_str());
+      supported = false;
+    }
+  }
+
+  ~WorkingSetEstimator() {
+    if (fd >= 0) close(fd);
+  }
+
+  void tick() {
+    if (!supported) return;
+
+    auto now = steady_clock::now();
+    if (now - last_sample < seconds(config.sample_interval)) return;
+    last_sample = now;
+
+    if (fd < 0) {
+      fd = open(path.c_str(), (config.aging ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+      if (fd < 0) {
+        ALOGW("Cannot open %s (%s), working set sizing disabled.",
+              path.c_str(), strerror(errno));
+        supported = false;
+        return;
+      }
+    }
+
+    WorkingSet set = empty_set();
+    lruvecs.clear();
+    if (!read_lru_gen(fd, set, config.aging ? &lruvecs : nullptr)) {
+      ALOGW("No MGLRU generations in %s, working set sizing disabled.",
+            path.c_str());
+      supported = false;
+      return;
+    }
+    current = set;
+    idle_anon_kb.store(set.idle_anon_pages * page_kb, memory_order_relaxed);
+
+    if (config.aging) age();
+    log();
+  }
+
+  /**
+   * Number of zram devices the working set calls for, -1 without an
+   * estimate.
+   */
+  int zram_devices_needed() const {
+    long needed_kb = idle_anon_kb.load(memory_order_relaxed);
+    if (needed_kb < 0) return -1;
+
+    vector<long> sizes;
+    for (const auto &device : swap_model.active_devices()) {
+      if (device.tier != SwapTier::ZRAM) continue;
+      needed_kb += device.used_kb;
+      sizes.push_back(device.size_kb);
+    }
+    needed_kb += needed_kb * config.headroom / 100;
+
+    vector<SwapDevice> inactive = swap_model.inactive_devices(SwapTier::ZRAM);
+    for (auto it = inactive.rbegin(); it != inactive.rend(); ++it) {
+      sizes.push_back(read_long(ZRAM_SYSFS_DIR + "/zram" +
+                                    to_string(it->number) + "/disksize",
+                                0) >>
+                      10);
+    }
+
+    int devices = 0;
+    for (long size_kb : sizes) {
+      if (needed_kb <= 0 && devices > 0) break;
+      needed_kb -= size_kb;
+      devices++;
+    }
+    return devices;
+  }
+
+ private:
+  const WorkingSetConfig &config;
+  const string path;
+  const long page_kb;
+  bool supported;
+  int fd = -1;
+  // current is tick()'s own, the control loop reads idle_anon_kb, -1
+  // without an estimate
+  WorkingSet current;
+  atomic<long> idle_anon_kb{-1};
+  vector<LruGenParser::Lruvec> lruvecs;
+  steady_clock::time_point last_sample{};
+
+  WorkingSet empty_set() const {
+    WorkingSet set;
+    set.ages = config.ages.size();
+    for (int i = 0; i < set.ages; ++i) set.age_ms[i] = config.ages[i] * 1000L;
+    set.swap_age_ms = config.swap_age * 1000L;
+    return set;
+  }
+
+  void age() {
+    char command[96];
+    for (const auto &lruvec : lruvecs) {
+      int len = snprintf(command, sizeof(command), "+ %lu %d %lu\n",
+                         lruvec.memcg, lruvec.node, lruvec.max_seq);
+      // Fails harmlessly when the kernel aged the lruvec meanwhile
+      if (write(fd, command, len) < 0 && errno == EPERM) {
+        ALOGW("MGLRU aging not permitted, using kernel generations only.");
+        break;
+      }
+    }
+  }
+
+  void log() const {
+    char text[256];
+    int pos = 0;
+    for (int i = 0; i < current.ages; ++i) {
+      pos += snprintf(text + pos, sizeof(text) - pos, "%s%lds: %llu MB",
+                      i ? ", " : "", current.age_ms[i] / 1000,
+                      static_cast<unsigned long long>(
+                          (current.anon_pages[i] + current.file_pages[i]) *
+                          page_kb >> 10));
+      if (pos >= static_cast<int>(sizeof(text))) break;
+    }
+    int needed = zram_devices_needed();
+    ALOGD("Working set %s; idle anon %llu MB, zram devices needed: %d", text,
+          static_cast<unsigned long long>(current.idle_anon_pages * page_kb >>
+                                          10),
+          needed);
+    journal.append(
+        JournalType::WORKING_SET, 0,
+        static_cast<int32_t>(current.ages ? (current.anon_pages[0] +
+                                             current.file_pages[0]) *
+                                                page_kb >> 10
+                                          : 0),
+        static_cast<int32_t>(current.idle_anon_pages * page_kb >> 10), needed);
+  }
+};
+
+/**
+ * Times the lru_gen parser on a captured file, e.g.
+ * cat /sys/kernel/debug/lru_gen_full > lru_gen.txt
+ */
+int bench_lru_gen(const string &path, long iterations) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    fprintf(stderr, "Cannot open %s: %s\n", path.c_str(), strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  WorkingSetConfig config;
+  WorkingSet set;
+  struct rusage before, after;
+  getrusage(RUSAGE_SELF, &before);
+  auto start = steady_clock::now();
+  for (long i = 0; i < iterations; ++i) {
+    set = WorkingSet();
+    set.ages = config.ages.size();
+    for (int a = 0; a < set.ages; ++a) set.age_ms[a] = config.ages[a] * 1000L;
+    set.swap_age_ms = config.swap_age * 1000L;
+    if (!read_lru_gen(fd, set)) {
+      fprintf(stderr, "No MGLRU generations in %s\n", path.c_str());
+      close(fd);
+      return EXIT_FAILURE;
+    }
+  }
+  double elapsed = duration<double>(steady_clock::now() - start).count();
+  getrusage(RUSAGE_SELF, &after);
+  close(fd);
+
+  long page_kb = sysconf(_SC_PAGESIZE) >> 10;
+  printf("%s: %.1f MB, %zu generations\n", path.c_str(),
+         st.st_size / 1048576.0, set.generations);
+  printf("%.3f ms/parse, %.0f MB/s, %.1f ns/generation, max RSS growth %ld KB\n",
+         elapsed * 1000 / iterations,
+         st.st_size * static_cast<double>(iterations) / 1048576.0 / elapsed,
+         elapsed * 1e9 / iterations / max<size_t>(set.generations, 1),
+         after.ru_maxrss - before.ru_maxrss);
+  for (int a = 0; a < set.ages; ++a) {
+    printf("working set %4lds: anon %8llu MB, file %8llu MB\n",
+           set.age_ms[a] / 1000,
+           static_cast<unsigned long long>(set.anon_pages[a] * page_kb >> 10),
+           static_cast<unsigned long long>(set.file_pages[a] * page_kb >> 10));
+  }
+  printf("idle anon (> %ds): %llu MB of %llu MB\n", config.swap_age,
+         static_cast<unsigned long long>(set.idle_anon_pages * page_kb >> 10),
+         static_cast<unsigned long long>(set.total_anon_pages * page_kb >> 10));
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Overrides applied while one of the listed apps is in the foreground.
+ */
+struct AppProfile {
+  string name;
+  vector<string> packages;
+  vector<int> uids;
+  DynamicSwappinessConfig swappiness;
+  bool swapoff = true;  // Drain swap devices while the app is in front
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(name, packages, uids, swappiness, swapoff);
+  }
+};
+
+struct ProfilesConfig {
+  bool enable = false;
+  string top_app = "/dev/cpuset/top-app";
+  vector<AppProfile> apps;  // In config order, the first match wins
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(enable, top_app, apps);
+  }
+
+  void load_from_yaml(const YAML::Node &config,
+                      const DynamicSwappinessConfig &base) {
+    auto node = config["profiles"];
+    if (!node || !node.IsMap()) {
+      ALOGW("profiles section not found in config.");
+      return;
+    }
+
+    enable = node["enable"].as<bool>(enable);
+    top_app = node["top_app"].as<string>(top_app);
+    auto apps_node = node["apps"];
+    if (!apps_node || !apps_node.IsMap()) return;
+
+    for (const auto &entry : apps_node) {
+      const YAML::Node &app = entry.second;
+      AppProfile profile;
+      profile.name = entry.first.as<string>();
+      profile.swappiness = base;
+      if (app["packages"] && app["packages"].IsSequence()) {
+        for (const auto &package : app["packages"]) {
+          profile.packages.push_back(package.as<string>());
+        }
+      }
+      if (app["uids"] && app["uids"].IsSequence()) {
+        for (const auto &uid : app["uids"]) {
+          profile.uids.push_back(uid.as<int>());
+        }
+      }
+      auto range = app["swappiness_range"];
+      if (range && range.IsMap()) {
+        profile.swappiness.min_swappiness =
+            range["min"].as<int>(base.min_swappiness);
+        profile.swappiness.max_swappiness =
+            range["max"].as<int>(base.max_swappiness);
+        if (profile.swappiness.min_swappiness >
+            profile.swappiness.max_swappiness) {
+          ALOGW("profiles.%s: swappiness_range min %d is above max %d, "
+                "using the default range.",
+                profile.name.c_str(), profile.swappiness.min_swappiness,
+                profile.swappiness.max_swappiness);
+          profile.swappiness.min_swappiness = base.min_swappiness;
+          profile.swappiness.max_swappiness = base.max_swappiness;
+        }
+      }
+      profile.swappiness.levels = max(app["levels"].as<int>(base.levels), 1);
+      profile.swapoff = app["swapoff"].as<bool>(profile.swapoff);
+
+      ALOGD("profile %s: %zu packages, %zu uids, swappiness %d-%d, levels %d, "
+            "swapoff %d",
+            profile.name.c_str(), profile.packages.size(),
+            profile.uids.size(), profile.swappiness.min_swappiness,
+            profile.swappiness.max_swappiness, profile.swappiness.levels,
+            profile.swapoff);
+      apps.push_back(move(profile));
+    }
+  }
+};
+
+/**
+ * Profile switches, from the top-app change to the new swappiness applied.
+ */
+struct ProfileStats {
+  atomic<uint64_t> switches{0};
+  atomic<uint64_t> latency_us{0};
+  atomic<uint64_t> max_latency_us{0};
+
+  void record(uint64_t us) {
+    switches.fetch_add(1, memory_order_relaxed);
+    latency_us.fetch_add(us, memory_order_relaxed);
+    if (us > max_latency_us.load(memory_order_relaxed)) {
+      max_latency_us.store(us, memory_order_relaxed);
+    }
+  }
+};
+
+ProfileStats profile_stats;
+
+/**
+ * Parses a cgroup.procs listing, one pid per line, stopping at the first
+ * thing that isn't a number.
+ *
+ * @return Number of pids stored, at most max.
+ */
+size_t parse_pids(const char *buf, pid_t *pids, size_t max) {
+  size_t count = 0;
+  const char *cursor = buf;
+  while (*cursor && count < max) {
+    char *end;
+    long pid = strtol(cursor, &end, 10);
+    if (end == cursor || pid <= 0) break;
+    pids[count++] = pid;
+    cursor = end;
+  }
+  return count;
+}
+
+/**
+ * Follows the foreground app through the top-app cpuset. ActivityManager
+ * moves an app there by writing its pids to cgroup.procs, which wakes an
+ * inotify watch on the directory, so the cpuset is only read when the
+ * foreground actually changes. A thread of its own sits in poll() on the
+ * watch, so a change is timed from when it happened, not from when the
+ * control loop gets to it.
+ */
+class ForegroundWatcher {
+ public:
+  explicit ForegroundWatcher(const ProfilesConfig &config) : config(config) {
+    if (!config.enable || config.apps.empty()) return;
+
+    string dir = root_path(config.top_app);
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_MODIFY) < 0) {
+      ALOGW("Cannot watch %s (%s), app profiles disabled.", dir.c_str(),
+            strerror(errno));
+      if (fd >= 0) close(fd);
+      fd = -1;
+      return;
+    }
+    procs_path = dir + "/cgroup.procs";
+    changed = true;
+    changed_at = steady_clock::now();
+    watcher = thread([this] { watch(); });
+    ALOGI("App profiles: %zu, watching %s", config.apps.size(), dir.c_str());
+  }
+
+  ~ForegroundWatcher() {
+    stopping = true;
+    if (watcher.joinable()) watcher.join();
+    if (fd >= 0) close(fd);
+  }
+
+  /**
+   * Sleeps up to timeout, returning early with true when top-app changed.
+   */
+  bool wait(milliseconds timeout) {
+    if (fd < 0) {
+      this_thread::sleep_for(timeout);
+      return false;
+    }
+    unique_lock<mutex> guard(lock);
+    return wakeup.wait_for(guard, timeout, [this] { return changed; });
+  }
+
+  /**
+   * Resolves the foreground profile after a top-app change. True when it
+   * differs from the previous one.
+   */
+  bool poll_switch() {
+    if (fd < 0) return false;
+    {
+      lock_guard<mutex> guard(lock);
+      if (!changed) return false;
+      changed = false;
+      switch_started = changed_at;
+    }
+
+    int uid = -1;
+    const AppProfile *next = resolve(uid);
+    if (next == current) return false;
+    current = next;
+    foreground_uid = uid;
+    return true;
+  }
+
+  /**
+   * Records how long the switch took once its swappiness is applied.
+   */
+  void record_switch() {
+    auto latency = duration_cast<microseconds>(steady_clock::now() -
+                                               switch_started)
+                       .count();
+    profile_stats.record(latency);
+    ALOGI("Profile %s (uid %d) applied in %.1f ms",
+          current ? current->name.c_str() : "default", foreground_uid,
+          latency / 1000.0);
+    journal.append(JournalType::PROFILE, 0,
+                   current ? static_cast<int32_t>(current - config.apps.data()) + 1
+                           : 0,
+                   static_cast<int32_t>(min<long long>(latency, INT32_MAX)),
+                   foreground_uid);
+  }
+
+  // Profile of the foreground app, nullptr for the default config
+  const AppProfile *profile() const { return current; }
+
+ private:
+  const ProfilesConfig &config;
+  int fd = -1;
+  string procs_path;
+  thread watcher;
+  atomic<bool> stopping{false};
+  // Guard changed and changed_at, the time of the first change since the
+  // last switch
+  mutex lock;
+  condition_variable wakeup;
+  bool changed = false;
+  steady_clock::time_point changed_at;
+  steady_clock::time_point switch_started;
+  const AppProfile *current = nullptr;
+  int foreground_uid = -1;
+
+  void watch() {
+    pollfd pfd{fd, POLLIN, 0};
+    while (running && !stopping) {
+      if (poll(&pfd, 1, 100) <= 0) continue;
+
+      auto now = steady_clock::now();
+      char events[4096];
+      bool any = false;
+      while (read(fd, events, sizeof(events)) > 0) any = true;
+      if (!any) continue;
+      lock_guard<mutex> guard(lock);
+      if (!changed) {
+        changed = true;
+        changed_at = now;
+      }
+      wakeup.notify_all();
+    }
+  }
+
+  const AppProfile *resolve(int &uid) const {
+    char buf[4096];
+    int procs = open(procs_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (procs < 0) return nullptr;
+    ssize_t len = read(procs, buf, sizeof(buf) - 1);
+    close(procs);
+    if (len <= 0) return nullptr;
+    buf[len] = '\0';
+
+    const AppProfile *best = nullptr;
+    pid_t pids[1024];
+    size_t count = parse_pids(buf, pids, size(pids));
+    for (size_t i = 0; i < count; ++i) {
+      pid_t pid = pids[i];
+      string proc = root_path("/proc/") + to_string(pid);
+      struct stat st;
+      if (stat(proc.c_str(), &st) != 0) continue;
+      int app_id = st.st_uid % 100000;
+      if (app_id < 10000) continue;  // System processes share top-app
+
+      char name[256] = {};
+      int cmdline = open((proc + "/cmdline").c_str(), O_RDONLY | O_CLOEXEC);
+      if (cmdline >= 0) {
+        read(cmdline, name, sizeof(name) - 1);
+        close(cmdline);
+      }
+      // Services of an app run as package:name
+      if (char *colon = strchr(name, ':')) *colon = '\0';
+
+      if (uid < 0) uid = st.st_uid;
+      for (const auto &app : config.apps) {
+        if (best && &app >= best) break;
+        if (contains(string(name), app.packages) ||
+            contains(static_cast<int>(st.st_uid), app.uids) ||
+            contains(app_id, app.uids)) {
+          best = &app;
+          uid = st.st_uid;
+          break;
+        }
+      }
+    }
+    return best;
+  }
+};
+
+/**
+ * Captures a page corpus for the zram benchmark: resident anonymous pages
+ * of background apps, read through /proc/<pid>/mem. Pages that are not
+ * present are skipped using pagemap, so the capture never swaps them in.
+ *
+ * @return Pages captured, -1 on error.
+ */
+long capture_pages(const string &out_path, long max_mb, int min_oom_score_adj) {
+  int out = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 0644);
+  if (out < 0) {
+    fprintf(stderr, "Unable to create %s: %s\n", out_path.c_str(),
+            strerror(errno));
+    return -1;
+  }
+
+  const long page_size = sysconf(_SC_PAGESIZE);
+  long remaining = (static_cast<long long>(max_mb) << 20) / page_size;
+  long captured = 0;
+  vector<char> page(page_size);
+  vector<uint64_t> pagemap;
+
+  DIR *proc = opendir(root_path("/proc").c_str());
+  while (proc && remaining > 0) {
+    dirent *entry = readdir(proc);
+    if (!entry) break;
+    if (!isdigit(entry->d_name[0])) continue;
+
+    string base = root_path("/proc/") + entry->d_name;
+    if (read_long(base + "/oom_score_adj", -1000) < min_oom_score_adj) continue;
+
+    FILE *maps = fopen((base + "/maps").c_str(), "r");
+    int mem = open((base + "/mem").c_str(), O_RDONLY | O_CLOEXEC);
+    int map = open((base + "/pagemap").c_str(), O_RDONLY | O_CLOEXEC);
+    char line[512];
+
+    while (maps && mem >= 0 && map >= 0 && remaining > 0 &&
+           fgets(line, sizeof(line), maps)) {
+      if (!is_anon_vma(line)) continue;
+
+      unsigned long start, end;
+      sscanf(line, "%lx-%lx", &start, &end);
+      size_t pages = (end - start) / page_size;
+      pagemap.resize(pages);
+      ssize_t len = pread(map, pagemap.data(), pages * sizeof(uint64_t),
+                          (start / page_size) * sizeof(uint64_t));
+      if (len <= 0) continue;
+
+      for (size_t i = 0; i < len / sizeof(uint64_t) && remaining > 0; ++i) {
+        // Bit 63: page present in RAM
+        if (!(pagemap[i] >> 63)) continue;
+        if (pread(mem, page.data(), page_size, start + i * page_size) !=
+            page_size) {
+          continue;
+        }
+        if (::write(out, page.data(), page_size) != page_size) break;
+        ++captured;
+        --remaining;
+      }
+    }
+
+    if (maps) fclose(maps);
+    if (mem >= 0) close(mem);
+    if (map >= 0) close(map);
+  }
+  if (proc) closedir(proc);
+  close(out);
+  return captured;
+}
+
+struct ZramBenchResult {
+  string algorithm;
+  int cpu;
+  long capacity;
+  double ratio;
+  double compress_mbps;
+  double decompress_mbps;
+  double cpu_ms_per_mb;
+};
+
+/**
+ * One representative CPU per core type, slowest type first.
+ */
+vector<pair<long, int>> core_types() {
+  vector<pair<long, int>> types;
+  for (const auto &[capacity, cpus] : cpu_clusters()) {
+    types.emplace_back(capacity, cpus.front());
+  }
+  return types;
+}
+
+/**
+ * Benchmarks the kernel's own zram compressors on a page corpus: a scratch
+ * zram device is created per algorithm and the corpus is written to and
+ * read back from it with O_DIRECT on every core type, so the numbers are
+ * those the swap path will actually see.
+ */
+class ZramBenchmark {
+ public:
+  explicit ZramBenchmark(const string &corpus_path) {
+    int fd = open(corpus_path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      if (fd >= 0) close(fd);
+      return;
+    }
+
+    const long page_size = sysconf(_SC_PAGESIZE);
+    size = st.st_size / page_size * page_size;
+    if (size > 0 && posix_memalign(&corpus, page_size, size) == 0 &&
+        posix_memalign(&scratch, page_size, size) == 0) {
+      size_t done = 0;
+      ssize_t len;
+      while (done < size &&
+             (len = read(fd, static_cast<char *>(corpus) + done,
+                         size - done)) > 0) {
+        done += len;
+      }
+      size = done / page_size * page_size;
+    }
+    close(fd);
+  }
+  ZramBenchmark(const ZramBenchmark &) = delete;
+  ZramBenchmark &operator=(const ZramBenchmark &) = delete;
+  ~ZramBenchmark() {
+    free(corpus);
+    free(scratch);
+  }
+
+  size_t corpus_size() const { return corpus && scratch ? size : 0; }
+
+  vector<ZramBenchResult> run() {
+    vector<ZramBenchResult> results;
+    if (corpus_size() == 0) return results;
+
+    auto cores = core_types();
+    for (const auto &algorithm : algorithms()) {
+      int id = add_device();
+      if (id < 0) {
+        fprintf(stderr, "Unable to create a scratch zram device\n");
+        break;
+      }
+      bench(id, algorithm, cores, results);
+      remove_device(id);
+    }
+
+    cpu_set_t all;
+    CPU_ZERO(&all);
+    for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF); ++cpu) {
+      CPU_SET(cpu, &all);
+    }
+    sched_setaffinity(0, sizeof(all), &all);
+    return results;
+  }
+
+  /**
+   * Primary: the best ratio among algorithms decompressing on the slowest
+   * core at least half as fast as the fastest one, since decompression is
+   * on the app launch path. Secondary: the best ratio overall, when it beats
+   * the primary by 10%, used for recompression of idle pages.
+   */
+  static pair<string, string> recommend(
+      const vector<ZramBenchResult> &results) {
+    if (results.empty()) return {};
+
+    long slowest = results.front().capacity;
+    for (const auto &r : results) slowest = min(slowest, r.capacity);
+
+    vector<const ZramBenchResult *> little;
+    double fastest = 0;
+    for (const auto &r : results) {
+      if (r.capacity != slowest) continue;
+      little.push_back(&r);
+      fastest = max(fastest, r.decompress_mbps);
+    }
+
+    const ZramBenchResult *primary = nullptr, *densest = nullptr;
+    for (const auto *r : little) {
+      if (r->decompress_mbps >= fastest / 2 &&
+          (!primary || r->ratio > primary->ratio)) {
+        primary = r;
+      }
+      if (!densest || r->ratio > densest->ratio) densest = r;
+    }
+
+    string secondary = "none";
+    if (densest != primary && densest->ratio > primary->ratio * 1.1) {
+      secondary = densest->algorithm;
+    }
+    return {primary->algorithm, secondary};
+  }
+
+ private:
+  void *corpus = nullptr;
+  void *scratch = nullptr;
+  size_t size = 0;
+
+  static string device_path(int id) {
+    string android = ZRAM_DIR + "/zram" + to_string(id);
+    return access(android.c_str(), F_OK) == 0 ? android
+                                              : root_path("/dev/zram") + to_string(id);
+  }
+
+  static string sysfs_path(int id) {
+    return (ZRAM_SYSFS_DIR + "/zram") + to_string(id);
+  }
+
+  static int add_device() {
+    return static_cast<int>(read_long(root_path("/sys/class/zram-control/hot_add"), -1));
+  }
+
+  static void remove_device(int id) {
+    write_sysfs(sysfs_path(id) + "/reset", "1");
+    write_sysfs(root_path("/sys/class/zram-control/hot_remove"), to_string(id));
+  }
+
+  /**
+   * Algorithms the kernel offers, read from a scratch device since the
+   * list is the same for every device.
+   */
+  static vector<string> algorithms() {
+    vector<string> names;
+    int id = add_device();
+    if (id < 0) return names;
+
+    ifstream file(sysfs_path(id) + "/comp_algorithm");
+    string name;
+    while (file >> name) {
+      if (name.front() == '[') name = name.substr(1, name.size() - 2);
+      names.push_back(name);
+    }
+    remove_device(id);
+    return names;
+  }
+
+  static double thread_cpu_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+  }
+
+  void bench(int id, const string &algorithm,
+             const vector<pair<long, int>> &cores,
+             vector<ZramBenchResult> &results) {
+    string sysfs = sysfs_path(id);
+    if (!write_sysfs(sysfs + "/comp_algorithm", algorithm) ||
+        !write_sysfs(sysfs + "/disksize", to_string(size + (1 << 20)))) {
+      fprintf(stderr, "Unable to set up zram%d with %s\n", id,
+              algorithm.c_str());
+      return;
+    }
+
+    int fd = open(device_path(id).c_str(), O_RDWR | O_DIRECT | O_CLOEXEC);
+    if (fd < 0) {
+      fprintf(stderr, "Unable to open %s: %s\n", device_path(id).c_str(),
+              strerror(errno));
+      return;
+    }
+
+    const size_t chunk = 1 << 20;
+    double mb = size / 1048576.0;
+    for (const auto &[capacity, cpu] : cores) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      sched_setaffinity(0, sizeof(set), &set);
+
+      double cpu_start = thread_cpu_ms();
+      auto start = steady_clock::now();
+      for (size_t off = 0; off < size; off += chunk) {
+        pwrite(fd, static_cast<char *>(corpus) + off, min(chunk, size - off),
+               off);
+      }
+      fdatasync(fd);
+      double write_s =
+          duration<double>(steady_clock::now() - start).count();
+      double write_cpu = thread_cpu_ms() - cpu_start;
+
+      start = steady_clock::now();
+      for (size_t off = 0; off < size; off += chunk) {
+        pread(fd, static_cast<char *>(scratch) + off, min(chunk, size - off),
+              off);
+      }
+      double read_s = duration<double>(steady_clock::now() - start).count();
+
+      if (memcmp(corpus, scratch, size) != 0) {
+        fprintf(stderr, "%s: data read back differs, skipped\n",
+                algorithm.c_str());
+        break;
+      }
+
+      long long values[MM_STAT_FIELDS] = {};
+      read_mm_stat(sysfs, values);
+      long long orig = values[MM_ORIG_DATA_SIZE];
+      long long compr = values[MM_COMPR_DATA_SIZE];
+
+      results.push_back({algorithm, cpu, capacity,
+                         compr > 0 ? static_cast<double>(orig) / compr : 0,
+                         mb / write_s, mb / read_s, write_cpu / mb});
+    }
+    close(fd);
+  }
+};
+
+int bench_zram(const string &corpus_path, bool apply) {
+  ZramBenchmark benchmark(corpus_path);
+  if (benchmark.corpus_size() == 0) {
+    fprintf(stderr, "Unable to load page corpus %s\n", corpus_path.c_str());
+    return EXIT_FAILURE;
+  }
+
+  printf("Corpus: %zu MB\n", benchmark.corpus_size() >> 20);
+  printf("%-10s %4s %8s %6s %12s %12s %10s\n", "algorithm", "cpu", "capacity",
+         "ratio", "comp MB/s", "decomp MB/s", "cpu ms/MB");
+
+  auto results = benchmark.run();
+  for (const auto &r : results) {
+    printf("%-10s %4d %8ld %6.2f %12.1f %12.1f %10.2f\n", r.algorithm.c_str(),
+           r.cpu, r.capacity, r.ratio, r.compress_mbps, r.decompress_mbps,
+           r.cpu_ms_per_mb);
+  }
+  if (results.empty()) return EXIT_FAILURE;
+
+  auto [primary, secondary] = ZramBenchmark::recommend(results);
+  printf("Recommended: comp_algorithm %s, recomp_algorithm %s\n",
+         primary.c_str(), secondary.c_str());
+
+  if (apply) {
+    ofstream file(ZRAM_ALGORITHM_FILE);
+    file << primary << " " << secondary << "\n";
+    if (!file) {
+      fprintf(stderr, "Unable to write %s\n", ZRAM_ALGORITHM_FILE.c_str());
+      return EXIT_FAILURE;
+    }
+    printf("Saved to %s, used for zram devices initialized from now on\n",
+           ZRAM_ALGORITHM_FILE.c_str());
+  }
+  return EXIT_SUCCESS;
+}
+
+// Reset in each worker forked by the supervisor
+steady_clock::time_point process_start = steady_clock::now();
+
+/**
+ * Milliseconds elapsed since the process started.
+ */
+long ms_since_start() {
+  return duration_cast<milliseconds>(steady_clock::now() - process_start)
+      .count();
+}
+
+/**
+ * Bitwise CRC-32 (IEEE), small inputs only.
+ */
+uint32_t crc32(const void *data, size_t len) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; ++i) {
+    crc ^= bytes[i];
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+constexpr uint32_t LEARNED_STATE_MAGIC = 0x54534D46;  // "FMST"
+constexpr uint16_t LEARNED_STATE_VERSION = 3;
+
+/**
+ * On-disk layout of the learned state. Fixed-width fields only; bump
+ * LEARNED_STATE_VERSION on any layout change.
+ */
+struct LearnedState {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+  uint32_t checksum;  // CRC-32 of the struct with this field zeroed
+  uint32_t sessions;
+  int64_t saved_at;
+  float hourly_pressure[24][3];  // Mean PSI some avg60 per hour and resource
+  uint32_t hourly_samples[24];
+  float swap_fill_rate[SWAP_TIER_COUNT];  // MB per minute while filling
+  int32_t last_swappiness;
+  int32_t active_swaps;
+  uint32_t first_decision_ms;
+};
+
+struct JournalConfig {
+  bool enable = true;
+  int size_kb = 2048;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(enable, size_kb);
+  }
+
+  void load_from_yaml(const YAML::Node &config) {
+    auto node = config["journal"];
+    if (!node || !node.IsMap()) {
+      ALOGW("journal section not found in config.");
+      return;
+    }
+    enable = node["enable"].as<bool>(enable);
+    size_kb = clamp(node["size_kb"].as<int>(size_kb), 64, 65536);
+    ALOGD("journal enable: %d, size_kb: %d", enable, size_kb);
+  }
+};
+
+/**
+ * Scales a pressure percentage to the journal's fixed-point integers.
+ */
+int32_t journal_pressure(double pressure) {
+  return isnan(pressure) ? -1 : static_cast<int32_t>(lround(pressure * 100));
+}
+
+/**
+ * Publishes memory pressure, swappiness and swap status into the module.prop
+ * description shown by the root manager. The file is rewritten only when a
+ * displayed value changes, via a temp file and rename so the manager never
+ * reads a half written description.
+ */
+class StatusPublisher {
+ public:
+  void update(int memory_pressure, int swappiness, bool swap_running) {
+    if (memory_pressure < 0) return;
+
+    const char *emoji = pressure_emoji(memory_pressure);
+    bool pressure_moved = last_pressure < 0 ||
+                          abs(memory_pressure - last_pressure) >= 5;
+
+    if (pressure_moved && memory_pressure != last_pressure) {
+      log_pressure(memory_pressure, emoji);
+    }
+
+    if (!pressure_moved && emoji == last_emoji &&
+        swappiness == last_swappiness && swap_running == last_swap_running) {
+      return;
+    }
+
+    if (publish(memory_pressure, emoji, swappiness, swap_running)) {
+      if (pressure_moved) last_pressure = memory_pressure;
+      last_emoji = emoji;
+      last_swappiness = swappiness;
+      last_swap_running = swap_running;
+    }
+  }
+
+ private:
+  int last_pressure = -1;
+  const char *last_emoji = nullptr;
+  int last_swappiness = -1;
+  bool last_swap_running = false;
+
+  static const char *pressure_emoji(int memory_pressure) {
+    if (memory_pressure > 80) return "⚪";
+    if (memory_pressure > 60) return "🟩";
+    if (memory_pressure > 40) return "🟨";
+    return "🟥";
+  }
+
+  static void log_pressure(int memory_pressure, const char *emoji) {
+    if (memory_pressure > 80) {
+      ALOGI("Sleek! It's (memory_pressure: %s %d), got nothing in RAM huh?",
+            emoji, memory_pressure);
+    } else if (memory_pressure > 60) {
+      ALOGI("What expected, just normal usage (memory_pressure: %s %d)",
+            emoji, memory_pressure);
+    } else if (memory_pressure > 40) {
+      ALOGI("I don't like potato (memory_pressure: %s %d)", emoji,
+            memory_pressure);
+    } else {
+      ALOGI("Call for ambulance (memory_pressure: %s %d)", emoji,
+            memory_pressure);
+    }
+  }
+
+  /**
+   * Replaces the text after "<label>...: " up to the terminator.
+   */
+  static void replace_field(string &text, const string &label,
+                            const string &terminators, const string &value) {
+    size_t pos = text.find(label);
+    if (pos == string::npos) return;
+    size_t start = text.find(": ", pos);
+    if (start == string::npos) return;
+    start += 2;
+    size_t end = text.find_first_of(terminators, start);
+    if (end == string::npos) end = text.size();
+    text.replace(start, end - start, value);
+  }
+
+  static string read_file(const string &path) {
+    ifstream file(path);
+    stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+  }
+
+  bool publish(int memory_pressure, const char *emoji, int swappiness,
+               bool swap_running) {
+    string prop = read_file(MODULE_PROP);
+    if (prop.empty()) prop = read_file(LOG_FOLDER + "/module.prop");
+    if (prop.empty()) {
+      ALOGE_ONCE("module_prop", "Failed to read %s", MODULE_PROP.c_str());
+      return false;
+    }
+
+    string updated = prop;
+    replace_field(updated, "Memory pressure", ",",
+                  emoji + to_string(memory_pressure));
+    replace_field(updated, "swappiness", ",", to_string(swappiness));
+    replace_field(updated, "Swap Status", ".",
+                  swap_running ? "✅ Running" : "❌ Not Running");
+    if (updated == prop) return true;
+
+    string tmp = MODULE_PROP + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      ALOGE_ONCE("module_prop", "Failed to write %s: %s", tmp.c_str(),
+                 strerror(errno));
+      return false;
+    }
+    bool ok = ::write(fd, updated.data(), updated.size()) ==
+              static_cast<ssize_t>(updated.size());
+    close(fd);
+
+    if (!ok || rename(tmp.c_str(), MODULE_PROP.c_str()) != 0) {
+      ALOGE_ONCE("module_prop", "Failed to update %s", MODULE_PROP.c_str());
+      unlink(tmp.c_str());
+      return false;
+    }
+    ALOG_RESET("module_prop");
+    return true;
+  }
+};
+
+constexpr int METRICS_MAX_DEVICES = 32;
+constexpr size_t METRICS_BUFFER_SIZE = 64 * 1024;
+
+struct MetricsConfig {
+  bool enable = false;
+  string unix_socket = "/dev/socket/fmiop_metrics";
+  int tcp_port = 0;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(enable, unix_socket, tcp_port);
+  }
+
+  void load_from_yaml(const YAML::Node &config) {
+    auto node = config["metrics"];
+    if (!node || !node.IsMap()) {
+      ALOGW("metrics section not found in config.");
+      return;
+    }
+
+    enable = node["enable"].as<bool>(enable);
+    unix_socket = node["unix_socket"].as<string>(unix_socket);
+    tcp_port = clamp(node["tcp_port"].as<int>(tcp_port), 0, 65535);
+    ALOGD("metrics enable: %d, unix_socket: %s, tcp_port: %d", enable,
+          unix_socket.c_str(), tcp_port);
+  }
+};
+
+/**
+ * State of the last tick, fixed size so publishing and rendering never
+ * allocate.
+ */
+struct MetricsSnapshot {
+  struct Device {
+    char path[64];
+    SwapTier tier;
+    int number;
+    long size_kb;
+    long used_kb;
+    int priority;
+  };
+
+  PsiSample psi;
+  int64_t window_us[PSI_MAX_WINDOWS];
+  int window_count = 0;
+  int swappiness = -1;
+  Device devices[METRICS_MAX_DEVICES];
+  int device_count = 0;
+  uint64_t ticks = 0;
+};
+
+/**
+ * Serves OpenMetrics text over HTTP on a Unix socket and optionally on a
+ * loopback TCP port. The control loop publishes a snapshot every tick;
+ * scrapes render it into a preallocated buffer.
+ */
+class MetricsServer {
+ public:
+  void publish(const PsiSample &psi, int swappiness,
+               const vector<SwapDevice> &active) {
+    lock_guard<mutex> guard(lock);
+    latest.psi = psi;
+    latest.window_count = psi_sampler.windows_used();
+    for (int w = 0; w < latest.window_count; ++w) {
+      latest.window_us[w] = psi_sampler.window_length(w);
+    }
+    latest.swappiness = swappiness;
+    latest.device_count = min<int>(active.size(), METRICS_MAX_DEVICES);
+    for (int i = 0; i < latest.device_count; ++i) {
+      const SwapDevice &device = active[i];
+      auto &out = latest.devices[i];
+      snprintf(out.path, sizeof(out.path), "%s", device.path.c_str());
+      out.tier = device.tier;
+      out.number = device.number;
+      out.size_kb = device.size_kb;
+      out.used_kb = device.used_kb;
+      out.priority = device.priority;
+    }
+    latest.ticks++;
+  }
+
+  void run(const MetricsConfig &config) {
+    buffer.reset(new char[METRICS_BUFFER_SIZE]);
+
+    pollfd fds[2];
+    int count = 0;
+    if (!config.unix_socket.empty()) {
+      int fd = listen_unix(config.unix_socket);
+      if (fd >= 0) fds[count++] = {fd, POLLIN, 0};
+    }
+    if (config.tcp_port > 0) {
+      int fd = listen_tcp(config.tcp_port);
+      if (fd >= 0) fds[count++] = {fd, POLLIN, 0};
+    }
+    if (count == 0) {
+      ALOGE("Metrics endpoint has nothing to listen on.");
+      return;
+    }
+
+    while (running) {
+      if (poll(fds, count, 1000) <= 0) continue;
+      for (int i = 0; i < count; ++i) {
+        if (!(fds[i].revents & POLLIN)) continue;
+        int client = accept4(fds[i].fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client >= 0) {
+          serve(client);
+          close(client);
+        }
+      }
+    }
+
+    for (int i = 0; i < count; ++i) close(fds[i].fd);
+  }
+
+ private:
+  mutex lock;
+  MetricsSnapshot latest;
+  MetricsSnapshot snapshot;
+  unique_ptr<char[]> buffer;
+  size_t length = 0;
+  double last_render_us = 0;
+  uint64_t scrapes = 0;
+
+  static constexpr int CLIENT_TIMEOUT_MS = 200;
+
+  static int listen_unix(const string &path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        listen(fd, 4) != 0) {
+      ALOGE("Failed to listen on %s: %s", path.c_str(), strerror(errno));
+      close(fd);
+      return -1;
+    }
+    chmod(path.c_str(), 0660);
+    ALOGI("Metrics endpoint listening on unix:%s", path.c_str());
+    return fd;
+  }
+
+  static int listen_tcp(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        listen(fd, 4) != 0) {
+      ALOGE("Failed to listen on 127.0.0.1:%d: %s", port, strerror(errno));
+      close(fd);
+      return -1;
+    }
+    ALOGI("Metrics endpoint listening on 127.0.0.1:%d", port);
+    return fd;
+  }
+
+  /**
+   * Clients are served one at a time on this thread. A client that is slow
+   * to send its request or to read the reply holds the next one back for at
+   * most CLIENT_TIMEOUT_MS each way, then it is dropped.
+   */
+  void serve(int client) {
+    // The request itself doesn't matter, every path returns the metrics
+    pollfd pfd{client, POLLIN, 0};
+    if (poll(&pfd, 1, CLIENT_TIMEOUT_MS) <= 0) return;
+    char request[1024];
+    if (recv(client, request, sizeof(request), MSG_DONTWAIT) <= 0) return;
+    timeval timeout{0, CLIENT_TIMEOUT_MS * 1000};
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    auto start = steady_clock::now();
+    {
+      lock_guard<mutex> guard(lock);
+      snapshot = latest;
+    }
+    render();
+    last_render_us =
+        duration<double, micro>(steady_clock::now() - start).count();
+    scrapes++;
+
+    char header[192];
+    int header_len = snprintf(
+        header, sizeof(header),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/openmetrics-text; version=1.0.0; "
+        "charset=utf-8\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n\r\n",
+        length);
+    iovec iov[] = {{header, static_cast<size_t>(header_len)},
+                   {buffer.get(), length}};
+    msghdr message{};
+    message.msg_iov = iov;
+    message.msg_iovlen = 2;
+    // A scraper that hung up gets EPIPE, not a SIGPIPE for the daemon
+    sendmsg(client, &message, MSG_NOSIGNAL);
+  }
+
+  __attribute__((format(printf, 2, 3))) void append(const char *format, ...) {
+    if (length >= METRICS_BUFFER_SIZE) return;
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer.get() + length, METRICS_BUFFER_SIZE - length,
+                        format, args);
+    va_end(args);
+    if (len > 0) length = min(length + len, METRICS_BUFFER_SIZE);
+  }
+
+  void family(const char *name, const char *type, const char *help) {
+    append("# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+  }
+
+  void render() {
+    static const char *const levels[] = {"some", "full"};
+    static const char *const avg_windows[] = {"10", "60", "300"};
+    const MetricsSnapshot &s = snapshot;
+    length = 0;
+
+    family("fmiop_psi_pressure_ratio", "gauge",
+           "Share of time stalled over the window");
+    if (s.psi.valid) {
+      for (int r = 0; r < 3; ++r) {
+        for (int l = 0; l < 2; ++l) {
+          if (l == 1 && !s.psi.has_full[r]) continue;
+          for (int w = 0; w < 3; ++w) {
+            append(
+                "fmiop_psi_pressure_ratio{resource=\"%s\",level=\"%s\","
+                "window=\"%ss\"} %.4f\n",
+                PsiSample::resources[r], levels[l], avg_windows[w],
+                s.psi.avg[r][l][w] / 100);
+          }
+          for (int w = 0; w < s.window_count; ++w) {
+            append(
+                "fmiop_psi_pressure_ratio{resource=\"%s\",level=\"%s\","
+                "window=\"%gs\"} %.4f\n",
+                PsiSample::resources[r], levels[l], s.window_us[w] / 1e6,
+                s.psi.window_values[w][r][l] / 100);
+          }
+        }
+      }
+    }
+
+    family("fmiop_psi_stall_seconds", "counter", "Total time stalled");
+    if (s.psi.valid) {
+      for (int r = 0; r < 3; ++r) {
+        for (int l = 0; l < 2; ++l) {
+          if (l == 1 && !s.psi.has_full[r]) continue;
+          append(
+              "fmiop_psi_stall_seconds_total{resource=\"%s\",level=\"%s\"} "
+              "%.6f\n",
+              PsiSample::resources[r], levels[l], s.psi.total[r][l] / 1e6);
+        }
+      }
+    }
+
+    family("fmiop_swappiness", "gauge", "Current vm.swappiness");
+    append("fmiop_swappiness %d\n", s.swappiness);
+
+    family("fmiop_swap_size_bytes", "gauge", "Size of active swap devices");
+    for (int i = 0; i < s.device_count; ++i) {
+      append("fmiop_swap_size_bytes{device=\"%s\",tier=\"%s\"} %lld\n",
+             s.devices[i].path, tier_name(s.devices[i].tier),
+             static_cast<long long>(s.devices[i].size_kb) << 10);
+    }
+    family("fmiop_swap_used_bytes", "gauge", "Used space of active swaps");
+    for (int i = 0; i < s.device_count; ++i) {
+      append("fmiop_swap_used_bytes{device=\"%s\",tier=\"%s\"} %lld\n",
+             s.devices[i].path, tier_name(s.devices[i].tier),
+             static_cast<long long>(s.devices[i].used_kb) << 10);
+    }
+    family("fmiop_swap_priority", "gauge", "Priority of active swaps");
+    for (int i = 0; i < s.device_count; ++i) {
+      append("fmiop_swap_priority{device=\"%s\",tier=\"%s\"} %d\n",
+             s.devices[i].path, tier_name(s.devices[i].tier),
+             s.devices[i].priority);
+    }
+
+    render_zram();
+    render_swap_counters();
+    render_profile_counters();
+    render_control_counters();
+    render_pipeline();
+
+    family("fmiop_kernel_capability", "gauge",
+           "Kernel features found at startup, 1 when present");
+    for (size_t i = 0; i < size(KernelCapabilities::names); ++i) {
+      append("fmiop_kernel_capability{name=\"%s\"} %d\n",
+             KernelCapabilities::names[i],
+             kernel_caps.has(static_cast<Capability>(i)));
+    }
+
+    family("fmiop_ticks", "counter", "Control loop ticks");
+    append("fmiop_ticks_total %llu\n",
+           static_cast<unsigned long long>(s.ticks));
+    family("fmiop_scrapes", "counter", "Metrics scrapes served");
+    append("fmiop_scrapes_total %llu\n",
+           static_cast<unsigned long long>(scrapes));
+    family("fmiop_last_render_seconds", "gauge",
+           "Time it took to render the previous scrape");
+    append("fmiop_last_render_seconds %.9f\n", last_render_us / 1e6);
+    append("# EOF\n");
+  }
+
+  void render_zram() {
+    static const char *const fields[] = {
+        "orig_data_bytes", "compr_data_bytes", "mem_used_total_bytes",
+        "mem_limit_bytes", "mem_used_max_bytes", "same_pages",
+        "pages_compacted", "huge_pages"};
+    constexpr int field_count = sizeof(fields) / sizeof(fields[0]);
+    static_assert(field_count == MM_STAT_FIELDS, "one name per mm_stat field");
+
+    // Read every device once, then emit one family per field
+    long long values[METRICS_MAX_DEVICES][field_count];
+    int numbers[METRICS_MAX_DEVICES];
+    int devices = 0;
+
+    DIR *dir = opendir(ZRAM_SYSFS_DIR.c_str());
+    while (dir && devices < METRICS_MAX_DEVICES) {
+      dirent *entry = readdir(dir);
+      if (!entry) break;
+      if (strncmp(entry->d_name, "zram", 4) != 0) continue;
+
+      char path[PATH_MAX], stat[256];
+      snprintf(path, sizeof(path), "%s/%.16s/mm_stat", ZRAM_SYSFS_DIR.c_str(),
+               entry->d_name);
+      int fd = open(path, O_RDONLY | O_CLOEXEC);
+      if (fd < 0) continue;
+      ssize_t len = read(fd, stat, sizeof(stat) - 1);
+      close(fd);
+      if (len <= 0) continue;
+      stat[len] = '\0';
+
+      if (!parse_mm_stat(stat, values[devices])) continue;
+      numbers[devices++] = atoi(entry->d_name + 4);
+    }
+    if (dir) closedir(dir);
+
+    char name[64];
+    for (int f = 0; f < field_count; ++f) {
+      snprintf(name, sizeof(name), "fmiop_zram_%s", fields[f]);
+      family(name, "gauge", "zram mm_stat field");
+      for (int d = 0; d < devices; ++d) {
+        if (values[d][f] < 0) continue;
+        append("%s{device=\"zram%d\"} %lld\n", name, numbers[d], values[d][f]);
+      }
+    }
+  }
+
+  void render_pipeline() {
+    const pair<const char *, const PipelineStats::Stage *> stages[] = {
+        {"sample", &pipeline_stats.sample},
+        {"decide", &pipeline_stats.decide},
+        {"actuate", &pipeline_stats.actuate},
+        {"power", &pipeline_stats.power}};
+
+    family("fmiop_stage_runs", "counter", "Control loop stage runs");
+    for (const auto &[name, stage] : stages) {
+      append("fmiop_stage_runs_total{stage=\"%s\"} %llu\n", name,
+             static_cast<unsigned long long>(
+                 stage->runs.load(memory_order_relaxed)));
+    }
+    family("fmiop_stage_seconds", "counter", "Time spent in each stage");
+    for (const auto &[name, stage] : stages) {
+      append("fmiop_stage_seconds_total{stage=\"%s\"} %.6f\n", name,
+             stage->total_us.load(memory_order_relaxed) / 1e6);
+    }
+    family("fmiop_stage_max_seconds", "gauge", "Slowest run of each stage");
+    for (const auto &[name, stage] : stages) {
+      append("fmiop_stage_max_seconds{stage=\"%s\"} %.6f\n", name,
+             stage->max_us.load(memory_order_relaxed) / 1e6);
+    }
+
+    family("fmiop_actuation_queue_depth", "gauge",
+           "Actions waiting for the actuator");
+    append("fmiop_actuation_queue_depth %u\n",
+           pipeline_stats.queue_depth.load(memory_order_relaxed));
+    family("fmiop_actuation_queue_max_depth", "gauge",
+           "Most actions ever waiting for the actuator");
+    append("fmiop_actuation_queue_max_depth %u\n",
+           pipeline_stats.max_queue_depth.load(memory_order_relaxed));
+    family("fmiop_actuation_coalesced", "counter",
+           "Queued actions replaced by a newer one");
+    append("fmiop_actuation_coalesced_total %llu\n",
+           static_cast<unsigned long long>(
+               pipeline_stats.coalesced.load(memory_order_relaxed)));
+  }
+
+  void render_control_counters() {
+    family("fmiop_slo_violation_seconds", "counter",
+           "Time MemAvailable was under the SLO floor or memory PSI over "
+           "the ceiling");
+    append("fmiop_slo_violation_seconds_total{kind=\"available\"} %.3f\n",
+           control_stats.available_violation_us.load(memory_order_relaxed) /
+               1e6);
+    append("fmiop_slo_violation_seconds_total{kind=\"psi\"} %.3f\n",
+           control_stats.psi_violation_us.load(memory_order_relaxed) / 1e6);
+    family("fmiop_swappiness_change", "counter",
+           "Sum of swappiness changes, in swappiness points");
+    append("fmiop_swappiness_change_total %llu\n",
+           static_cast<unsigned long long>(
+               control_stats.swappiness_change.load(memory_order_relaxed)));
+    family("fmiop_reclaimed_pages", "counter",
+           "Pages paged out by proactive reclaim");
+    append("fmiop_reclaimed_pages_total %llu\n",
+           static_cast<unsigned long long>(
+               control_stats.reclaimed_pages.load(memory_order_relaxed)));
+    family("fmiop_pressure_wakeups", "counter",
+           "Ticks started early by the memory PSI trigger");
+    append("fmiop_pressure_wakeups_total %llu\n",
+           static_cast<unsigned long long>(
+               control_stats.pressure_wakeups.load(memory_order_relaxed)));
+
+    int effort = control_stats.effort_permille.load(memory_order_relaxed);
+    family("fmiop_slo_effort", "gauge",
+           "SLO controller output between 0 and 1");
+    if (effort >= 0) append("fmiop_slo_effort %.3f\n", effort / 1000.0);
+  }
+
+  void render_profile_counters() {
+    family("fmiop_profile_switches", "counter", "App profile switches");
+    append("fmiop_profile_switches_total %llu\n",
+           static_cast<unsigned long long>(
+               profile_stats.switches.load(memory_order_relaxed)));
+    family("fmiop_profile_switch_latency_seconds", "counter",
+           "Time from a foreground change to its swappiness being applied");
+    append("fmiop_profile_switch_latency_seconds_total %.6f\n",
+           profile_stats.latency_us.load(memory_order_relaxed) / 1e6);
+    family("fmiop_profile_switch_latency_max_seconds", "gauge",
+           "Slowest profile switch");
+    append("fmiop_profile_switch_latency_max_seconds %.6f\n",
+           profile_stats.max_latency_us.load(memory_order_relaxed) / 1e6);
+  }
+
+  void render_swap_counters() {
+    const struct {
+      const char *op;
+      const SwapStats::Counter *counters;
+    } ops[] = {{"swapon", swap_stats.swapon}, {"swapoff", swap_stats.swapoff}};
+
+    for (const auto &op : ops) {
+      char name[64];
+      snprintf(name, sizeof(name), "fmiop_%s", op.op);
+      family(name, "counter", "Swap operations by tier");
+      for (int t = 0; t < SWAP_TIER_COUNT; ++t) {
+        append("%s_total{tier=\"%s\"} %llu\n", name,
+               tier_name(static_cast<SwapTier>(t)),
+               static_cast<unsigned long long>(
+                   op.counters[t].count.load(memory_order_relaxed)));
+      }
+
+      snprintf(name, sizeof(name), "fmiop_%s_failures", op.op);
+      family(name, "counter", "Failed swap operations by tier");
+      for (int t = 0; t < SWAP_TIER_COUNT; ++t) {
+        append("%s_total{tier=\"%s\"} %llu\n", name,
+               tier_name(static_cast<SwapTier>(t)),
+               static_cast<unsigned long long>(
+                   op.counters[t].failures.load(memory_order_relaxed)));
+      }
+
+      snprintf(name, sizeof(name), "fmiop_%s_duration_seconds", op.op);
+      family(name, "counter", "Time spent in swap operations by tier");
+      for (int t = 0; t < SWAP_TIER_COUNT; ++t) {
+        append("%s_total{tier=\"%s\"} %.6f\n", name,
+               tier_name(static_cast<SwapTier>(t)),
+               op.counters[t].duration_us.load(memory_order_relaxed) / 1e6);
+      }
+    }
+  }
+};
+
+MetricsServer metrics_server;
+
+/**
+ * Metrics endpoint service.
+ */
+void metrics_service(const MetricsConfig &config) {
+  if (!config.enable) return;
+
+  sched_control.place_control_thread();
+  metrics_server.run(config);
+}
+
+struct StateConfig {
+  bool enable = true;
+  int save_interval = 300;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(enable, save_interval);
+  }
+
+  void load_from_yaml(const YAML::Node &config) {
+    auto node = config["state"];
+    if (!node || !node.IsMap()) {
+      ALOGW("state section not found in config.");
+      return;
+    }
+    enable = node["enable"].as<bool>(enable);
+    save_interval = max(node["save_interval"].as<int>(save_interval), 10);
+    ALOGD("state enable: %d, save_interval: %d", enable, save_interval);
+  }
+};
+
+/**
+ * Keeps statistics learned across daemon restarts in a small checksummed
+ * binary file, so the first decisions after boot start from what this device
+ * did in previous sessions instead of defaults.
+ */
+class LearnedStateStore {
+ public:
+  LearnedStateStore(const StateConfig &config, string path)
+      : config(config), path(std::move(path)) {
+    memset(&state, 0, sizeof(state));
+    state.last_swappiness = -1;
+  }
+
+  /**
+   * Maps the state file and validates it, a bad or old file is ignored.
+   *
+   * @return True if a valid state was loaded.
+   */
+  bool load() {
+    if (!config.enable) return false;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      ALOGI("No learned state at %s, starting cold.", path.c_str());
+      return false;
+    }
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && st.st_size == sizeof(LearnedState);
+    void *map = ok ? mmap(nullptr, sizeof(LearnedState), PROT_READ,
+                          MAP_PRIVATE, fd, 0)
+                   : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+      ALOGW("Learned state %s has unexpected size, ignored.", path.c_str());
+      return false;
+    }
+
+    LearnedState loaded;
+    memcpy(&loaded, map, sizeof(loaded));
+    munmap(map, sizeof(LearnedState));
+
+    uint32_t checksum = loaded.checksum;
+    loaded.checksum = 0;
+    if (loaded.magic != LEARNED_STATE_MAGIC ||
+        loaded.version != LEARNED_STATE_VERSION ||
+        loaded.size != sizeof(LearnedState) ||
+        crc32(&loaded, sizeof(loaded)) != checksum) {
+      ALOGW("Learned state %s is invalid or from another version, ignored.",
+            path.c_str());
+      return false;
+    }
+
+    state = loaded;
+    warm = true;
+
+    int hour = local_hour();
+    if (state.hourly_samples[hour] > 0) {
+      ALOGI("Pressure baseline for hour %d: CPU=%.2f, MEM=%.2f, IO=%.2f", hour,
+            hourly_baseline(hour, PsiResource::CPU),
+            hourly_baseline(hour, PsiResource::MEMORY),
+            hourly_baseline(hour, PsiResource::IO));
+    }
+    ALOGI(
+        "Learned state loaded: session %u, last swappiness %d, %d active "
+        "swaps, previous time to first decision %u ms",
+        state.sessions, state.last_swappiness, state.active_swaps,
+        state.first_decision_ms);
+    return true;
+  }
+
+  /**
+   * Writes the state to a temp file and renames it over the old one.
+   */
+  bool save() {
+    if (!config.enable) return false;
+
+    state.magic = LEARNED_STATE_MAGIC;
+    state.version = LEARNED_STATE_VERSION;
+    state.size = sizeof(LearnedState);
+    state.saved_at = time(nullptr);
+    state.checksum = 0;
+    state.checksum = crc32(&state, sizeof(state));
+
+    string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0600);
+    if (fd < 0) {
+      ALOGE("Error: Unable to open %s for writing.", tmp_path.c_str());
+      return false;
+    }
+    bool ok = ::write(fd, &state, sizeof(state)) == sizeof(state) &&
+              fsync(fd) == 0;
+    close(fd);
+
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+      ALOGE("Error: Saving learned state to %s failed: %s", path.c_str(),
+            strerror(errno));
+      unlink(tmp_path.c_str());
+      return false;
+    }
+    last_save = steady_clock::now();
+    return true;
+  }
+
+  void start_session() {
+    state.sessions++;
+    last_save = steady_clock::now();
+  }
+
+  /**
+   * Folds one tick of observations into the learned statistics and saves
+   * when the save interval elapsed.
+   */
+  void update(const PsiSample &psi, const vector<SwapDevice> &active) {
+    if (!config.enable) return;
+
+    if (psi.valid) {
+      int hour = local_hour();
+      uint32_t n = min<uint32_t>(++state.hourly_samples[hour], 10000);
+      for (int r = 0; r < 3; ++r) {
+        float &mean = state.hourly_pressure[hour][r];
+        mean += (psi.avg[r][0][1] - mean) / n;
+      }
+    }
+
+    update_fill_rates(active);
+    state.active_swaps = active.size();
+
+    if (steady_clock::now() - last_save >= seconds(config.save_interval)) {
+      save();
+    }
+  }
+
+  /**
+   * Records a policy decision; the first one of the session also records the
+   * time to first decision measured from process start.
+   */
+  void record_decision(int swappiness) {
+    if (swappiness >= 0) state.last_swappiness = swappiness;
+    if (first_decision_logged) return;
+
+    first_decision_logged = true;
+    state.first_decision_ms = ms_since_start();
+    ALOGI("Time to first decision: %u ms (%s start)", state.first_decision_ms,
+          warm ? "warm" : "cold");
+  }
+
+  bool is_warm() const { return warm; }
+
+  const LearnedState &snapshot() const { return state; }
+
+  // Takes over the state a crashed worker handed over, newer than the file
+  void adopt(const LearnedState &handed) {
+    if (!config.enable) return;
+    state = handed;
+    warm = true;
+  }
+
+  int last_swappiness() const { return warm ? state.last_swappiness : -1; }
+  int active_swaps() const { return warm ? state.active_swaps : 0; }
+
+  /**
+   * Learned fill rate of a tier in MB per minute, 0 if unknown.
+   */
+  float fill_rate(SwapTier tier) const {
+    return state.swap_fill_rate[static_cast<int>(tier)];
+  }
+
+  /**
+   * Mean PSI some avg60 seen at this hour in previous sessions.
+   */
+  float hourly_baseline(int hour, PsiResource resource) const {
+    return state.hourly_pressure[hour][static_cast<int>(resource)];
+  }
+
+  /**
+   * The current hour's baseline as a sample every window and level reads
+   * from, so a policy can decide before the first real PSI sample. Invalid
+   * when the hour was never seen.
+   */
+  PsiSample baseline_sample() const {
+    PsiSample sample{};
+    int hour = local_hour();
+    if (!warm || state.hourly_samples[hour] == 0) return sample;
+
+    for (int r = 0; r < 3; ++r) {
+      double mean = state.hourly_pressure[hour][r];
+      sample.has_full[r] = true;
+      for (int level = 0; level < 2; ++level) {
+        for (double &avg : sample.avg[r][level]) avg = mean;
+        for (auto &window : sample.window_values) window[r][level] = mean;
+      }
+    }
+    sample.valid = true;
+    return sample;
+  }
+
+ private:
+  const StateConfig &config;
+  string path;
+  LearnedState state;
+  bool warm = false;
+  bool first_decision_logged = false;
+  steady_clock::time_point last_save;
+  steady_clock::time_point last_fill_sample;
+  array<long, SWAP_TIER_COUNT> last_used_kb{};
+  array<bool, SWAP_TIER_COUNT> last_active{};
+
+  static int local_hour() {
+    time_t now = time(nullptr);
+    tm local;
+    localtime_r(&now, &local);
+    return local.tm_hour;
+  }
+
+  /**
+   * Every minute a tier stays active is a sample, so the rate decays while
+   * the tier holds steady or drains. Draining counts as 0, the rate only
+   * predicts filling.
+   */
+  void update_fill_rates(const vector<SwapDevice> &active) {
+    auto now = steady_clock::now();
+    if (now - last_fill_sample < minutes(1)) return;
+
+    array<long, SWAP_TIER_COUNT> used_kb{};
+    array<bool, SWAP_TIER_COUNT> tier_active{};
+    for (const auto &device : active) {
+      used_kb[static_cast<int>(device.tier)] += device.used_kb;
+      tier_active[static_cast<int>(device.tier)] = true;
+    }
+
+    if (last_fill_sample != steady_clock::time_point()) {
+      double elapsed_min = duration<double, ratio<60>>(now - last_fill_sample)
+                               .count();
+      for (int i = 0; i < SWAP_TIER_COUNT; ++i) {
+        if (!tier_active[i] || !last_active[i]) continue;
+        double rate =
+            max((used_kb[i] - last_used_kb[i]) / 1024.0 / elapsed_min, 0.0);
+        float &learned = state.swap_fill_rate[i];
+        learned += 0.1 * (rate - learned);
+      }
+    }
+    last_used_kb = used_kb;
+    last_active = tier_active;
+    last_fill_sample = now;
   }
 };
 
-bool psi_available() {
-  ifstream cpu_file("/proc/pressure/cpu");
-  ifstream mem_file("/proc/pressure/memory");
-  ifstream io_file("/proc/pressure/io");
+constexpr uint32_t HANDOFF_MAGIC = 0x48444D46;  // "FMDH"
+constexpr int HANDOFF_MAX_DEVICES = 32;
+constexpr int HANDOFF_PATH_MAX = 96;
+
+/**
+ * Policy state shared between the supervisor and its worker. The worker
+ * keeps it current every tick and the supervisor keeps the mapping alive,
+ * so a worker restarted after a crash resumes with the swappiness, swap
+ * devices and learned state of the one that died.
+ */
+struct HandoffState {
+  uint32_t magic;
+  atomic<uint32_t> sequence;  // Odd while the worker is writing
+  uint32_t restarts;          // Written by the supervisor
+  int32_t swappiness;
+  bool devices_valid;  // False when the device list didn't fit
+  bool has_learned;
+  uint16_t device_count;
+  char devices[HANDOFF_MAX_DEVICES][HANDOFF_PATH_MAX];
+  LearnedState learned;
+};
+
+class Handoff {
+ public:
+  /**
+   * Maps the shared region; called by the supervisor before the first
+   * worker is forked, which inherits it.
+   */
+  bool create() {
+    void *map = mmap(nullptr, sizeof(HandoffState), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+      ALOGE("Cannot map handoff state: %s", strerror(errno));
+      return false;
+    }
+    region = static_cast<HandoffState *>(map);
+    return true;
+  }
 
-  if (cpu_file.good() && mem_file.good() && io_file.good()) {
+  void count_restart() {
+    if (region) region->restarts++;
+  }
+
+  /**
+   * State left by the previous worker. Nothing is restored on the first
+   * start, or when the worker died halfway through publishing.
+   */
+  bool restore(LearnedStateStore &learned, int &swappiness,
+               vector<string> &devices) {
+    if (!region || region->magic != HANDOFF_MAGIC) return false;
+    if (region->sequence.load(memory_order_acquire) & 1) {
+      ALOGW("Handoff state torn by the crash, starting over.");
+      return false;
+    }
+
+    swappiness = region->swappiness;
+    if (region->devices_valid) {
+      for (int i = 0; i < region->device_count; ++i) {
+        devices.emplace_back(region->devices[i]);
+      }
+    }
+    if (region->has_learned) learned.adopt(region->learned);
+    ALOGI("Resumed after restart %u: swappiness %d, %zu swap devices known",
+          region->restarts, swappiness, devices.size());
     return true;
+  }
+
+  /**
+   * Publishes the current policy state, once per tick. The device list is
+   * only copied again when the swap model changed.
+   */
+  void publish(int swappiness, const LearnedStateStore &learned,
+               bool learned_enabled) {
+    if (!region) return;
+    uint32_t version = swap_model.version();
+    bool devices_changed =
+        region->magic != HANDOFF_MAGIC || version != published_version;
+    vector<string> paths;
+    if (devices_changed) paths = swap_model.known_devices();
+
+    // Parity is set, not toggled: a worker that died between the two
+    // stores left an odd sequence behind
+    uint32_t writing = region->sequence.load(memory_order_relaxed) | 1;
+    region->sequence.store(writing, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    region->swappiness = swappiness;
+    if (devices_changed) {
+      region->devices_valid = paths.size() <= HANDOFF_MAX_DEVICES;
+      region->device_count = 0;
+      for (const auto &path : paths) {
+        if (!region->devices_valid) break;
+        if (path.size() >= HANDOFF_PATH_MAX) {
+          region->devices_valid = false;
+          break;
+        }
+        memcpy(region->devices[region->device_count++], path.c_str(),
+               path.size() + 1);
+      }
+      published_version = version;
+    }
+    region->has_learned = learned_enabled;
+    if (learned_enabled) region->learned = learned.snapshot();
+    region->magic = HANDOFF_MAGIC;
+    region->sequence.store(writing + 1, memory_order_release);
+  }
+
+ private:
+  HandoffState *region = nullptr;
+  uint32_t published_version = 0;
+};
+
+Handoff handoff;
+
+struct LogCaptureConfig {
+  bool enable = true;
+  int segment_kb = 4096;
+  int max_segments = 5;
+  int plain_log_kb = 10240;
+  int archive_interval = 300;
+  int max_archives = 20;
+  int flush_interval = 5;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(enable, segment_kb, max_segments, plain_log_kb, archive_interval,
+            max_archives, flush_interval);
+  }
+
+  void load_from_yaml(const YAML::Node &config) {
+    auto node = config["logging"];
+    if (!node || !node.IsMap()) {
+      ALOGW("logging section not found in config.");
+      return;
+    }
+    enable = node["enable"].as<bool>(enable);
+    segment_kb = max(node["segment_kb"].as<int>(segment_kb), 64);
+    max_segments = max(node["max_segments"].as<int>(max_segments), 1);
+    plain_log_kb = max(node["plain_log_kb"].as<int>(plain_log_kb), 64);
+    archive_interval =
+        max(node["archive_interval"].as<int>(archive_interval), 10);
+    max_archives = max(node["max_archives"].as<int>(max_archives), 1);
+    flush_interval = max(node["flush_interval"].as<int>(flush_interval), 1);
+    ALOGD(
+        "logging enable: %d, segment_kb: %d, max_segments: %d, "
+        "plain_log_kb: %d, archive_interval: %d, max_archives: %d",
+        enable, segment_kb, max_segments, plain_log_kb, archive_interval,
+        max_archives);
+  }
+};
+
+/**
+ * Every section of config.yaml, loaded once per worker by load_config()
+ * and handed to the services.
+ */
+struct DaemonConfig {
+  Config general;
+  SchedulingConfig scheduling;
+  bool dynv_enable = true;
+  DynamicSwappinessConfig swappiness;
+  ProfilesConfig profiles;
+  SloConfig slo;
+  ReclaimConfig reclaim;
+  ZramResizeConfig zram_resize;
+  ZramAlgorithmConfig zram_algorithm;
+  DamonConfig damon;
+  WorkingSetConfig working_set;
+  VmKnobsConfig vm_knobs;
+  SwapTierConfig swap_tiers;
+  StateConfig state;
+  JournalConfig journal;
+  MetricsConfig metrics;
+  LogCaptureConfig logging;
+
+  template <class Archive>
+  void fields(Archive &archive) {
+    archive(general, scheduling, dynv_enable, swappiness, profiles, slo,
+            reclaim, zram_resize, zram_algorithm, damon, working_set,
+            vm_knobs, swap_tiers, state, journal, metrics, logging);
+  }
+
+  void load_from_yaml(const YAML::Node &root) {
+    general.load_from_yaml(root);
+    scheduling.load_from_yaml(root);
+    dynv_enable = read_config(root, ".dynamic_swappiness.enable", true);
+    swappiness.load_from_yaml(root);
+    profiles.load_from_yaml(root, swappiness);
+    slo.load_from_yaml(root);
+    reclaim.load_from_yaml(root);
+    zram_resize.load_from_yaml(root);
+    zram_algorithm.load_from_yaml(root);
+    damon.load_from_yaml(root);
+    working_set.load_from_yaml(root);
+    vm_knobs.load_from_yaml(root);
+    swap_tiers.load_from_yaml(general, root);
+    state.load_from_yaml(root);
+    journal.load_from_yaml(root);
+    metrics.load_from_yaml(root);
+    logging.load_from_yaml(root);
+  }
+};
+
+/**
+ * Loads config.yaml, from the compiled cache when it's current. Only then
+ * is the YAML parsed and the node tree built; the sections are written
+ * back to the cache, so only the first start after a config change or an
+ * update pays for the YAML parser.
+ */
+DaemonConfig load_config() {
+  auto start = steady_clock::now();
+  DaemonConfig config;
+  if (read_config_cache(DEFAULT_CONFIG, CONFIG_CACHE, config)) {
+    ALOGD("Config loaded from %s in %.2f ms", CONFIG_CACHE.c_str(),
+          duration<double, milli>(steady_clock::now() - start).count());
+    return config;
+  }
+
+  YAML::Node root;
+  try {
+    root = YAML::LoadFile(DEFAULT_CONFIG);
+  } catch (const std::exception &e) {
+    ALOGE("Failed to load config file: %s", e.what());
+    config.load_from_yaml(root);
+    return config;
+  }
+  config.load_from_yaml(root);
+  ALOGI("Config parsed from %s in %.2f ms", DEFAULT_CONFIG.c_str(),
+        duration<double, milli>(steady_clock::now() - start).count());
+  if (!write_config_cache(config, DEFAULT_CONFIG, CONFIG_CACHE)) {
+    ALOGW("Cannot write config cache %s: %s", CONFIG_CACHE.c_str(),
+          strerror(errno));
+  }
+  return config;
+}
+
+/**
+ * Dynamic swappiness adjustment service.
+ */
+void dyn_swap_service(const DaemonConfig &daemonConfig) {
+  sched_control.place_control_thread();
+  power_state.start();
+  actuator.start();
+  const Config &config = daemonConfig.general;
+  float CONFIG_VERSION = config.config_version;
+  int SWAPPINESS_MAX = config.swappiness_max;
+  int SWAPPINESS_MIN = config.swappiness_min;
+  int SWAP_DEACTIVATION_TIME = config.swap_deactivation_time;
+  bool DEACTIVATE_IN_SLEEP = config.deactivate_in_sleep;
+  string THRESHOLD_TYPE = config.threshold_type;
+
+  SwappinessManager swappinessManager(daemonConfig.swappiness);
+  ForegroundWatcher foreground(daemonConfig.profiles);
+  SloController slo(daemonConfig.slo, THRESHOLD_TYPE == "slo");
+  ReclaimEngine reclaimEngine(daemonConfig.reclaim);
+  ZramResizer zramResizer(daemonConfig.zram_resize,
+                          daemonConfig.zram_algorithm);
+  DamonMonitor damonMonitor(daemonConfig.damon);
+  WorkingSetEstimator workingSet(daemonConfig.working_set);
+  VmKnobController vmKnobController(daemonConfig.vm_knobs);
+  PressureTrigger pressureTrigger(config.psi_trigger_ms);
+  PsiSample psi;
+
+  swap_model.configure(daemonConfig.swap_tiers.policies,
+                       daemonConfig.swap_tiers.backing_devices);
+  vector<thread> swapoff_thread;
+  LearnedStateStore learnedState(daemonConfig.state, STATE_FILE);
+  learnedState.load();
+
+  // After a crash the supervisor hands over what the last worker knew
+  int handed_swappiness = -1;
+  vector<string> handed_devices;
+  bool handed_over =
+      handoff.restore(learnedState, handed_swappiness, handed_devices);
+  if (!handed_devices.empty()) {
+    swap_model.rebuild(handed_devices);
   } else {
-    ALOGW_ONCE("psi_unavailable",
-               "PSI metrics unavailable. Falling back to mem_pressure.");
-    return false;
+    swap_model.discover();
+  }
+  learnedState.start_session();
+  if (daemonConfig.journal.enable) {
+    journal.open_file(JOURNAL_FILE, daemonConfig.journal.size_kb);
+    journal.append(JournalType::START, 0, getpid(),
+                   static_cast<int32_t>(lround(CONFIG_VERSION * 100)));
+  }
+  long tick_count = 0;
+  MemoryPressureReader memoryPressure;
+  StatusPublisher statusPublisher;
+
+  // swapon runs on the actuator, the device shows up as active once done
+  auto activate = [&](const SwapDevice &device) {
+    string key = "swapon " + device.path;
+    if (actuator.pending(key)) return;
+
+    int priority = swap_model.priority_for(device.tier);
+    learnedState.record_decision(-1);
+    actuator.submit(key, [device, priority] {
+      auto start = steady_clock::now();
+      bool ok = sched_control.as_urgent(
+          [&] { return swapon(device.path, priority); });
+      swap_stats.swapon[static_cast<int>(device.tier)].record(ok, start);
+      if (ok) {
+        journal.append(JournalType::SWAPON, 0, static_cast<int>(device.tier),
+                       device.number, priority);
+        swap_model.mark_active(device, priority);
+      } else {
+        journal.append(JournalType::SWAPON, JOURNAL_FAILED,
+                       static_cast<int>(device.tier), device.number, priority);
+        swap_model.discover();
+      }
+    });
+  };
+
+  int new_swappiness = SWAPPINESS_MAX;
+  int wait_timeout = SWAP_DEACTIVATION_TIME;
+  bool unbounded = true;
+  bool is_condition_met;
+  bool dynv_enabled = daemonConfig.dynv_enable;
+  if (handed_over && handed_swappiness >= 0) {
+    new_swappiness = handed_swappiness;
+    swappinessManager.resume(handed_swappiness);
+  }
+  if (!dynv_enabled) {
+    swappinessManager.apply_swappiness(SWAPPINESS_MAX);
+  }
+  is_swapoff_session = (!DEACTIVATE_IN_SLEEP) ? true : false;
+
+  // Warm start: resume the last session's policy before the first tick. A
+  // PSI policy starts from what this hour usually looks like, the last
+  // swappiness only covers hours never seen before. A handed over worker
+  // keeps the swappiness its predecessor last decided
+  if (learnedState.is_warm()) {
+    PsiSample baseline = learnedState.baseline_sample();
+    if (dynv_enabled && !handed_over && baseline.valid &&
+        swappinessManager.reads_psi()) {
+      new_swappiness =
+          swappinessManager.get_swappiness(baseline, memoryPressure.read());
+      swappinessManager.apply_swappiness(new_swappiness);
+      learnedState.record_decision(new_swappiness);
+    } else if (dynv_enabled && learnedState.last_swappiness() >= 0) {
+      new_swappiness = clamp(learnedState.last_swappiness(), SWAPPINESS_MIN,
+                             SWAPPINESS_MAX);
+      swappinessManager.apply_swappiness(new_swappiness);
+      learnedState.record_decision(new_swappiness);
+    }
+    while (static_cast<int>(swap_model.active_count()) <
+           learnedState.active_swaps()) {
+      auto next = swap_model.next_inactive();
+      if (!next) break;
+      size_t before = swap_model.active_count();
+      activate(*next);
+      actuator.flush();
+      if (swap_model.active_count() == before) break;
+    }
+  }
+
+  ALOGI("Config version: %.2f", CONFIG_VERSION);
+
+  while (running) {
+    if (!power_state.doze()) {
+      // Sample: everything the decisions below read, stamped once
+      auto sample_start = steady_clock::now();
+      psi = kernel_caps.has(Capability::PSI) ? sample_psi() : PsiSample();
+      int memory_pressure = memoryPressure.read();
+      bool sleeping = power_state.sleeping();
+      pipeline_stats.sample.record(sample_start);
+
+      // Decide: writes and swapon go to the actuator, never block here
+      auto decide_start = steady_clock::now();
+      slo.update(psi, memoryPressure.meminfo());
+      bool profile_switched = foreground.poll_switch();
+      if (profile_switched) {
+        const AppProfile *profile = foreground.profile();
+        swappinessManager.use_config(profile ? profile->swappiness
+                                             : daemonConfig.swappiness);
+      }
+
+      if (dynv_enabled) {
+        new_swappiness =
+            slo.controlling()
+                ? slo.swappiness(swappinessManager.current_config())
+                : swappinessManager.get_swappiness(psi, memory_pressure);
+        swappinessManager.apply_swappiness(new_swappiness);
+        learnedState.record_decision(new_swappiness);
+      } else {
+        ALOGI_ONCE("dynv disabled", "Dynamic Swappiness is disabled.");
+      }
+      if (profile_switched) foreground.record_switch();
+      vmKnobController.apply(psi);
+
+      if (DEACTIVATE_IN_SLEEP) {
+        start_swapoff_timer_if_idle(wait_timeout);
+        if (!sleeping) {
+          is_swapoff_session = false;
+          ALOG_RESET("swapoff_session");
+          ALOG_RESET("swapoff_timer");
+        }
+      }
+
+      if (daemonConfig.reclaim.enable) {
+        double mem_psi = psi.get(PsiResource::MEMORY, "avg10");
+        bool idle = sleeping || (!isnan(mem_psi) &&
+                                 mem_psi < daemonConfig.reclaim.idle_psi);
+        // The SLO controller reclaims only when headroom runs short
+        if (slo.controlling()) idle = slo.wants_reclaim();
+        double stall = reclaimEngine.abort_pressure(psi);
+        actuator.submit("reclaim", [&reclaimEngine, idle, stall] {
+          sched_control.as_worker(
+              [&] { return reclaimEngine.tick(idle, stall); });
+        });
+      }
+      // Sysfs walks, off the control thread like reclaim. The decisions
+      // below read their last results.
+      if (daemonConfig.zram_resize.enable) {
+        actuator.submit("zram_resize", [&zramResizer] {
+          sched_control.as_worker([&] { zramResizer.tick(); });
+        });
+      }
+      if (daemonConfig.damon.enable) {
+        actuator.submit("damon", [&damonMonitor, sleeping] {
+          sched_control.as_worker([&] { damonMonitor.tick(sleeping); });
+        });
+      }
+      if (daemonConfig.working_set.enable) {
+        actuator.submit("working_set", [&workingSet] {
+          sched_control.as_worker([&] { workingSet.tick(); });
+        });
+      }
+
+      // SWAP management logic
+      if (unbounded) {
+        swap_model.refresh_usage();
+        auto frontier = swap_model.frontier();
+        auto next = swap_model.next_inactive();
+
+        // Free swap in MB, without the device that would be drained
+        auto free_swap_mb = [&](const string &without) {
+          long free_kb = 0;
+          for (const auto &device : swap_model.active_devices()) {
+            if (device.path == without) {
+              free_kb -= device.used_kb;
+            } else {
+              free_kb += device.size_kb - device.used_kb;
+            }
+          }
+          return free_kb >> 10;
+        };
+        // zram stays, or is added, while cold memory needs the room
+        auto cold_needs_zram = [&](const SwapDevice &device,
+                                   const string &without) {
+          return device.tier == SwapTier::ZRAM &&
+                 damonMonitor.needs_room(free_swap_mb(without));
+        };
+        // With a working set estimate zram follows it, not the threshold
+        int zram_target = workingSet.zram_devices_needed();
+        int active_zram = 0;
+        for (const auto &device : swap_model.active_devices()) {
+          if (device.tier == SwapTier::ZRAM) ++active_zram;
+        }
+        bool sized_by_working_set =
+            zram_target >= 0 && next && next->tier == SwapTier::ZRAM;
+        auto working_set_keeps = [&](const SwapDevice &device) {
+          return zram_target >= 0 && device.tier == SwapTier::ZRAM &&
+                 active_zram <= zram_target;
+        };
+
+        /*
+          If conditions:
+            1. Usage of the last active swap is more than its tier's
+               activation threshold, or will be within a minute at the fill
+               rate learned for its tier
+            2. Swap is available
+            3. Device is not in sleep mode which probably better for battery
+               with swap usage low so less process running.
+          Then:
+            - Turn on next available swap, fastest tier first
+        */
+        int predicted_usage = -1;
+        if (frontier && frontier->size_kb > 0) {
+          predicted_usage =
+              frontier->used_percentage() +
+              learnedState.fill_rate(frontier->tier) * 1024 * 100 /
+                  frontier->size_kb;
+        }
+
+        if (!frontier) {
+          if (next) activate(*next);
+        } else if (sized_by_working_set && active_zram < zram_target &&
+                   !sleeping) {
+          ALOGI("Activating %s, working set needs %d zram devices",
+                next->path.c_str(), zram_target);
+          activate(*next);
+        } else if (next && slo.wants_swap()) {
+          ALOGI("Activating %s, %ld MB available at full effort",
+                next->path.c_str(), slo.available());
+          activate(*next);
+          slo.swap_added();
+        } else if (!slo.controlling() && !sized_by_working_set &&
+                   predicted_usage >
+                       swap_model.policy(frontier->tier).activation_threshold &&
+                   next && !sleeping) {
+          activate(*next);
+        } else if (next && cold_needs_zram(*next, "")) {
+          ALOGI("Activating %s for %ld MB of cold memory", next->path.c_str(),
+                damonMonitor.cold_mb());
+          activate(*next);
+        } else if (!foreground.profile() || foreground.profile()->swapoff) {
+          // Drain slow tiers first, the device on top takes over its pages
+          vector<SwapDevice> drain = swap_model.drain_order();
+
+          if (drain.size() > 1) {
+            const SwapDevice &victim = drain.front();
+            vector<SwapDevice> active = swap_model.active_devices();
+            SwapDevice receiver = active.front();
+            for (const auto &device : active) {
+              if (device.path != victim.path) receiver = device;
+            }
+            bool receiver_has_room =
+                receiver.used_percentage() <
+                swap_model.policy(receiver.tier).activation_threshold;
+
+            is_condition_met =
+                receiver_has_room &&
+                victim.used_mb() <
+                    swap_model.policy(victim.tier).deactivation_threshold &&
+                is_swapoff_session && !cold_needs_zram(victim, victim.path) &&
+                !working_set_keeps(victim) && slo.can_release(victim.used_mb());
+
+            // If one of condition is met turn off SWAP
+            if (is_condition_met) {
+              ALOGW_ONCE("condition met",
+                         "sleep more than %d seconds. Deactivating swap...",
+                         SWAP_DEACTIVATION_TIME);
+              swapoff_(victim.path, swapoff_thread,
+                       string("Reason: draining ") + tier_name(victim.tier) +
+                           " tier.");
+            } else if (receiver_has_room) {
+              // Never drain the top priority swap for low usage
+              for (size_t i = 0; i + 1 < drain.size(); ++i) {
+                if (drain[i].used_mb() < 10 &&
+                    !cold_needs_zram(drain[i], drain[i].path) &&
+                    !working_set_keeps(drain[i]) &&
+                    slo.can_release(drain[i].used_mb())) {
+                  swapoff_(drain[i].path, swapoff_thread,
+                           "Reason: low swap usage.");
+                }
+              }
+            }
+            ALOG_RESET("swapoff_end");
+          } else {
+            ALOGW_ONCE("swapoff_end", "No second last swap.");
+            ALOG_RESET("condition met");
+          }
+        }
+      }
+      pipeline_stats.decide.record(decide_start);
+      vector<SwapDevice> active = swap_model.active_devices();
+      learnedState.update(psi, active);
+      handoff.publish(swappinessManager.current_swappiness(), learnedState,
+                      daemonConfig.state.enable);
+
+      uint16_t tick_flags = (sleeping ? JOURNAL_SLEEP : 0) |
+                            (is_swapoff_session ? JOURNAL_SWAPOFF_SESSION : 0) |
+                            (psi.valid ? 0 : JOURNAL_PSI_INVALID);
+      journal.append(JournalType::TICK, tick_flags,
+                     journal_pressure(psi.get(PsiResource::CPU, "avg10")),
+                     journal_pressure(psi.get(PsiResource::MEMORY, "avg10")),
+                     journal_pressure(psi.get(PsiResource::IO, "avg10")));
+      long used_kb = 0, size_kb = 0;
+      for (const auto &device : active) {
+        used_kb += device.used_kb;
+        size_kb += device.size_kb;
+      }
+      journal.append(JournalType::SWAP_SUMMARY, 0, active.size(),
+                     used_kb >> 10, size_kb >> 10);
+      statusPublisher.update(memory_pressure,
+                             swappinessManager.current_swappiness(),
+                             !active.empty());
+      metrics_server.publish(psi, swappinessManager.current_swappiness(),
+                             active);
+      if (++tick_count % 60 == 0) journal.flush();
+      if (tick_count % 3600 == 0) pipeline_stats.report();
+      sched_control.account("control");
+      sched_control.report();
+
+      // Sleep for 1 second (100ms * 10 loops) to make it more responsive,
+      // a foreground app change or a memory stall starts the next tick
+      for (int i = 0; i < 10 && running; ++i) {
+        if (foreground.wait(milliseconds(100))) break;
+        if (pressureTrigger.fired()) {
+          control_stats.pressure_wakeups.fetch_add(1, memory_order_relaxed);
+          break;
+        }
+      }
+    } else {
+      this_thread::sleep_for(seconds(1));
+    }
   }
+
+  actuator.stop();
+  power_state.stop();
 }
 
-class SwappinessManager {
+/**
+ * Lists the sequence numbers of <stream>.<seq>.log.gz segments in a
+ * directory, oldest first.
+ */
+vector<int> list_segments(const string &dir, const string &stream) {
+  vector<int> seqs;
+  string prefix = stream + ".";
+  DIR *d = opendir(dir.c_str());
+  if (!d) return seqs;
+
+  while (dirent *entry = readdir(d)) {
+    string name = entry->d_name;
+    if (name.compare(0, prefix.size(), prefix) != 0) continue;
+    if (name.size() < 7 || name.compare(name.size() - 7, 7, ".log.gz") != 0)
+      continue;
+
+    char *end;
+    long seq = strtol(name.c_str() + prefix.size(), &end, 10);
+    if (strcmp(end, ".log.gz") == 0) seqs.push_back(seq);
+  }
+  closedir(d);
+  sort(seqs.begin(), seqs.end());
+  return seqs;
+}
+
+/**
+ * Writes a log stream into size-bounded gzip segments. A full segment is
+ * closed and a new one opened, the oldest beyond max_segments are removed;
+ * nothing is ever copied.
+ */
+class LogSegmentWriter {
  public:
-  SwappinessManager(const DynamicSwappinessConfig &config)
-      : config(config), last_swappiness(-1) {
-    // Cache sorted pressure maps
-    cached_cpu = sort_desc(config.pressure_mapping.cpu);
-    cached_mem = sort_desc(config.pressure_mapping.memory);
-    cached_io = sort_desc(config.pressure_mapping.io);
-    cached_legacy = sort_desc(config.pressure_mapping.mem_pressure);
+  LogSegmentWriter(const LogCaptureConfig &config, string dir, string stream)
+      : config(config), dir(std::move(dir)), stream(std::move(stream)) {
+    vector<int> seqs = list_segments(this->dir, this->stream);
+    seq = seqs.empty() ? 0 : seqs.back();
   }
+  LogSegmentWriter(const LogSegmentWriter &) = delete;
+  LogSegmentWriter &operator=(const LogSegmentWriter &) = delete;
+  ~LogSegmentWriter() { close(); }
 
-  int get_swappiness() {
-    int swappiness = config.threshold_type == "psi" && psi_available()
-                         ? evaluate_psi()
-                         : evaluate_legacy();
-    return clamp(swappiness, config.min_swappiness, config.max_swappiness);
+  void write(const char *data, size_t len) {
+    if (!gz && !open_next()) return;
+
+    gzwrite(gz, data, len);
+    segment_bytes += len;
+    if (segment_bytes >= static_cast<size_t>(config.segment_kb) << 10) {
+      close();
+    }
   }
 
-  void apply_swappiness(int &swappiness) {
-    if (swappiness != last_swappiness) {
-      ALOGI("Swappiness -> %d", swappiness);
-      write_swappiness(swappiness);
-      last_swappiness = swappiness;
-      reset_threshold_logs();
+  void flush() {
+    if (!gz) return;
+    gzflush(gz, Z_SYNC_FLUSH);
+    account_written();
+  }
+
+  /**
+   * Finishes the current segment, its gzip trailer included in written().
+   */
+  void close() {
+    if (!gz) return;
+    gzflush(gz, Z_FINISH);
+    account_written();
+    gzclose(gz);
+    gz = nullptr;
+  }
+
+  /**
+   * Compressed bytes this writer put on flash so far.
+   */
+  long long written() const { return flash_bytes; }
+
+ private:
+  const LogCaptureConfig &config;
+  string dir;
+  string stream;
+  gzFile gz = nullptr;
+  int seq;
+  size_t segment_bytes = 0;
+  long long flash_bytes = 0;
+  long last_offset = 0;
+
+  string segment_path(int n) const {
+    return dir + "/" + stream + "." + to_string(n) + ".log.gz";
+  }
+
+  bool open_next() {
+    string path = segment_path(++seq);
+    gz = gzopen(path.c_str(), "wb6");
+    if (!gz) {
+      ALOGE("Error: Unable to open log segment %s", path.c_str());
+      return false;
+    }
+    segment_bytes = 0;
+    last_offset = 0;
+
+    vector<int> seqs = list_segments(dir, stream);
+    for (size_t i = 0; i + config.max_segments < seqs.size(); ++i) {
+      unlink(segment_path(seqs[i]).c_str());
+    }
+    return true;
+  }
+
+  void account_written() {
+    long offset = gzoffset(gz);
+    if (offset > last_offset) flash_bytes += offset - last_offset;
+    last_offset = offset;
+  }
+};
+
+/**
+ * Finds the pid of a process by its comm name without spawning pidof.
+ */
+pid_t find_pid_by_name(const char *name) {
+  DIR *proc = opendir(root_path("/proc").c_str());
+  if (!proc) return -1;
+
+  pid_t found = -1;
+  while (dirent *entry = readdir(proc)) {
+    if (!isdigit(entry->d_name[0])) continue;
+
+    char path[PATH_MAX], comm[32] = "";
+    snprintf(path, sizeof(path), "%s/proc/%s/comm", ROOT.c_str(),
+             entry->d_name);
+    FILE *file = fopen(path, "r");
+    if (!file) continue;
+    if (fgets(comm, sizeof(comm), file)) comm[strcspn(comm, "\n")] = '\0';
+    fclose(file);
+
+    if (strcmp(comm, name) == 0) {
+      found = atoi(entry->d_name);
+      break;
+    }
+  }
+  closedir(proc);
+  return found;
+}
+
+/**
+ * Checks one pid's comm instead of scanning /proc.
+ */
+bool process_has_name(pid_t pid, const char *name) {
+  char path[PATH_MAX], comm[32] = "";
+  snprintf(path, sizeof(path), "%s/proc/%d/comm", ROOT.c_str(), pid);
+  FILE *file = fopen(path, "r");
+  if (!file) return false;
+  if (fgets(comm, sizeof(comm), file)) comm[strcspn(comm, "\n")] = '\0';
+  fclose(file);
+  return strcmp(comm, name) == 0;
+}
+
+/**
+ * Captures the lmkd and fmiop log streams into compressed segments, bounds
+ * the plain text logs the shell scripts write, and archives closed segments
+ * incrementally.
+ */
+class LogCaptureService {
+ public:
+  LogCaptureService(const LogCaptureConfig &config)
+      : config(config),
+        segment_dir(LOG_FOLDER + "/logs"),
+        archive_dir(fmiop_dir + "/archives") {}
+
+  void run() {
+    mkdir(segment_dir.c_str(), 0755);
+    mkdir(archive_dir.c_str(), 0755);
+
+    Stream streams[] = {
+        {"lmkd", {}, -1, -1, -1, {config, segment_dir, "lmkd"}},
+        {"dynv", {"logcat", "-v", "time", "fmiop:V", "*:S"}, -1, -1, -1,
+         {config, segment_dir, "dynv"}},
+    };
+    auto last_flush = steady_clock::now();
+    auto last_archive = last_flush;
+    auto last_report = last_flush;
+    auto last_plain_check = last_flush;
+    timespec cpu_start;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    long long report_bytes = 0;
+
+    while (running) {
+      // The lmkd pidfd becomes readable when lmkd exits, poll() skips it
+      // while it is -1
+      pollfd fds[3];
+      for (int i = 0; i < 2; ++i) {
+        if (streams[i].fd < 0) spawn(streams[i]);
+        fds[i] = {streams[i].fd, POLLIN, 0};
+      }
+      fds[2] = {streams[0].pidfd, POLLIN, 0};
+
+      if (poll(fds, 3, 1000) > 0) {
+        // logcat --pid keeps running after lmkd restarts, follow the new pid
+        if (fds[2].revents & POLLIN) {
+          ALOGI("lmkd restarted, following the new process.");
+          stop(streams[0]);
+          fds[0].revents = 0;
+        }
+        for (int i = 0; i < 2; ++i) {
+          if (!(fds[i].revents & (POLLIN | POLLHUP))) continue;
+
+          char buf[16384];
+          ssize_t len = read(fds[i].fd, buf, sizeof(buf));
+          if (len > 0) {
+            streams[i].writer.write(buf, len);
+          } else {
+            ALOGW("Log stream %s ended, restarting.", streams[i].name);
+            stop(streams[i]);
+          }
+        }
+      } else if (streams[0].fd < 0 || streams[1].fd < 0) {
+        this_thread::sleep_for(seconds(1));
+      }
+
+      sched_control.account("log");
+      auto now = steady_clock::now();
+      if (now - last_flush >= seconds(config.flush_interval)) {
+        for (auto &stream : streams) stream.writer.flush();
+        last_flush = now;
+      }
+      if (now - last_plain_check >= seconds(2)) {
+        // Without a pidfd only the followed pid is checked
+        if (streams[0].fd >= 0 && streams[0].pidfd < 0 &&
+            !process_has_name(streams[0].target_pid, "lmkd")) {
+          ALOGI("lmkd restarted, following the new process.");
+          stop(streams[0]);
+        }
+        bound_plain_logs();
+        last_plain_check = now;
+      }
+      if (now - last_archive >= seconds(config.archive_interval)) {
+        archive_closed_segments();
+        last_archive = now;
+      }
+      if (now - last_report >= hours(1)) {
+        long long bytes = archived_bytes + plain_bytes;
+        for (auto &stream : streams) bytes += stream.writer.written();
+
+        timespec cpu_now;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_now);
+        double cpu_s = (cpu_now.tv_sec - cpu_start.tv_sec) +
+                       (cpu_now.tv_nsec - cpu_start.tv_nsec) / 1e9;
+        ALOGI("Log capture: %.2fs CPU, %lld KB written to flash in the last hour",
+              cpu_s, (bytes - report_bytes) >> 10);
+
+        cpu_start = cpu_now;
+        report_bytes = bytes;
+        last_report = now;
+      }
     }
+
+    for (auto &stream : streams) stop(stream);
   }
 
  private:
-  const DynamicSwappinessConfig &config;
-  int last_swappiness;
+  struct Stream {
+    const char *name;
+    vector<string> args;  // lmkd's are built per spawn, with its pid
+    pid_t target_pid;
+    pid_t child;
+    int fd;
+    LogSegmentWriter writer;
+    steady_clock::time_point last_spawn{};
+    int pidfd = -1;  // Of target_pid, lmkd's stream only
+  };
 
-  // Cached sorted maps
-  vector<pair<int, int>> cached_cpu;
-  vector<pair<int, int>> cached_mem;
-  vector<pair<int, int>> cached_io;
-  vector<pair<int, int>> cached_legacy;
+  const LogCaptureConfig &config;
+  string segment_dir;
+  string archive_dir;
+  long long archived_bytes = 0;
+  long long plain_bytes = 0;
+
+  void spawn(Stream &stream) {
+    // A source that exits right away (logd not up yet) is retried slowly
+    auto now = steady_clock::now();
+    if (now - stream.last_spawn < seconds(5)) return;
+    stream.last_spawn = now;
+
+    vector<string> args = stream.args;
+    if (args.empty()) {
+      stream.target_pid = find_pid_by_name("lmkd");
+      if (stream.target_pid < 0) return;
+      if (stream.pidfd >= 0) close(stream.pidfd);
+      stream.pidfd = kernel_caps.has(Capability::PIDFD)
+                         ? syscall(__NR_pidfd_open, stream.target_pid, 0)
+                         : -1;
+      args = {"logcat", "-v", "time",
+              "--pid=" + to_string(stream.target_pid)};
+    }
 
-  static vector<pair<int, int>> sort_desc(const vector<pair<int, int>> &table) {
-    auto sorted = table;
-    sort(sorted.begin(), sorted.end(),
-         [](const auto &a, const auto &b) { return a.first > b.first; });
-    return sorted;
-  }
+    // Everything the child needs is set up before fork(), other threads may
+    // hold the allocator or log locks. The child only dup2()s and execs.
+    string binary = find_executable(args[0]);
+    vector<char *> argv;
+    for (auto &arg : args) argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+    string command;
+    for (const auto &arg : args) command += (command.empty() ? "" : " ") + arg;
+
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) != 0) return;
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    pid_t child = fork();
+    if (child == 0) {
+      dup2(pipefd[1], STDOUT_FILENO);
+      if (null_fd >= 0) dup2(null_fd, STDERR_FILENO);
+      execv(binary.c_str(), argv.data());
+      _exit(127);
+    }
+    close(pipefd[1]);
+    if (null_fd >= 0) close(null_fd);
 
-  vector<int> compute_swappiness_steps(int min_swappiness, int max_swappiness,
-                                       int levels) {
-    vector<int> steps;
-    double step =
-        (max_swappiness - min_swappiness) / static_cast<double>(levels);
-    for (int i = 0; i <= levels; ++i) {
-      steps.insert(steps.begin(),
-                   static_cast<int>(round(max_swappiness - i * step)));
+    if (child < 0) {
+      ALOGE_ONCE(string("logcat_") + stream.name,
+                 "Failed to start log stream %s", stream.name);
+      close(pipefd[0]);
+      return;
     }
-    return steps;
+    stream.child = child;
+    stream.fd = pipefd[0];
+    ALOGI("Log stream %s capturing: %s", stream.name, command.c_str());
   }
 
-  int interpolate(double pressure, double pressure_min, double pressure_max,
-                  double swappiness_max, double swappiness_min) {
-    return (pressure - pressure_min) * (swappiness_min - swappiness_max) /
-               (pressure_max - pressure_min) +
-           swappiness_max;
+  static void stop(Stream &stream) {
+    if (stream.pidfd >= 0) {
+      close(stream.pidfd);
+      stream.pidfd = -1;
+    }
+    if (stream.fd < 0) return;
+    kill(stream.child, SIGTERM);
+    waitpid(stream.child, nullptr, 0);
+    close(stream.fd);
+    stream.fd = -1;
   }
 
-  // Helper function to join vector<int> into a string, highlighting the
-  // selected index
-  static string join_vector(const vector<int> &vec, int highlight_index) {
-    ostringstream oss;
-    for (size_t i = 0; i < vec.size(); ++i) {
-      if (static_cast<int>(i) == highlight_index) {
-        oss << "[" << vec[i] << "]";
-      } else {
-        oss << vec[i];
+  /**
+   * Shell scripts append to plain *.log files. One above plain_log_kb is
+   * renamed to *.log.1 and the scripts' next >> starts a new file. The
+   * previous *.log.1 is compressed into a segment first, a rotation later
+   * than the rename, so scripts that kept the old file open had that long
+   * to finish their lines.
+   */
+  void bound_plain_logs() {
+    DIR *d = opendir(LOG_FOLDER.c_str());
+    if (!d) return;
+
+    while (dirent *entry = readdir(d)) {
+      string name = entry->d_name;
+      if (name.size() < 5 || name.compare(name.size() - 4, 4, ".log") != 0)
+        continue;
+
+      string path = LOG_FOLDER + "/" + name;
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0 ||
+          st.st_size < static_cast<off_t>(config.plain_log_kb) << 10) {
+        continue;
+      }
+
+      string rotated = path + ".1";
+      int fd = open(rotated.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd >= 0) {
+        LogSegmentWriter writer(config, segment_dir,
+                                name.substr(0, name.size() - 4));
+        char buf[65536];
+        ssize_t len;
+        while ((len = read(fd, buf, sizeof(buf))) > 0) writer.write(buf, len);
+        writer.close();
+        plain_bytes += writer.written();
+        close(fd);
+        unlink(rotated.c_str());
+        ALOGI("Compressed %s into a segment", rotated.c_str());
+      }
+
+      if (rename(path.c_str(), rotated.c_str()) != 0) {
+        ALOGW_ONCE("rotate_" + name, "Failed to rotate %s: %s", path.c_str(),
+                   strerror(errno));
       }
-      if (i != vec.size() - 1) oss << " ";
     }
-    return oss.str();
+    closedir(d);
   }
 
-  int interpolate_sparse(double pressure, double pressure_min,
-                         double pressure_max, int swappiness_max,
-                         int swappiness_min, string log_id, int levels = 4) {
-    // Step 1: Clamp the pressure
-    pressure = clamp(pressure, pressure_min, pressure_max);
-    // Step 2: Normalize the pressure to [0,1]
-    double norm = (pressure - pressure_min) / (pressure_max - pressure_min);
-    // Step 3: Reverse the normalized value so high pressure → low swappiness
-    double reversed = 1.0 - norm;
-    // Step 4: Calculate index based on levels
-    int index = round(reversed * levels);
-    index = clamp(index, 0, levels);
-    // Step 5: Generate swappiness steps
-    vector<int> swappiness_steps =
-        compute_swappiness_steps(swappiness_min, swappiness_max, levels);
+  /**
+   * Copies segments closed since the last pass to the archive directory.
+   * Segments never change once closed, so an existing copy is up to date.
+   */
+  void archive_closed_segments() {
+    DIR *d = opendir(segment_dir.c_str());
+    if (!d) return;
 
-    ostringstream oss;
-    for (size_t i = 0; i < swappiness_steps.size(); ++i) {
-      if (i == index)
-        oss << "[" << swappiness_steps[i] << "] ";
-      else
-        oss << swappiness_steps[i] << " ";
+    vector<string> names;
+    while (dirent *entry = readdir(d)) {
+      if (entry->d_name[0] != '.') names.push_back(entry->d_name);
     }
+    closedir(d);
+
+    for (const auto &name : names) {
+      // The newest segment of each stream is still being written
+      size_t dot = name.find('.');
+      if (dot == string::npos) continue;
+      vector<int> seqs = list_segments(segment_dir, name.substr(0, dot));
+      if (seqs.empty() ||
+          name == name.substr(0, dot) + "." + to_string(seqs.back()) +
+                      ".log.gz") {
+        continue;
+      }
 
-    ALOGI_ONCE(log_id,
-               "[%s] PSI: %.2f normalized to %.4f (reversed: %.4f). "
-               "Using level %d → swappiness %d from steps [%s]",
-               log_id.c_str(), pressure, norm, reversed, index,
-               swappiness_steps[index],
-               join_vector(swappiness_steps, index).c_str());
-    // Step 6: Return selected swappiness
-    return swappiness_steps[index];
-  }
-
-  int evaluate_psi() {
-    double cpu = read_pressure("cpu", "some", config.cpu_time_window);
-    double mem = read_pressure("memory", "some", config.mem_time_window);
-    double io = read_pressure("io", "some", config.io_time_window);
-
-    if (config.mode == "auto") {
-      vector<int> pressures = {};
-      vector<tuple<pair<int, int>, double, string>> types = {
-          {make_pair(config.cpu_max, config.cpu_min), cpu, "cpu_pressure"},
-          {make_pair(config.mem_max, config.mem_min), mem, "mem_pressure"},
-          {make_pair(config.io_max, config.io_min), io, "io_pressure"}};
-
-      for (const auto &[pair, pressure, log_id] : types) {
-        double max = pair.first;
-        double min = pair.second;
-        pressures.push_back(
-            interpolate_sparse(pressure, min, max, config.max_swappiness,
-                               config.min_swappiness, log_id, config.levels));
-      }
-
-      int swappiness = min({pressures[0], pressures[1], pressures[2]});
-      log_if_threshold("sparsed_swappiness", swappiness, cpu, mem, io);
-      ALOGI_ONCE(
-          "swappiness_eval",
-          "[AUTO MODE] CPU(%s): %.2f → %d, MEM(%s): %.2f → %d, IO(%s): %.2f → "
-          "%d → FINAL: %d",
-          config.cpu_time_window.c_str(), cpu, pressures[0],
-          config.mem_time_window.c_str(), mem, pressures[1],
-          config.io_time_window.c_str(), io, pressures[2], swappiness);
-
-      return swappiness;
-    } else {
-      int cpu_swappiness = max(get_swappiness_from_pressure(cached_cpu, cpu),
-                               config.min_swappiness);
-      int mem_swappiness = max(get_swappiness_from_pressure(cached_mem, mem),
-                               config.min_swappiness);
-      int io_swappiness = max(get_swappiness_from_pressure(cached_io, io),
-                              config.min_swappiness);
-      int swappiness = max({cpu_swappiness, mem_swappiness, io_swappiness});
-
-      log_if_threshold("cpu_threshold", cpu_swappiness, cpu, mem, io);
-      log_if_threshold("mem_threshold", mem_swappiness, cpu, mem, io);
-      log_if_threshold("io_threshold", io_swappiness, cpu, mem, io);
-      return (swappiness != -1) ? swappiness : config.max_swappiness;
-    }
-  }
-
-  int evaluate_legacy() {
-    int mem_pressure = get_memory_pressure();
-    return (get_swappiness_from_pressure(cached_legacy, mem_pressure) != -1)
-               ? get_swappiness_from_pressure(cached_legacy, mem_pressure)
-               : config.max_swappiness;
-  }
-
-  void log_if_threshold(const string &tag, int swappiness, double cpu,
-                        double mem, double io) {
-    if (swappiness != -1) {
-      ALOGI_ONCE(tag,
-                 "[THRESHOLD] [%s] Swappiness: %d | Pressures: CPU=%.2f, "
-                 "MEM=%.2f, IO=%.2f",
-                 tag.c_str(), swappiness, cpu, mem, io);
-    } else {
-      ALOG_RESET(tag);
+      string target = archive_dir + "/" + name;
+      if (access(target.c_str(), F_OK) == 0) continue;
+      archived_bytes += copy_file(segment_dir + "/" + name, target);
     }
+
+    prune_archives();
   }
 
-  void reset_threshold_logs() {
-    ALOG_RESET("cpu_threshold");
-    ALOG_RESET("mem_threshold");
-    ALOG_RESET("io_threshold");
-    ALOG_RESET("cpu_pressure");
-    ALOG_RESET("mem_pressure");
-    ALOG_RESET("io_pressure");
-    ALOG_RESET("swappiness_eval");
+  static long long copy_file(const string &from, const string &to) {
+    int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return 0;
+
+    string tmp = to + ".tmp";
+    int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644);
+    long long copied = 0;
+    if (out >= 0) {
+      char buf[65536];
+      ssize_t len;
+      while ((len = read(in, buf, sizeof(buf))) > 0) {
+        if (::write(out, buf, len) != len) break;
+        copied += len;
+      }
+      close(out);
+      rename(tmp.c_str(), to.c_str());
+    }
+    close(in);
+    return copied;
   }
 
-  static int get_swappiness_from_pressure(const vector<pair<int, int>> &table,
-                                          double pressure) {
-    for (const auto &[threshold, value] : table) {
-      if (pressure >= threshold) return value;
+  void prune_archives() {
+    vector<pair<time_t, string>> archives;
+    DIR *d = opendir(archive_dir.c_str());
+    if (!d) return;
+    while (dirent *entry = readdir(d)) {
+      string path = archive_dir + "/" + entry->d_name;
+      struct stat st;
+      if (entry->d_name[0] != '.' && stat(path.c_str(), &st) == 0 &&
+          S_ISREG(st.st_mode)) {
+        archives.emplace_back(st.st_mtime, path);
+      }
+    }
+    closedir(d);
+
+    sort(archives.begin(), archives.end());
+    for (size_t i = 0; i + config.max_archives < archives.size(); ++i) {
+      unlink(archives[i].second.c_str());
     }
-    return -1;
   }
 };
 
 /**
- * Dynamic swappiness adjustment service.
+ * Native log capture and rotation service.
  */
-void dyn_swap_service() {
-  Config config;
-  config.load_from_yaml();
-  float CONFIG_VERSION = config.config_version;
-  int SWAPPINESS_MAX = config.swappiness_max;
-  int SWAPPINESS_MIN = config.swappiness_min;
-  int ZRAM_ACTIVATION_THRESHOLD = config.zram_activation_threshold;
-  int ZRAM_DEACTIVATION_THRESHOLD = config.zram_deactivation_threshold;
-  int SWAP_ACTIVATION_THRESHOLD = config.swap_activation_threshold;
-  int SWAP_DEACTIVATION_THRESHOLD = config.swap_deactivation_threshold;
-  int SWAP_DEACTIVATION_TIME = config.swap_deactivation_time;
-  bool PRESSURE_BINDING = config.pressure_binding;
-  bool DEACTIVATE_IN_SLEEP = config.deactivate_in_sleep;
-  string THRESHOLD_TYPE = config.threshold_type;
-
-  YAML::Node configRoot;
-  try {
-    configRoot = YAML::LoadFile(DEFAULT_CONFIG);
-  } catch (const std::exception &e) {
-    ALOGE("Failed to load config file: %s", e.what());
-  }
-  DynamicSwappinessConfig dynConfig;
-  dynConfig.load_from_yaml(configRoot);
-  SwappinessManager swappinessManager(dynConfig);
-
-  active_swaps = get_active_swap();
-  available_swaps = get_available_swap();
-  string swap_type = "zram";
-  string last_active_swap, scnd_lst_swap, next_swap, first_swap;
-  thread wfs_thread;
-  vector<thread> swapoff_thread;
-  vector<string> *current_avs, low_usage_swaps;
-  pair<int, int> lst_swap_usage, sc_prev_swap_usg;
-
-  int last_swappiness = read_swappiness();
-  int new_swappiness = SWAPPINESS_MAX;
-  int wait_timeout = SWAP_DEACTIVATION_TIME;
-  int activation_threshold, deactivation_threshold, lst_scnd_act_threshold,
-      priority;
-  bool unbounded = true;
-  bool is_condition_met, kill_low_swap, in_pressure;
-  bool threshold_psi = THRESHOLD_TYPE == "psi";
-  bool threshold_mem_pressure = THRESHOLD_TYPE == "mem_pressure";
-  bool dynv_enabled = read_config(".dynamic_swappiness.enable", true);
-  if (!dynv_enabled) {
-    swappinessManager.apply_swappiness(SWAPPINESS_MAX);
+void log_capture_service(const LogCaptureConfig &config) {
+  if (!config.enable) {
+    ALOGI("Log capture disabled, logs stay in logcat only.");
+    return;
   }
-  is_swapoff_session = (!DEACTIVATE_IN_SLEEP) ? true : false;
-
-  ALOGI("Config version: %.2f", CONFIG_VERSION);
-
-  while (running) {
-    if (!is_doze_mode()) {
-      if (dynv_enabled) {
-        new_swappiness = swappinessManager.get_swappiness();
-        swappinessManager.apply_swappiness(new_swappiness);
-      } else {
-        ALOGI_ONCE("dynv disabled", "Dynamic Swappiness is disabled.");
-      }
-
-      if (DEACTIVATE_IN_SLEEP) {
-        start_swapoff_timer_if_idle(wait_timeout);
-        if (!is_sleep_mode()) {
-          is_swapoff_session = false;
-          ALOG_RESET("swapoff_session");
-          ALOG_RESET("swapoff_timer");
-        }
-      }
-
-      // SWAP management logic
-      if (unbounded) {
-        // Load available swaps
-        if (!available_swaps.first.empty()) {
-          current_avs = &available_swaps.first;
-        } else if (!available_swaps.second.empty()) {
-          current_avs = &available_swaps.second;
-        }
-
-        // If there's no swap turn on first swap
-        if (active_swaps.empty()) {
-          first_swap = current_avs->back();
-          priority = get_smlst_priority();
 
-          if (swapon(first_swap, priority)) {
-            safe_push_back(first_swap, active_swaps);
-            current_avs->pop_back();
-
-            ALOGI("SWAPON: %s.", first_swap.c_str());
-          } else {
-            available_swaps = get_available_swap();
-          }
-        } else {
-          last_active_swap = active_swaps.back();
-          lst_swap_usage = get_swap_usage(last_active_swap);
-          activation_threshold =
-              (last_active_swap.find(SWAP_FILE_PREFIX) != string::npos)
-                  ? SWAP_ACTIVATION_THRESHOLD
-                  : ZRAM_ACTIVATION_THRESHOLD;
-          deactivation_threshold =
-              (last_active_swap.find(SWAP_FILE_PREFIX) != string::npos)
-                  ? SWAP_DEACTIVATION_THRESHOLD
-                  : ZRAM_DEACTIVATION_THRESHOLD;
-          low_usage_swaps = get_lusg_swaps();
-
-          /*
-            If conditions:
-              1. Swap usage is more than activation threshold
-              2. Swap is available
-              3. Device is not in sleep mode which probably better for battery
-                 with swap usage low so less process running.
-            Then:
-              - Turn on next available swap
-          */
-          if (lst_swap_usage.second > activation_threshold &&
-              !current_avs->empty() && !is_sleep_mode()) {
-            next_swap = current_avs->back();
-            priority = (next_swap.find("fmiop_swap.1") != string::npos)
-                           ? get_smlst_priority()
-                           : get_smlst_priority() - 1;
-
-            if (swapon(next_swap, priority)) {
-              safe_push_back(next_swap, active_swaps);
-              current_avs->pop_back();
-            } else {
-              available_swaps = get_available_swap();
-            }
-          } else {
-            // If SWAP more than 1 then check if need to turn off SWAP
-            try {
-              scnd_lst_swap = active_swaps.at(active_swaps.size() - 2);
-              lst_scnd_act_threshold =
-                  (scnd_lst_swap.find(SWAP_FILE_PREFIX) != string::npos)
-                      ? SWAP_ACTIVATION_THRESHOLD
-                      : ZRAM_ACTIVATION_THRESHOLD;
-              sc_prev_swap_usg = get_swap_usage(scnd_lst_swap);
-              is_condition_met =
-                  (sc_prev_swap_usg.second < lst_scnd_act_threshold &&
-                   lst_swap_usage.first < deactivation_threshold) &&
-                  is_swapoff_session;
-              kill_low_swap =
-                  (!low_usage_swaps.empty() &&
-                   sc_prev_swap_usg.second < lst_scnd_act_threshold &&
-                   active_swaps.size() > 1);
-
-              // If one of condition is met turn off SWAP
-              if (is_condition_met) {
-                ALOGW("condition met",
-                      "sleep more than %d minutes. Deactivating swap...",
-                      SWAP_DEACTIVATION_TIME);
-                swapoff_(last_active_swap, swapoff_thread);
-              } else if (kill_low_swap) {
-                for (auto swap : low_usage_swaps) {
-                  swapoff_(swap, swapoff_thread, "Reason: low swap usage.");
-                }
-              }
-              ALOG_RESET("swapoff_end");
-            } catch (const out_of_range &e) {
-              ALOGW_ONCE("swapoff_end", "No second last swap.");
-              ALOG_RESET("condition met");
-            }
-          }
-        }
-      }
-      // Sleep for 1 second (100ms * 10 loops) to make it more responsive
-      for (int i = 0; i < 10 && running; ++i) {
-        this_thread::sleep_for(milliseconds(100));
-      }
-    }
-  }
+  ALOGI("Starting native log capture service.");
+  sched_control.place_control_thread();
+  LogCaptureService service(config);
+  service.run();
 }
 
 void relmkd() {
@@ -1368,7 +8172,7 @@ bool rm_prop(const vector<string> &props) {
 void fmiop() {
   ALOGI("Starting minfree_level deleter service.");
 
-  while (true) {
+  while (running) {
     if (rm_prop({"sys.lmk.minfree_levels"})) {
       relmkd();
     }
@@ -1376,12 +8180,649 @@ void fmiop() {
   }
 }
 
-int main() {
+/**
+ * Times a policy decision per tick for each policy on a fixed PSI sample,
+ * including the memory pressure read every tick does, to keep an eye on the
+ * per-tick cost of the control loop. Run with DYNV_ROOT pointing at a tree
+ * without /proc/pressure to time a PSI-less kernel.
+ */
+int bench_policy(long iterations, const string &config_path) {
+  YAML::Node configRoot;
+  try {
+    configRoot = YAML::LoadFile(config_path);
+  } catch (const std::exception &e) {
+    fprintf(stderr, "Failed to load config: %s\n", e.what());
+    return EXIT_FAILURE;
+  }
+
+  PsiSample psi;
+  psi.valid = true;
+  for (int r = 0; r < 3; ++r) {
+    for (int l = 0; l < 2; ++l) {
+      for (int w = 0; w < 3; ++w) psi.avg[r][l][w] = 3.5 * (r + 1) + w;
+    }
+  }
+
+  MemoryPressureReader memoryPressure;
+  printf("%-12s %12s %12s %10s\n", "policy", "ns/tick", "ticks/s",
+         "swappiness");
+  for (const char *variant : {"psi-auto", "psi-manual", "legacy"}) {
+    DynamicSwappinessConfig config;
+    config.load_from_yaml(configRoot);
+    config.threshold_type = strcmp(variant, "legacy") == 0 ? "mem_pressure"
+                                                           : "psi";
+    config.mode = strcmp(variant, "psi-auto") == 0 ? "auto" : "manual";
+
+    SwappinessManager manager(config);
+    int swappiness = 0;
+    auto start = steady_clock::now();
+    for (long i = 0; i < iterations; ++i) {
+      swappiness = manager.get_swappiness(psi, memoryPressure.read());
+    }
+    double ns = duration<double, nano>(steady_clock::now() - start).count() /
+                iterations;
+
+    printf("%-12s %12.1f %12.0f %10d\n", variant, ns, 1e9 / ns, swappiness);
+  }
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Allocations made through operator new, counted for the allocations per
+ * parse --check-parsers reports. Only the checker build (build.sh -T)
+ * defines DYNV_COUNT_ALLOCS, the daemon keeps the default allocator.
+ */
+atomic<uint64_t> allocation_count{0};
+
+#ifdef DYNV_COUNT_ALLOCS
+constexpr bool COUNTING_ALLOCATIONS = true;
+
+void *operator new(size_t size) {
+  allocation_count.fetch_add(1, memory_order_relaxed);
+  if (void *p = malloc(size ? size : 1)) return p;
+  throw bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+// Not inlined, so the compiler doesn't see free() on a pointer from new
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete[](void *p) noexcept {
+  free(p);
+}
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+__attribute__((noinline)) void operator delete[](void *p, size_t) noexcept {
+  free(p);
+}
+#else
+constexpr bool COUNTING_ALLOCATIONS = false;
+#endif
+
+void describe_line(string &out, const char *format, ...) {
+  char line[512];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  out += line;
+  out += '\n';
+}
+
+/**
+ * A parser covered by --check-parsers. parse() is the timed part and only
+ * parses; describe() prints what the parser got out of a corpus file, one
+ * key=value per line, to compare with the file's .expect.
+ */
+struct ParserCheck {
+  const char *name;  // Corpus subdirectory
+  bool (*parse)(const char *input, size_t len);
+  string (*describe)(const char *input, size_t len);
+};
+
+WorkingSet lru_gen_parse(const char *input, size_t len) {
+  static const WorkingSetConfig config;
+  WorkingSet set;
+  set.ages = config.ages.size();
+  for (int a = 0; a < set.ages; ++a) set.age_ms[a] = config.ages[a] * 1000L;
+  set.swap_age_ms = config.swap_age * 1000L;
+  LruGenParser parser(set);
+  parser.feed(input, len);
+  parser.finish();
+  return set;
+}
+
+const ParserCheck PARSER_CHECKS[] = {
+    {"psi",
+     [](const char *input, size_t) {
+       double avg[2][3];
+       uint64_t total[2];
+       bool has_full;
+       return parse_psi(input, avg, total, has_full);
+     },
+     [](const char *input, size_t) {
+       double avg[2][3] = {};
+       uint64_t total[2] = {};
+       bool has_full;
+       string out;
+       describe_line(out, "ok=%d", parse_psi(input, avg, total, has_full));
+       describe_line(out, "has_full=%d", has_full);
+       for (int level = 0; level < 2; ++level) {
+         describe_line(out, "%s avg10=%.2f avg60=%.2f avg300=%.2f total=%llu",
+                       level ? "full" : "some", avg[level][0], avg[level][1],
+                       avg[level][2],
+                       static_cast<unsigned long long>(total[level]));
+       }
+       return out;
+     }},
+    {"meminfo",
+     [](const char *input, size_t) {
+       MemInfo info;
+       return parse_meminfo(input, info);
+     },
+     [](const char *input, size_t) {
+       MemInfo info;
+       string out;
+       describe_line(out, "ok=%d", parse_meminfo(input, info));
+       describe_line(out, "has_available=%d", info.has_available);
+       const pair<const char *, uint64_t> fields[] = {
+           {"mem_total", info.mem_total},   {"mem_free", info.mem_free},
+           {"mem_available", info.mem_available}, {"buffers", info.buffers},
+           {"cached", info.cached},         {"swap_total", info.swap_total},
+           {"swap_free", info.swap_free},   {"anon_pages", info.anon_pages}};
+       for (const auto &[name, value] : fields) {
+         describe_line(out, "%s=%llu", name,
+                       static_cast<unsigned long long>(value));
+       }
+       return out;
+     }},
+    {"proc_swaps",
+     [](const char *input, size_t) {
+       vector<SwapEntry> entries;
+       parse_proc_swaps(input, entries);
+       return !entries.empty();
+     },
+     [](const char *input, size_t) {
+       vector<SwapEntry> entries;
+       parse_proc_swaps(input, entries);
+       string out;
+       describe_line(out, "entries=%zu", entries.size());
+       for (const auto &entry : entries) {
+         describe_line(out, "path=%s size_kb=%ld used_kb=%ld priority=%d",
+                       entry.path.c_str(), entry.size_kb, entry.used_kb,
+                       entry.priority);
+       }
+       return out;
+     }},
+    {"mm_stat",
+     [](const char *input, size_t) {
+       long long values[MM_STAT_FIELDS];
+       return parse_mm_stat(input, values) > 0;
+     },
+     [](const char *input, size_t) {
+       long long values[MM_STAT_FIELDS];
+       string out;
+       describe_line(out, "columns=%d", parse_mm_stat(input, values));
+       for (int f = 0; f < MM_STAT_FIELDS; ++f) {
+         describe_line(out, "%d=%lld", f, values[f]);
+       }
+       return out;
+     }},
+    {"dumpsys_deviceidle",
+     [](const char *input, size_t) { return parse_deep_idle(input); },
+     [](const char *input, size_t) {
+       string out;
+       describe_line(out, "idle=%d", parse_deep_idle(input));
+       return out;
+     }},
+    {"dumpsys_power",
+     [](const char *input, size_t) { return parse_asleep(input); },
+     [](const char *input, size_t) {
+       string out;
+       describe_line(out, "asleep=%d", parse_asleep(input));
+       return out;
+     }},
+    {"lru_gen",
+     [](const char *input, size_t len) {
+       return lru_gen_parse(input, len).generations > 0;
+     },
+     [](const char *input, size_t len) {
+       WorkingSet set = lru_gen_parse(input, len);
+       string out;
+       describe_line(out, "generations=%zu", set.generations);
+       describe_line(out, "anon_pages=%llu file_pages=%llu idle_anon_pages=%llu",
+                     static_cast<unsigned long long>(set.total_anon_pages),
+                     static_cast<unsigned long long>(set.total_file_pages),
+                     static_cast<unsigned long long>(set.idle_anon_pages));
+       for (int a = 0; a < set.ages; ++a) {
+         describe_line(out, "age_ms=%ld anon_pages=%llu file_pages=%llu",
+                       set.age_ms[a],
+                       static_cast<unsigned long long>(set.anon_pages[a]),
+                       static_cast<unsigned long long>(set.file_pages[a]));
+       }
+       return out;
+     }},
+    {"damon_snapshot",
+     [](const char *input, size_t) {
+       DamonSnapshot snapshot;
+       return snapshot.parse(input);
+     },
+     [](const char *input, size_t) {
+       DamonSnapshot snapshot;
+       string out;
+       describe_line(out, "ok=%d", snapshot.parse(input));
+       describe_line(out,
+                     "sample_us=%ld aggr_us=%ld free_kb=%llu anon_kb=%llu "
+                     "ops=%s",
+                     snapshot.sample_us, snapshot.aggr_us,
+                     static_cast<unsigned long long>(snapshot.free_kb),
+                     static_cast<unsigned long long>(snapshot.anon_kb),
+                     snapshot.vaddr ? "vaddr" : "paddr");
+       describe_line(out, "regions=%zu", snapshot.regions.size());
+       for (const auto &region : snapshot.regions) {
+         describe_line(out, "%lx-%lx nr_accesses=%u age=%u", region.start,
+                       region.end, region.nr_accesses, region.age);
+       }
+       return out;
+     }},
+    {"cgroup_procs",
+     [](const char *input, size_t) {
+       pid_t pids[1024];
+       return parse_pids(input, pids, size(pids)) > 0;
+     },
+     [](const char *input, size_t) {
+       pid_t pids[1024];
+       size_t count = parse_pids(input, pids, size(pids));
+       string out;
+       describe_line(out, "pids=%zu", count);
+       for (size_t i = 0; i < count; ++i) describe_line(out, "%d", pids[i]);
+       return out;
+     }},
+};
+
+bool read_corpus_file(const string &path, string &content) {
+  ifstream file(path, ios::binary);
+  if (!file) return false;
+  ostringstream buffer;
+  buffer << file.rdbuf();
+  content = buffer.str();
+  return true;
+}
+
+/**
+ * Runs every /proc, sysfs and dumpsys parser over a corpus of captured
+ * files, one subdirectory per parser (tools/parser_corpus). Each <case>.txt
+ * must parse to what its <case>.expect says, and every parser needs at
+ * least one case, so a new parser can't go in without its corpus. Prints
+ * ns and allocations per parse; --update rewrites the .expect files.
+ */
+int check_parsers(const string &corpus, long iterations, bool update) {
+  printf("%-18s %-24s %10s %10s  %s\n", "parser", "case", "ns/op",
+         "allocs/op", "result");
+  int failures = 0;
+  for (const auto &check : PARSER_CHECKS) {
+    string dir = corpus + "/" + check.name;
+    vector<string> cases;
+    if (DIR *d = opendir(dir.c_str())) {
+      while (dirent *entry = readdir(d)) {
+        string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0) {
+          cases.push_back(name.substr(0, name.size() - 4));
+        }
+      }
+      closedir(d);
+    }
+    sort(cases.begin(), cases.end());
+    if (cases.empty()) {
+      printf("%-18s %-24s %10s %10s  FAIL: no corpus in %s\n", check.name, "-",
+             "-", "-", dir.c_str());
+      failures++;
+      continue;
+    }
+
+    for (const auto &name : cases) {
+      string input, expected;
+      read_corpus_file(dir + "/" + name + ".txt", input);
+      string expect_path = dir + "/" + name + ".expect";
+      bool has_expected = read_corpus_file(expect_path, expected);
+      string got = check.describe(input.c_str(), input.size());
+
+      const char *result = "ok";
+      if (got != expected) {
+        if (update) {
+          ofstream(expect_path) << got;
+          result = "updated";
+        } else {
+          result = has_expected ? "FAIL" : "FAIL: no .expect";
+          failures++;
+          fprintf(stderr, "%s/%s expected:\n%sgot:\n%s", check.name,
+                  name.c_str(), expected.c_str(), got.c_str());
+        }
+      }
+
+      bool parsed = false;
+      uint64_t allocations = allocation_count.load(memory_order_relaxed);
+      auto start = steady_clock::now();
+      for (long i = 0; i < iterations; ++i) {
+        parsed ^= check.parse(input.c_str(), input.size());
+      }
+      double ns = duration<double, nano>(steady_clock::now() - start).count() /
+                  iterations;
+      double allocs =
+          static_cast<double>(allocation_count.load(memory_order_relaxed) -
+                              allocations) /
+          iterations;
+      // Keeps the loop from being optimized out
+      asm volatile("" : : "r"(parsed) : "memory");
+
+      char allocs_text[16] = "-";
+      if (COUNTING_ALLOCATIONS) {
+        snprintf(allocs_text, sizeof(allocs_text), "%.2f", allocs);
+      }
+      printf("%-18s %-24s %10.1f %10s  %s\n", check.name, name.c_str(), ns,
+             allocs_text, result);
+    }
+  }
+  printf("%d failed\n", failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * Validates a config by running every section's loader over it, then
+ * writes the compiled cache the daemon starts from. Run by the installer
+ * and after editing config.yaml; the daemon also rebuilds a stale cache.
+ */
+int compile_config(const string &source, const string &path) {
+  auto start = steady_clock::now();
+  YAML::Node root;
+  try {
+    root = YAML::LoadFile(source);
+  } catch (const std::exception &e) {
+    fprintf(stderr, "%s: %s\n", source.c_str(), e.what());
+    return EXIT_FAILURE;
+  }
+
+  DaemonConfig config;
+  try {
+    config.load_from_yaml(root);
+    if (config.general.config_version < 0) {
+      throw runtime_error("config_version is missing");
+    }
+  } catch (const std::exception &e) {
+    fprintf(stderr, "%s: invalid config: %s\n", source.c_str(), e.what());
+    return EXIT_FAILURE;
+  }
+  double parse_ms =
+      duration<double, milli>(steady_clock::now() - start).count();
+
+  if (!write_config_cache(config, source, path)) {
+    fprintf(stderr, "Cannot write %s: %s\n", path.c_str(), strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  start = steady_clock::now();
+  DaemonConfig cached;
+  if (!read_config_cache(source, path, cached)) {
+    fprintf(stderr, "Cannot read back %s\n", path.c_str());
+    return EXIT_FAILURE;
+  }
+  double load_ms = duration<double, milli>(steady_clock::now() - start).count();
+
+  struct stat st;
+  stat(path.c_str(), &st);
+  printf("%s: %lld bytes, YAML load %.3f ms, cache load %.3f ms\n",
+         path.c_str(), static_cast<long long>(st.st_size), parse_ms, load_ms);
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Prints what the capability probe found and what dynv would run with.
+ * Combine with DYNV_ROOT and DYNV_CAPS to check a simulated kernel.
+ */
+int probe_caps() {
+  for (size_t i = 0; i < size(KernelCapabilities::names); ++i) {
+    auto cap = static_cast<Capability>(i);
+    printf("%-18s %s%s\n", KernelCapabilities::names[i],
+           kernel_caps.has(cap) ? "yes" : "no",
+           kernel_caps.simulated(cap) ? " (simulated)" : "");
+  }
+  printf("bitmap 0x%04x\nselected: %s\n", kernel_caps.bitmap(),
+         kernel_caps.selection().c_str());
+  return EXIT_SUCCESS;
+}
+
+void print_usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [--foreground]        Run the daemon\n"
+          "       %s --capture-pages <corpus> [max_mb] [min_oom_score_adj]\n"
+          "       %s --bench-zram <corpus> [--apply]\n"
+          "       %s --bench-policy [iterations] [config]\n"
+          "       %s --damon-replay <snapshot> [config]\n"
+          "       %s --bench-lru-gen <file> [iterations=1000]\n"
+          "       %s --compile-config [config] [cache]\n"
+          "       %s --check-parsers <corpus> [iterations=10000] [--update]\n"
+          "       %s --check-zram <device number>\n"
+          "       %s --probe-caps\n",
+          name, name, name, name, name, name, name, name, name, name);
+}
+
+/**
+ * One-shot tools sharing the daemon's code, run in the foreground.
+ */
+int run_command(int argc, char *argv[]) {
+  string command = argv[1];
+
+  if (command == "--capture-pages" && argc >= 3) {
+    long max_mb = argc >= 4 ? atol(argv[3]) : 256;
+    int min_adj = argc >= 5 ? atoi(argv[4]) : 900;
+    long pages = capture_pages(argv[2], max_mb, min_adj);
+    if (pages < 0) return EXIT_FAILURE;
+    printf("Captured %ld pages to %s\n", pages, argv[2]);
+    return EXIT_SUCCESS;
+  }
+  if (command == "--bench-zram" && argc >= 3) {
+    bool apply = argc >= 4 && string(argv[3]) == "--apply";
+    return bench_zram(argv[2], apply);
+  }
+
+  if (command == "--bench-policy") {
+    return bench_policy(argc >= 3 ? max(atol(argv[2]), 1L) : 100000,
+                        argc >= 4 ? argv[3] : DEFAULT_CONFIG);
+  }
+
+  if (command == "--damon-replay" && argc >= 3) {
+    return damon_replay(argv[2], argc >= 4 ? argv[3] : DEFAULT_CONFIG);
+  }
+
+  if (command == "--bench-lru-gen" && argc >= 3) {
+    long iterations = argc >= 4 ? atol(argv[3]) : 1000;
+    return bench_lru_gen(argv[2], max(iterations, 1L));
+  }
+
+  if (command == "--check-parsers" && argc >= 3) {
+    bool update = string(argv[argc - 1]) == "--update";
+    long iterations = argc >= 4 && !(update && argc == 4) ? atol(argv[3])
+                                                          : 10000;
+    return check_parsers(argv[2], max(iterations, 1L), update);
+  }
+
+  if (command == "--check-zram" && argc >= 3) return check_zram(atoi(argv[2]));
+
+  if (command == "--probe-caps") return probe_caps();
+
+  if (command == "--compile-config") {
+    return compile_config(argc >= 3 ? argv[2] : DEFAULT_CONFIG,
+                          argc >= 4 ? argv[3] : CONFIG_CACHE);
+  }
+
+  print_usage(argv[0]);
+  return EXIT_FAILURE;
+}
+
+/**
+ * Takes the single-instance lock and writes our pid into it for the shell
+ * scripts. The kernel drops the lock with the process, however it dies.
+ */
+bool acquire_instance_lock() {
+  int fd = open(LOCK_FILE.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    ALOGW("Cannot open %s: %s, running without a lock.", LOCK_FILE.c_str(),
+          strerror(errno));
+    return true;
+  }
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    char owner[16] = {};
+    pread(fd, owner, sizeof(owner) - 1, 0);
+    owner[strcspn(owner, "\n")] = '\0';
+    ALOGE("dynv is already running with PID %s.", owner);
+    close(fd);
+    return false;
+  }
+
+  // Kept open for the lifetime of the process
+  string pid = to_string(getpid()) + "\n";
+  if (ftruncate(fd, 0) != 0 || pwrite(fd, pid.data(), pid.size(), 0) !=
+                                   static_cast<ssize_t>(pid.size())) {
+    ALOGW("Cannot write %s: %s", LOCK_FILE.c_str(), strerror(errno));
+  }
+  return true;
+}
+
+/**
+ * The daemon proper: config, scheduling and the service threads.
+ */
+void run_worker() {
+  const DaemonConfig config = load_config();
+  sched_control.configure(config.scheduling);
+
+  thread adjust_thread(dyn_swap_service, cref(config));
+  thread fmiop_thread(fmiop);
+  thread log_thread(log_capture_service, cref(config.logging));
+  thread metrics_thread(metrics_service, cref(config.metrics));
+  adjust_thread.join();
+  fmiop_thread.join();
+  log_thread.join();
+  metrics_thread.join();
+
+  journal.flush();
+  if (stop_signal) ALOGI("Received signal %d, exiting...", stop_signal);
+}
+
+atomic<pid_t> worker_pid(0);
+atomic<int> worker_pidfd(-1);
+volatile sig_atomic_t supervisor_stopping = 0;
+
+// Stops the supervisor and passes the signal on to the worker
+void supervisor_signal_handler(int) {
+  supervisor_stopping = 1;
+  int pidfd = worker_pidfd.load();
+  if (pidfd >= 0) {
+    syscall(__NR_pidfd_send_signal, pidfd, SIGTERM, nullptr, 0);
+  } else if (worker_pid.load() > 0) {
+    kill(worker_pid.load(), SIGTERM);
+  }
+}
+
+/**
+ * Runs the worker in a child process and restarts it as soon as it dies.
+ * The supervisor sleeps in poll() on a pidfd of the worker (waitpid() on
+ * kernels before 5.3), so a crash is seen at once and the replacement is
+ * forked within milliseconds. It starts from the handoff state the dead
+ * worker kept current, so swappiness isn't reset and swap devices aren't
+ * scanned for again. A worker that dies within a minute of starting again
+ * is restarted with exponential backoff, from 100 ms up to 30 s.
+ *
+ * A clean exit of the worker or SIGTERM to the supervisor stops both. The
+ * worker finishes its tick and flushes the journal first on SIGTERM or
+ * SIGINT, and dies with the supervisor if that is killed outright.
+ */
+int supervise(const function<void()> &worker) {
+  handoff.create();
+  signal(SIGTERM, supervisor_signal_handler);
+  signal(SIGINT, supervisor_signal_handler);
+
+  pid_t supervisor = getpid();
+  int crashes = 0;
+  steady_clock::time_point died;
+  while (!supervisor_stopping) {
+    auto started = steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+      ALOGE("Failed to fork the worker: %s", strerror(errno));
+      this_thread::sleep_for(seconds(1));
+      continue;
+    }
+    if (pid == 0) {
+      prctl(PR_SET_PDEATHSIG, SIGKILL);
+      if (getppid() != supervisor) _exit(EXIT_FAILURE);
+      process_start = steady_clock::now();
+      signal(SIGTERM, signal_handler);
+      signal(SIGINT, signal_handler);
+      worker();
+      _exit(EXIT_SUCCESS);
+    }
+
+    int pidfd = kernel_caps.has(Capability::PIDFD)
+                    ? syscall(__NR_pidfd_open, pid, 0)
+                    : -1;
+    worker_pid = pid;
+    worker_pidfd = pidfd;
+    if (supervisor_stopping) kill(pid, SIGTERM);  // Raced with the fork
+    if (crashes > 0) {
+      ALOGI("Worker %d started %.2f ms after the last one died", pid,
+            duration<double, milli>(started - died).count());
+    } else {
+      ALOGI("Worker %d started", pid);
+    }
+
+    if (pidfd >= 0) {
+      pollfd pfd{pidfd, POLLIN, 0};
+      while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+      }
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    died = steady_clock::now();
+    worker_pidfd = -1;
+    worker_pid = 0;
+    if (pidfd >= 0) close(pidfd);
+
+    bool clean_exit = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (supervisor_stopping || clean_exit) {
+      ALOGI("Worker %d stopped.", pid);
+      break;
+    }
+
+    crashes = died - started < minutes(1) ? crashes + 1 : 1;
+    auto delay = crashes == 1 ? milliseconds(0)
+                              : min(milliseconds(100 << min(crashes - 2, 9)),
+                                    milliseconds(30000));
+    if (WIFSIGNALED(status)) {
+      ALOGE("Worker %d killed by signal %d, restarting in %lld ms", pid,
+            WTERMSIG(status), static_cast<long long>(delay.count()));
+    } else {
+      ALOGE("Worker %d exited with %d, restarting in %lld ms", pid,
+            WEXITSTATUS(status), static_cast<long long>(delay.count()));
+    }
+    handoff.count_restart();
+    if (delay.count() > 0) poll(nullptr, 0, delay.count());
+  }
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+  // Foreground mode keeps the terminal, for profiling and host runs
+  bool foreground = argc > 1 && string(argv[1]) == "--foreground";
+  if (argc > 1 && !foreground) return run_command(argc, argv);
+
   signal(SIGINT, signal_handler);
+  signal(SIGTERM, signal_handler);
+  // Sockets and pipes report EPIPE instead of killing the daemon
+  signal(SIGPIPE, SIG_IGN);
 
   pid_t pid, sid;
 
-  pid = fork();
+  pid = foreground ? 0 : fork();
 
   if (pid < 0) {
     exit(EXIT_FAILURE);
@@ -1394,30 +8835,36 @@ int main() {
   // Set file mode creation mask to 0
   umask(0);
 
-  // Create a new session ID
-  sid = setsid();
-  if (sid < 0) {
-    ALOGE("Failed to create new session: %s", strerror(errno));
-    exit(EXIT_FAILURE);
-  }
+  if (!foreground) {
+    // Create a new session ID
+    sid = setsid();
+    if (sid < 0) {
+      ALOGE("Failed to create new session: %s", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
 
-  if (chdir("/") < 0) {
-    ALOGE("Failed to change working directory: %s", strerror(errno));
-    exit(EXIT_FAILURE);
+    if (chdir("/") < 0) {
+      ALOGE("Failed to change working directory: %s", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    // Close standard file descriptors
+    close(STDIN_FILENO);
+    close(STDOUT_FILENO);
+    close(STDERR_FILENO);
   }
 
-  // Close standard file descriptors
-  close(STDIN_FILENO);
-  close(STDOUT_FILENO);
-  close(STDERR_FILENO);
+  if (!acquire_instance_lock()) exit(EXIT_FAILURE);
 
   pid_t current_pid = getpid();
   ALOGI("Current PID: %d", current_pid);
-  save_pid("dyn_swap_service", current_pid);
+  // Probed once here, restarted workers inherit the result
+  kernel_caps.bitmap();
 
-  thread adjust_thread(dyn_swap_service);
-  thread fmiop_thread(fmiop);
-  adjust_thread.join();
-  fmiop_thread.join();
-  return 0;
+  // Foreground runs stay unsupervised, a crash should stop the profile
+  if (foreground) {
+    run_worker();
+    return 0;
+  }
+  return supervise(run_worker);
 }
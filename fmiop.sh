@@ -110,7 +110,8 @@ read_pid() {
 	grep "$1" "$PID_DB" | cut -d= -f2
 }
 
-# kill_all_pids - Terminates all processes listed in PID_DB
+# kill_all_pids - Terminates all processes listed in PID_DB. dynv is not
+# listed there, stop it with kill_dynv
 kill_all_pids() {
 	local pid_name pid_value
 
@@ -118,96 +119,16 @@ kill_all_pids() {
 		pid_name=$(echo "$line" | cut -d= -f1)
 		pid_value=$(echo "$line" | cut -d= -f2)
 
-		if [ -n "$pid_value" ]; then
+		# A stale entry may name a reused pid, only kill our own scripts
+		if [ -n "$pid_value" ] &&
+			grep -q fmiop "/proc/$pid_value/cmdline" 2>/dev/null; then
 			kill -9 "$pid_value" && loger "Killed $pid_name with PID $pid_value"
-			remove_pid "$pid_name"
 		fi
+		remove_pid "$pid_name"
 	done <"$PID_DB"
 	loger "All tracked processes terminated"
 }
 
-# lmkd_loger - Logs LMKD activity to a file with rotation
-# Usage: lmkd_loger <log_file>
-lmkd_loger() {
-	local log_file="$1" new_pid old_pid
-
-	loger "Starting LMKD logging to $log_file"
-	resetprop ro.lmk.debug true || loger e "Failed to enable LMKD debug mode"
-	old_pid=$(read_pid "fmiop.lmkd_loger.pid")
-
-	if [ -n "$old_pid" ]; then
-		kill -9 "$old_pid"
-		remove_pid "fmiop.lmkd_loger.pid"
-		loger "Stopped previous LMKD logger (PID $old_pid)"
-	fi
-
-	$BIN/logcat -v time --pid=$(pidof lmkd) -r "$((5 * 1024))" -n 2 --file="$log_file" &
-
-	if [ $? -ne 0 ]; then
-		loger e "Failed to start logcat for LMKD"
-		return 1
-	fi
-
-	new_pid=$!
-	save_pid "fmiop.lmkd_loger.pid" "$new_pid"
-	loger "LMKD logger started with PID $new_pid"
-}
-
-# loger_watcher - Monitors log files and rotates them when they exceed 10MB
-# Usage: loger_watcher <log_files>
-loger_watcher() {
-	logs="$1"
-	ten_mb=10485760
-
-	loger "Starting log watcher for files: $logs"
-
-	exec 3>&-
-	set +x
-
-	while true; do
-		for log in $logs; do
-			log_size=$(check_file_size "$log")
-
-			if [ "$log_size" -ge "$ten_mb" ]; then
-				exec 3>&1
-				set -x
-
-				log_count=$(find "${log%.log}"* | wc -l)
-
-				if [ $SINCE_REBOOT ]; then
-					cp "$log" "$log.boot"
-					SINCE_REBOOT=false
-				else
-					for num in $(find $log.* | sed 's/[^0-9]//g' | sort -r); do
-						new_num=$((num + 1))
-						mv $log.$num $log.$new_num
-					done
-
-					cp "$log" "$log.1"
-				fi
-
-				: >"$log"
-				loger "Rotated $log to $log.1"
-
-				# limit logs to only 3
-				while [ $log_count -ge 3 ]; do
-					oldest_log=$(ls -tr "${log%.log}"* | head -n 1)
-					log_count=$((log_count - 1))
-
-					rm -rf "$oldest_log"
-					loger "Removed: $oldest_log. $log_count left."
-				done
-
-				exec 3>&-
-				set +x
-			fi
-		done
-		sleep 2
-	done &
-
-	save_pid "fmiop.lmkd_loger_watcher.pid" "$!"
-}
-
 # rm_prop - Deletes specified system properties
 # Usage: rm_prop <prop1> <prop2> ...
 rm_prop() {
@@ -311,6 +232,30 @@ remove_zram() {
 	} || loger e "Failed to remove ZRAM $1"
 }
 
+# set_zram_algorithm - Sets the compression algorithms of a ZRAM partition
+# Usage: set_zram_algorithm <zram_id>
+# Note: "auto" uses the recommendation saved by `dynv --bench-zram <corpus> --apply`
+set_zram_algorithm() {
+	local zram_sys="/sys/block/zram$1" algorithm recomp auto_algorithm auto_recomp
+
+	algorithm=$(read_config ".virtual_memory.zram.comp_algorithm" "auto")
+	recomp=$(read_config ".virtual_memory.zram.recomp_algorithm" "auto")
+	[ -f "$LOG_FOLDER/zram.algorithm" ] && read -r auto_algorithm auto_recomp <"$LOG_FOLDER/zram.algorithm"
+	[ "$algorithm" = "auto" ] && algorithm=$auto_algorithm
+	[ "$recomp" = "auto" ] && recomp=$auto_recomp
+
+	if [ -n "$algorithm" ]; then
+		echo "$algorithm" >"$zram_sys/comp_algorithm" 2>/dev/null &&
+			loger "Set ZRAM$1 comp_algorithm to $algorithm" ||
+			loger e "Failed to set ZRAM$1 comp_algorithm to $algorithm"
+	fi
+	if [ -n "$recomp" ] && [ "$recomp" != "none" ] && [ -f "$zram_sys/recomp_algorithm" ]; then
+		echo "algo=$recomp" >"$zram_sys/recomp_algorithm" 2>/dev/null &&
+			loger "Set ZRAM$1 recomp_algorithm to $recomp" ||
+			loger e "Failed to set ZRAM$1 recomp_algorithm to $recomp"
+	fi
+}
+
 # resize_zram - Resizes a ZRAM partition and prepares it for swapping
 # Usage: resize_zram <size> <zram_id>
 resize_zram() {
@@ -325,6 +270,7 @@ resize_zram() {
 
 	loger "Resizing ZRAM$zram_id to $size"
 	echo 1 >/sys/block/zram${zram_id}/use_dedup 2>/dev/null && loger "Enabled deduplication for ZRAM$zram_id"
+	set_zram_algorithm "$zram_id"
 	echo "$size" >/sys/block/zram${zram_id}/disksize 2>/dev/null && loger "Set ZRAM$zram_id size to $size"
 
 	for _ in $(seq 5); do
@@ -339,38 +285,6 @@ resize_zram() {
 	return 1
 }
 
-# get_memory_pressure - Calculates memory pressure as a percentage
-get_memory_pressure() {
-	local mem_usage=0 swap_usage=0 memsw_usage=1 memory_pressure=0
-
-	if [ -f /dev/memcg/memory.usage_in_bytes ]; then
-		mem_usage=$(cat /dev/memcg/memory.usage_in_bytes)
-	else
-		mem_usage=$(free -b | awk '/^Mem:/ { print $3 }')
-	fi
-
-	swap_usage=$(free -b | awk '/^Swap:/ { print $3 }')
-
-	if [ -f /dev/memcg/memory.memsw.usage_in_bytes ]; then
-		memsw_usage=$(cat /dev/memcg/memory.memsw.usage_in_bytes)
-	else
-		memsw_usage=$((mem_usage + swap_usage))
-	fi
-
-	if [ "$memsw_usage" -eq 0 ]; then
-		memory_pressure=0
-	else
-		memory_pressure=$(awk -v m="$mem_usage" -v t="$memsw_usage" \
-			'BEGIN { print int(m * 100 / t) }')
-	fi
-
-	if [ $memory_pressure -le 100 ] || [ $memory_pressure -ge 0 ]; then
-		echo "$memory_pressure"
-	else
-		echo error
-	fi
-}
-
 # apply_lmkd_props - Applies LMKD properties from files
 apply_lmkd_props() {
 	loger "Applying LMKD properties from $MODPATH/system.prop and $FOGIMP_PROPS"
@@ -389,141 +303,6 @@ turnon_zram() {
 	fi
 }
 
-# update_pressure_report - Updates the module.prop with current memory pressure
-last_memory_pressure=$(get_memory_pressure)
-
-update_pressure_report() {
-	local memory_pressure current_swappiness module_prop pressure_emoji swap_status
-
-	memory_pressure=$(get_memory_pressure)
-	module_prop="$MODPATH/module.prop"
-	current_swappiness=$(cat /proc/sys/vm/swappiness)
-	pressure_emoji="🟩"
-
-	if [ "$memory_pressure" -gt 80 ]; then
-		pressure_emoji="⚪"
-	elif [ "$memory_pressure" -gt 60 ]; then
-		pressure_emoji="🟩"
-	elif [ "$memory_pressure" -gt 40 ]; then
-		pressure_emoji="🟨"
-	else
-		pressure_emoji="🟥"
-	fi
-
-	# Assign emoji based on memory pressure
-	if [ $memory_pressure -ge $((last_memory_pressure + 5)) ] ||
-		[ $memory_pressure -le $((last_memory_pressure - 5)) ] && [ $memory_pressure != $last_memory_pressure ]; then
-		last_memory_pressure=$memory_pressure
-		if [ "$memory_pressure" -gt 80 ]; then
-			loger i "Sleek! It's (memory_pressure: $pressure_emoji $memory_pressure), got nothing in RAM huh?"
-		elif [ "$memory_pressure" -gt 60 ]; then
-			loger i "What expected, just normal usage (memory_pressure: $pressure_emoji $memory_pressure)"
-		elif [ "$memory_pressure" -gt 40 ]; then
-			loger i "I don't like potato (memory_pressure: $pressure_emoji $memory_pressure)"
-		else
-			loger i "Call for ambulance (memory_pressure: $pressure_emoji $memory_pressure)"
-		fi
-	fi
-
-	# Check if swap is active
-	if [ "$(wc -l </proc/swaps)" -gt 1 ]; then
-		swap_status="✅ Running"
-	else
-		swap_status="❌ Not Running"
-	fi
-
-	[ -z $(cat $module_prop) ] && cp $LOG_FOLDER/module.prop $module_prop
-
-	# Use sed to replace the values correctly
-	sed -i -E \
-		-e "s/(Memory pressure[^:]*: )[^,]+,/\1$pressure_emoji$memory_pressure,/" \
-		-e "s/(swappiness[^:]*: )[^,]+,/\1$current_swappiness,/" \
-		-e "s/(Swap Status[^:]*: )[^.]+/\1$swap_status/" "$module_prop"
-}
-
-pressure_reporter_service() {
-	set +x
-	exec 3>&-
-
-	while true; do
-		update_pressure_report
-		sleep 1
-	done &
-	new_pid=$!
-	save_pid "pressure_reporter" "$new_pid"
-	loger "pressure reporter PID $new_pid"
-}
-
-# archive_service - Starts a background service to archive files every 5 minutes
-# Usage: archive_service
-# Archives: Files in /data/adb/fmiop/* and /sdcard/Android/fmiop/* into tar.gz
-archive_service() {
-	local archive_dir="$FMIOP_DIR/archives"                   # Directory for archives
-	local source_dirs="/data/adb/fmiop /sdcard/Android/fmiop" # Directories to archive
-	local interval=300                                        # 5 minutes in seconds
-	local max_archives=5                                      # Maximum number of archives to keep
-	local timestamp archive_file
-	local last_dir
-	last_dir=$(pwd)
-
-	# Ensure archive directory exists
-	mkdir -p "$archive_dir" || {
-		loger e "Failed to create archive directory $archive_dir"
-	}
-	loger "Starting archive service for $source_dirs"
-	exec 3>&-
-	set +x
-
-	# Background loop to archive files
-	while true; do
-		# Generate timestamp for unique archive name
-		timestamp=$(date +%Y%m%d_%H%M%S)
-		archive_file="$archive_dir/fmiop_archive_$timestamp.tar.gz"
-
-		# Archive files from both directories
-		tmp_dir=/data/local/tmp/fmiop
-		mkdir -p $tmp_dir
-
-		cp -r /data/adb/fmiop/* "$tmp_dir/"
-		cp /sdcard/Android/fmiop/config.yaml "$tmp_dir/"
-
-		cd $last_dir || cd $MODPATH || {
-			loger "Failed to open $tmp_dir"
-			return
-		}
-		tar -czf "$archive_file" "$tmp_dir" || loger "Log archiving failed."
-		if [ $(check_file_size $archive_file) -eq 0 ]; then
-			loger "Log archiving failed. Size is 0."
-		fi
-		rm -rf "$tmp_dir"
-
-		# Check and limit the number of archives to max_archives (5)
-		local archive_count
-		archive_count=$(find "$archive_dir/fmiop_archive_"*.tar.gz 2>/dev/null | wc -l)
-		if [ "$archive_count" -gt "$max_archives" ]; then
-			exec 3>&1
-			set -x
-
-			# Remove the oldest archives until only 5 remain
-			local excess=$((archive_count - max_archives))
-			ls -t "$archive_dir/fmiop_archive_"*.tar.gz | tail -n "$excess" | while read -r old_archive; do
-				rm -f "$old_archive"
-
-				exec 3>&-
-				set +x
-			done
-		fi
-
-		# Wait 5 minutes
-		sleep "$interval"
-	done &
-
-	# Save PID of the background service
-	local pid=$!
-	save_pid "fmiop.archive_service.pid" "$pid"
-	loger "Archive service started with PID $pid, running every $((interval / 60)) minutes, limiting to $max_archives archives"
-}
-
 # Function to get key events
 get_key_event() {
 	local event_type="$1"
@@ -615,23 +394,29 @@ make_swap() {
 
 start_services() {
 	loger "===Main service started from here==="
-	pressure_reporter_service
 	$MODPATH/system/bin/dynv
 	loger "Started dyn_swap_service with PID $!"
 	pidof dynv || loger e "Failed to start dyn_swap_service"
 }
 
+# kill_dynv - Stops the dynv supervisor and its worker, waiting until the
+# single-instance lock is released so a new dynv can start right away
 kill_dynv() {
-	pid=$(read_pid dyn_swap_service)
-	kill -9 $pid && loger "Killed $id with PID $pid"
+	local pid i=0
+	pid=$(cat "$LOG_FOLDER/dynv.lock" 2>/dev/null)
+	# The pid stays in the file after a crash, make sure it's still dynv
+	grep -q dynv "/proc/$pid/cmdline" 2>/dev/null || return 1
+
+	kill $pid && loger "Killed dyn_swap_service with PID $pid"
+	while kill -0 $pid 2>/dev/null && [ $i -lt 50 ]; do
+		sleep 0.1
+		i=$((i + 1))
+	done
+	kill -0 $pid 2>/dev/null && kill -9 $pid
 }
 
 kill_services() {
-	services_target="dyn_swap_service pressure_reporter"
-	for id in $services_target; do
-		pid=$(read_pid $id)
-		kill -9 $pid && loger "Killed $id with PID $pid"
-	done
+	kill_dynv
 }
 
 magisk_ge() {
@@ -12,30 +12,12 @@ for pid in $(ps -ef | awk '/fmiop:V/ {print $2}'); do
 	kill -9 $pid
 done
 pkill -9 -f "logcat.*lmkd"
-lmkd_loger "$LOG_FOLDER/lmkd.log"
+
+# dynv captures, rotates and archives the logs itself
+if [ "$(read_config ".logging.enable" "true")" = "true" ]; then
+	resetprop ro.lmk.debug true
+	loger "Native log capture enabled."
+fi
 
 exec 3>&-
 set +x
-
-while true; do
-	pid=$(pidof dynv)
-	if [ -n "$pid" ]; then
-		exec 3>&1
-		set -x
-
-		logcat -v time fmiop:V '*:S' >>"$LOG_FOLDER/dynv.log" 2>&1
-
-		exec 3>&-
-		set +x
-	else
-		echo "Waiting for dynv to start..." >>"$LOG_FOLDER/fmiop.log"
-		sleep 5
-	fi
-done &
-new_pid=$!
-save_pid "fmiop.dynamic_swappiness_logger_keeper.pid" "$new_pid"
-
-loger_watcher "$LOG_FOLDER/*.log"
-loger "Started loger_watcher with PID $!"
-archive_service
-loger "Started archive_service with PID $!"
@@ -0,0 +1,329 @@
+import argparse
+import hashlib
+import json
+import os
+import shutil
+import signal
+import stat
+import statistics
+import subprocess
+import sys
+import time
+
+# Paths dynv uses when DYNV_ROOT is unset, keep in sync with dynv.cpp
+LOG_FOLDER = "/data/adb/fmiop"
+CONFIG = LOG_FOLDER + "/config.yaml"
+# Learned state and caches one run leaves for the next
+CARRY_OVER = [
+    LOG_FOLDER + "/dynv.state",
+    LOG_FOLDER + "/config.bin",
+    LOG_FOLDER + "/vm_knobs.boot",
+]
+# Knobs dynv drives, restored to their values from before the first run
+SYSCTLS = [
+    "/proc/sys/vm/swappiness",
+    "/proc/sys/vm/watermark_scale_factor",
+    "/proc/sys/vm/min_free_kbytes",
+    "/proc/sys/vm/compaction_proactiveness",
+    "/proc/sys/vm/page-cluster",
+    "/proc/sys/vm/vfs_cache_pressure",
+    "/sys/kernel/mm/lru_gen/min_ttl_ms",
+]
+SWAP_DIR = "/data/adb"
+ZRAM_DIR = "/dev/block"
+
+RESULTS_VERSION = 1
+
+# name: phases for tools/loadgen, sized from MemTotal in MB
+SCENARIOS = {
+    "anon_ramp": lambda mem: [
+        f"ramp:mb={mem * 1.1:.0f},seconds=30",
+        "idle:seconds=10",
+    ],
+    "app_launch": lambda mem: [
+        f"ramp:mb={mem * 0.8:.0f},seconds=15",
+        f"launch:count=20,mb={mem * 0.15:.0f},gap_ms=500,retouch_mb={mem * 0.05:.0f}",
+        "idle:seconds=5",
+    ],
+    "idle_recovery": lambda mem: [
+        f"ramp:mb={mem * 1.0:.0f},seconds=15",
+        "idle:seconds=60",
+        f"launch:count=5,mb={mem * 0.1:.0f},gap_ms=1000,retouch_mb={mem * 0.1:.0f}",
+    ],
+    "mixed_io": lambda mem: [
+        f"ramp:mb={mem * 0.7:.0f},seconds=10",
+        f"fileio:mb={mem * 0.5:.0f},seconds=30,retouch_mb=16",
+    ],
+}
+
+# Metrics where an increase is a regression, compared by `compare`
+HEADLINE = [
+    "touch.p50_ns",
+    "touch.p99_ns",
+    "retouch.p50_ns",
+    "retouch.p99_ns",
+    "major_faults",
+    "psi_some_ms",
+    "psi_full_ms",
+    "daemon_cpu_ms",
+]
+INFORMATIONAL = ["swap_in_mb_s", "swap_out_mb_s", "file_mb_s"]
+
+
+def sha256(path):
+    with open(path, "rb") as f:
+        return hashlib.sha256(f.read()).hexdigest()
+
+
+def mem_total_mb():
+    with open("/proc/meminfo") as f:
+        for line in f:
+            if line.startswith("MemTotal:"):
+                return int(line.split()[1]) // 1024
+    return 0
+
+
+def active_swaps():
+    with open("/proc/swaps") as f:
+        return [line.split()[0] for line in f.readlines()[1:]]
+
+
+def git_commit():
+    try:
+        return subprocess.run(
+            ["git", "rev-parse", "HEAD"],
+            cwd=os.path.dirname(os.path.abspath(__file__)),
+            capture_output=True,
+            text=True,
+            check=True,
+        ).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def prepare_devices():
+    """
+    Gives every zram device a node under /dev/block, where dynv looks for
+    them, and returns the swap devices dynv will manage.
+    """
+    os.makedirs(ZRAM_DIR, exist_ok=True)
+    for name in sorted(os.listdir("/sys/block")):
+        if not name.startswith("zram"):
+            continue
+        node = os.path.join(ZRAM_DIR, name)
+        if not os.path.exists(node):
+            with open(f"/sys/block/{name}/dev") as f:
+                major, minor = map(int, f.read().split(":"))
+            os.mknod(node, 0o600 | stat.S_IFBLK, os.makedev(major, minor))
+
+    devices = [os.path.join(ZRAM_DIR, n) for n in os.listdir(ZRAM_DIR) if "zram" in n]
+    devices += [os.path.join(SWAP_DIR, n) for n in os.listdir(SWAP_DIR) if "swap" in n]
+    return sorted(devices)
+
+
+def read_sysctls():
+    values = {}
+    for path in SYSCTLS:
+        try:
+            with open(path) as f:
+                values[path] = f.read().strip()
+        except OSError:
+            pass
+    return values
+
+
+def write_sysctls(values):
+    for path, value in values.items():
+        try:
+            with open(path, "w") as f:
+                f.write(value)
+        except OSError as e:
+            print(f"Cannot restore {path}: {e}", file=sys.stderr)
+
+
+def reset(devices, sysctls):
+    """Starts every run from the same state: module swaps off, no learned
+    state, VM knobs at their starting values, caches cold."""
+    for path in active_swaps():
+        if path in devices:
+            subprocess.run(["swapoff", path], check=False)
+    for path in CARRY_OVER:
+        if os.path.exists(path):
+            os.remove(path)
+    write_sysctls(sysctls)
+    subprocess.run(["sync"], check=False)
+    with open("/proc/sys/vm/drop_caches", "w") as f:
+        f.write("3")
+
+
+def run_once(args, phases, log):
+    """Runs one scenario against a fresh dynv and returns the loadgen report."""
+    env = dict(os.environ, DYNV_LOG="stderr")
+    env.pop("DYNV_ROOT", None)
+    daemon = subprocess.Popen([args.dynv, "--foreground"], env=env, stdout=log, stderr=log)
+
+    try:
+        time.sleep(args.settle)
+        if daemon.poll() is not None:
+            sys.exit(f"dynv exited during startup with {daemon.returncode}, see {log.name}")
+
+        loadgen = subprocess.run(
+            [args.loadgen, "--daemon-pid", str(daemon.pid), *phases],
+            capture_output=True,
+            text=True,
+        )
+    finally:
+        daemon.send_signal(signal.SIGINT)
+        try:
+            daemon.wait(timeout=10)
+        except subprocess.TimeoutExpired:
+            daemon.kill()
+            daemon.wait()
+
+    # A load generator killed by the OOM killer is a result, not an error
+    if loadgen.returncode != 0:
+        return {"failed": True, "returncode": loadgen.returncode, "stderr": loadgen.stderr}
+    return json.loads(loadgen.stdout)
+
+
+def flatten(values, prefix=""):
+    flat = {}
+    for key, value in values.items():
+        if isinstance(value, dict):
+            flat.update(flatten(value, f"{prefix}{key}."))
+        elif isinstance(value, (int, float)) and not isinstance(value, bool):
+            flat[prefix + key] = value
+    return flat
+
+
+def median_of(runs):
+    totals = [flatten(r["total"]) for r in runs if not r.get("failed")]
+    if not totals:
+        return {}
+    return {key: statistics.median(t[key] for t in totals) for key in totals[0]}
+
+
+def run(args):
+    if os.geteuid() != 0:
+        sys.exit("bench_suite needs root to manage swap")
+    if not os.path.exists("/proc/pressure/memory"):
+        sys.exit("Kernel has no PSI, boot with psi=1")
+
+    names = args.scenario or list(SCENARIOS)
+    unknown = [n for n in names if n not in SCENARIOS]
+    if unknown:
+        sys.exit(f"Unknown scenario: {', '.join(unknown)}")
+
+    mem = mem_total_mb()
+    os.makedirs(LOG_FOLDER, exist_ok=True)
+    backup = CONFIG + ".bench-backup"
+    if os.path.exists(CONFIG):
+        shutil.copy2(CONFIG, backup)
+    shutil.copy(args.config, CONFIG)
+    sysctls = read_sysctls()
+
+    results = {
+        "version": RESULTS_VERSION,
+        "time": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+        "commit": git_commit(),
+        "label": args.label,
+        "kernel": os.uname().release,
+        "mem_total_mb": mem,
+        "dynv_sha256": sha256(args.dynv),
+        "config_sha256": sha256(args.config),
+        "scenarios": {},
+    }
+
+    try:
+        devices = prepare_devices()
+        if not devices:
+            sys.exit(f"No zram device or swap file for dynv under {ZRAM_DIR} or {SWAP_DIR}")
+        results["devices"] = devices
+
+        with open(args.log, "a") as log:
+            for name in names:
+                phases = SCENARIOS[name](mem)
+                runs = []
+                for i in range(args.repeat):
+                    print(f"- {name} run {i + 1}/{args.repeat}", file=sys.stderr)
+                    reset(devices, sysctls)
+                    runs.append(run_once(args, phases, log))
+                results["scenarios"][name] = {
+                    "phases": phases,
+                    "runs": runs,
+                    "median": median_of(runs),
+                    "failed_runs": sum(1 for r in runs if r.get("failed")),
+                }
+    finally:
+        write_sysctls(sysctls)
+        if os.path.exists(backup):
+            shutil.move(backup, CONFIG)
+
+    output = json.dumps(results, indent=2)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(output + "\n")
+    else:
+        print(output)
+
+
+def compare(args):
+    with open(args.base) as f:
+        base = json.load(f)
+    with open(args.new) as f:
+        new = json.load(f)
+
+    regressions = 0
+    print(f"{'scenario':<15} {'metric':<16} {'base':>12} {'new':>12} {'change':>8}")
+    for name, scenario in base["scenarios"].items():
+        if name not in new["scenarios"]:
+            continue
+        before, after = scenario["median"], new["scenarios"][name]["median"]
+        for key in HEADLINE + INFORMATIONAL:
+            if key not in before or key not in after:
+                continue
+            change = (after[key] - before[key]) / before[key] * 100 if before[key] else 0.0
+            regressed = key in HEADLINE and change > args.threshold
+            regressions += regressed
+            print(
+                f"{name:<15} {key:<16} {before[key]:>12.1f} {after[key]:>12.1f} "
+                f"{change:>+7.1f}%{' REGRESSION' if regressed else ''}"
+            )
+
+    sys.exit(1 if regressions else 0)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Run memory pressure workloads against dynv on a Linux VM and record results."
+    )
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    run_parser = commands.add_parser("run", help="Run the scenarios and write JSON results")
+    run_parser.add_argument("--dynv", default="build/dynv-host", help="dynv binary to test")
+    run_parser.add_argument("--loadgen", default="build/loadgen", help="tools/loadgen binary")
+    run_parser.add_argument("--config", default="config.yaml", help="Config to run dynv with")
+    run_parser.add_argument(
+        "--scenario", action="append", help=f"Scenario to run, default all: {', '.join(SCENARIOS)}"
+    )
+    run_parser.add_argument("--repeat", type=int, default=3, help="Runs per scenario")
+    run_parser.add_argument("--settle", type=float, default=5, help="Seconds to let dynv start")
+    run_parser.add_argument("--label", help="Free text stored with the results")
+    run_parser.add_argument("--log", default="bench_dynv.log", help="Where dynv logs go")
+    run_parser.add_argument("--output", help="Results file, default stdout")
+    run_parser.set_defaults(func=run)
+
+    compare_parser = commands.add_parser("compare", help="Compare medians of two result files")
+    compare_parser.add_argument("base")
+    compare_parser.add_argument("new")
+    compare_parser.add_argument(
+        "--threshold", type=float, default=10, help="Percent increase reported as a regression"
+    )
+    compare_parser.set_defaults(func=compare)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
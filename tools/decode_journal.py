@@ -0,0 +1,149 @@
+import argparse
+import csv
+import json
+import struct
+import sys
+import time
+
+# Layout of /data/adb/fmiop/dynv.journal, keep in sync with Journal in dynv.cpp
+JOURNAL_MAGIC = 0x524A4D46  # "FMJR"
+HEADER = struct.Struct("<IHHII Q 40x")
+RECORDS = {
+    # version: (struct, field names)
+    1: (struct.Struct("<Q q HH iii"), ("seq", "time_ms", "type", "flags", "a", "b", "c")),
+}
+
+TIERS = {0: "zram", 1: "backing", 2: "file"}
+VM_KNOBS = [
+    "watermark_scale_factor",
+    "min_free_kbytes",
+    "compaction_proactiveness",
+    "page-cluster",
+    "vfs_cache_pressure",
+    "min_ttl_ms",
+]
+
+
+def pressure(value):
+    """Journal pressures are stored as percentage * 100, -1 when unavailable."""
+    return None if value < 0 else value / 100
+
+
+def device(record):
+    return {"tier": TIERS.get(record["a"], record["a"]), "number": record["b"]}
+
+
+def tick_flags(flags):
+    return {
+        "sleep": bool(flags & 1),
+        "swapoff_session": bool(flags & 2),
+        "psi_invalid": bool(flags & 4),
+    }
+
+
+def failed(flags):
+    return {"failed": bool(flags & 1)}
+
+
+# type: (name, decoder returning the type specific fields)
+TYPES = {
+    1: ("start", lambda r: {"pid": r["a"], "config_version": r["b"] / 100}),
+    2: (
+        "tick",
+        lambda r: {
+            "cpu": pressure(r["a"]),
+            "memory": pressure(r["b"]),
+            "io": pressure(r["c"]),
+            **tick_flags(r["flags"]),
+        },
+    ),
+    3: ("swap_summary", lambda r: {"active": r["a"], "used_mb": r["b"], "size_mb": r["c"]}),
+    4: ("swappiness", lambda r: {"value": r["a"], "previous": r["b"]}),
+    5: ("swapon", lambda r: {**device(r), "priority": r["c"], **failed(r["flags"])}),
+    6: ("swapoff", lambda r: {**device(r), "used_mb": r["c"]}),
+    7: ("swapoff_done", lambda r: {**device(r), **failed(r["flags"])}),
+    8: ("timer_start", lambda r: {"timeout": r["a"]}),
+    9: ("timer_cancel", lambda r: {}),
+    10: ("timer_fire", lambda r: {}),
+    11: (
+        "vm_knob",
+        lambda r: {
+            "knob": VM_KNOBS[r["a"]] if 0 <= r["a"] < len(VM_KNOBS) else r["a"],
+            "value": r["b"],
+        },
+    ),
+    12: ("reclaim", lambda r: {"pages": r["a"]}),
+    13: (
+        "zram_resize",
+        lambda r: {"number": r["a"], "old_mb": r["b"], "new_mb": r["c"], **failed(r["flags"])},
+    ),
+    14: ("damon", lambda r: {"cold_mb": r["a"], "monitored_mb": r["b"], "paged_out_mb": r["c"]}),
+    15: ("working_set", lambda r: {"working_set_mb": r["a"], "idle_anon_mb": r["b"], "zram_needed": r["c"]}),
+    16: ("profile", lambda r: {"profile": r["a"], "latency_us": r["b"], "uid": r["c"]}),
+}
+
+
+def read_journal(path):
+    """Reads every valid record of a journal, oldest first."""
+    with open(path, "rb") as f:
+        data = f.read()
+
+    magic, version, record_size, capacity, _, next_seq = HEADER.unpack_from(data)
+    if magic != JOURNAL_MAGIC:
+        sys.exit(f"{path}: not a dynv journal")
+    if version not in RECORDS:
+        sys.exit(f"{path}: unsupported journal version {version}")
+
+    record_struct, names = RECORDS[version]
+    records = []
+    oldest = max(next_seq - capacity, 1)
+
+    for slot in range(capacity):
+        offset = HEADER.size + slot * record_size
+        record = dict(zip(names, record_struct.unpack_from(data, offset)))
+
+        # A slot is only valid for the sequence of the last lap that maps to
+        # it; 0 marks a record that was being written
+        if not oldest <= record["seq"] < next_seq or (record["seq"] - 1) % capacity != slot:
+            continue
+        records.append(record)
+
+    records.sort(key=lambda r: r["seq"])
+    return records
+
+
+def decode(record):
+    name, fields = TYPES.get(record["type"], (f"unknown_{record['type']}", lambda r: {}))
+    return {
+        "seq": record["seq"],
+        "time": time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(record["time_ms"] / 1000))
+        + f".{record['time_ms'] % 1000:03d}",
+        "type": name,
+        **fields(record),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a dynv flight recorder journal.")
+    parser.add_argument("journal", help="Path to dynv.journal, or a dynv.journal.v<N> kept from an older layout")
+    parser.add_argument("--json", action="store_true", help="Output JSON lines instead of CSV")
+    args = parser.parse_args()
+
+    rows = [decode(r) for r in read_journal(args.journal)]
+
+    if args.json:
+        for row in rows:
+            print(json.dumps(row, ensure_ascii=False))
+        return
+
+    columns = ["seq", "time", "type"]
+    for row in rows:
+        columns += [key for key in row if key not in columns]
+
+    writer = csv.DictWriter(sys.stdout, fieldnames=columns)
+    writer.writeheader()
+    writer.writerows(rows)
+
+
+if __name__ == "__main__":
+    main()
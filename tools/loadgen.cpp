@@ -0,0 +1,486 @@
+/**
+ * Memory pressure load generator for comparing dynv configs and versions.
+ *
+ * Runs a list of phases in order and prints one JSON document with, per
+ * phase: page touch latency percentiles, major faults, swap throughput, the
+ * memory PSI integral and the CPU time dynv spent meanwhile.
+ *
+ * Phases (sizes are MB, times are seconds unless noted):
+ *   ramp:mb=2048,seconds=30              allocate and touch anonymous memory
+ *   launch:count=20,mb=256,gap_ms=500,retouch_mb=64
+ *                                        app launch like bursts: fresh pages
+ *                                        plus a re-touch of held memory
+ *   idle:seconds=30                      do nothing, let the daemon react
+ *   fileio:mb=512,seconds=30,dir=/tmp    write and read back a file while
+ *                                        re-touching held memory
+ *
+ * Memory allocated by ramp phases is held until the run ends, so later
+ * phases run against it. tools/bench_suite.py drives this against dynv.
+ *
+ * Build: g++ -std=c++17 -O2 -o build/loadgen tools/loadgen.cpp
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace chrono;
+
+static const size_t PAGE = sysconf(_SC_PAGESIZE);
+
+/**
+ * Log-linear latency histogram, 16 buckets per power of two. Percentiles are
+ * within ~6% and recording never allocates, which matters while the machine
+ * is swapping.
+ */
+class LatencyHistogram {
+ public:
+  void record(uint64_t ns) {
+    buckets[bucket(ns)]++;
+    count++;
+    total_ns += ns;
+    max_ns = max(max_ns, ns);
+  }
+
+  void merge(const LatencyHistogram &other) {
+    for (size_t i = 0; i < buckets.size(); i++) buckets[i] += other.buckets[i];
+    count += other.count;
+    total_ns += other.total_ns;
+    max_ns = max(max_ns, other.max_ns);
+  }
+
+  uint64_t percentile(double p) const {
+    if (count == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * (count - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+      seen += buckets[i];
+      if (seen >= rank) return min(upper_bound(i), max_ns);
+    }
+    return max_ns;
+  }
+
+  void to_json(FILE *out) const {
+    fprintf(out,
+            "{\"count\": %" PRIu64 ", \"mean_ns\": %" PRIu64
+            ", \"p50_ns\": %" PRIu64 ", \"p90_ns\": %" PRIu64
+            ", \"p99_ns\": %" PRIu64 ", \"p999_ns\": %" PRIu64
+            ", \"max_ns\": %" PRIu64 "}",
+            count, count ? total_ns / count : 0, percentile(50),
+            percentile(90), percentile(99), percentile(99.9), max_ns);
+  }
+
+ private:
+  static constexpr int SUB_BITS = 4;
+  array<uint64_t, 64 << SUB_BITS> buckets{};
+  uint64_t count = 0, total_ns = 0, max_ns = 0;
+
+  static size_t bucket(uint64_t ns) {
+    if (ns < (1u << SUB_BITS)) return ns;
+    int exp = 63 - __builtin_clzll(ns);
+    uint64_t sub = (ns >> (exp - SUB_BITS)) & ((1u << SUB_BITS) - 1);
+    return ((exp - SUB_BITS + 1) << SUB_BITS) + sub;
+  }
+
+  static uint64_t upper_bound(size_t index) {
+    if (index < (1u << SUB_BITS)) return index;
+    int exp = (index >> SUB_BITS) + SUB_BITS - 1;
+    uint64_t sub = index & ((1u << SUB_BITS) - 1);
+    return ((1ull << exp) | ((sub + 1) << (exp - SUB_BITS))) - 1;
+  }
+};
+
+/**
+ * System and daemon counters sampled at phase boundaries.
+ */
+struct Counters {
+  uint64_t major_faults = 0;      // This process
+  uint64_t pgmajfault = 0;        // System wide, /proc/vmstat
+  uint64_t pswpin = 0, pswpout = 0;
+  uint64_t psi_some_us = 0, psi_full_us = 0;
+  uint64_t daemon_cpu_ticks = 0;  // utime + stime + reaped children
+  steady_clock::time_point time;
+
+  static Counters read(pid_t daemon) {
+    Counters c;
+    c.time = steady_clock::now();
+
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    c.major_faults = usage.ru_majflt;
+
+    char line[256];
+    if (FILE *f = fopen("/proc/vmstat", "r")) {
+      char key[64];
+      unsigned long long value;
+      while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%63s %llu", key, &value) != 2) continue;
+        if (!strcmp(key, "pgmajfault")) c.pgmajfault = value;
+        else if (!strcmp(key, "pswpin")) c.pswpin = value;
+        else if (!strcmp(key, "pswpout")) c.pswpout = value;
+      }
+      fclose(f);
+    }
+
+    if (FILE *f = fopen("/proc/pressure/memory", "r")) {
+      unsigned long long total;
+      while (fgets(line, sizeof(line), f)) {
+        const char *p = strstr(line, "total=");
+        if (!p || sscanf(p, "total=%llu", &total) != 1) continue;
+        if (!strncmp(line, "some", 4)) c.psi_some_us = total;
+        else if (!strncmp(line, "full", 4)) c.psi_full_us = total;
+      }
+      fclose(f);
+    }
+
+    if (daemon > 0) c.daemon_cpu_ticks = daemon_ticks(daemon);
+    return c;
+  }
+
+ private:
+  static uint64_t daemon_ticks(pid_t pid) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+
+    // comm may hold spaces, fields are counted from the closing paren
+    const char *p = strrchr(buf, ')');
+    if (!p) return 0;
+    unsigned long long utime, stime;
+    long long cutime, cstime;
+    if (sscanf(p + 2,
+               "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %lld "
+               "%lld",
+               &utime, &stime, &cutime, &cstime) != 4)
+      return 0;
+    return utime + stime + cutime + cstime;
+  }
+};
+
+struct Phase {
+  string kind;
+  map<string, string> args;
+
+  double num(const string &key, double fallback) const {
+    auto it = args.find(key);
+    return it == args.end() ? fallback : atof(it->second.c_str());
+  }
+  string str(const string &key, const string &fallback) const {
+    auto it = args.find(key);
+    return it == args.end() ? fallback : it->second;
+  }
+};
+
+/**
+ * Parses "kind:key=value,key=value".
+ */
+static bool parse_phase(const string &spec, Phase &phase) {
+  size_t colon = spec.find(':');
+  phase.kind = spec.substr(0, colon);
+  if (colon == string::npos) return true;
+
+  size_t pos = colon + 1;
+  while (pos < spec.size()) {
+    size_t end = spec.find(',', pos);
+    if (end == string::npos) end = spec.size();
+    string item = spec.substr(pos, end - pos);
+    size_t eq = item.find('=');
+    if (eq == string::npos) return false;
+    phase.args[item.substr(0, eq)] = item.substr(eq + 1);
+    pos = end + 1;
+  }
+  return true;
+}
+
+/**
+ * Anonymous memory filled like app heaps: compressible but not zero, so
+ * zram does real work instead of storing same-filled pages.
+ */
+class Region {
+ public:
+  explicit Region(size_t bytes) : size(bytes / PAGE * PAGE) {
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    base = p == MAP_FAILED ? nullptr : static_cast<uint8_t *>(p);
+  }
+  ~Region() {
+    if (base) munmap(base, size);
+  }
+  Region(const Region &) = delete;
+  Region &operator=(const Region &) = delete;
+
+  bool ok() const { return base != nullptr; }
+  size_t pages() const { return size / PAGE; }
+
+  /**
+   * First touch of one page, timing only the fault.
+   */
+  void touch(size_t page, LatencyHistogram &latency, uint64_t &seed) {
+    uint8_t *p = base + page * PAGE;
+    auto start = steady_clock::now();
+    *p = 1;
+    latency.record(duration_cast<nanoseconds>(steady_clock::now() - start)
+                       .count());
+
+    // One random word per 64 bytes, the rest repeats: roughly 3:1 in lz4
+    uint64_t *words = reinterpret_cast<uint64_t *>(p);
+    for (size_t i = 0; i < PAGE / 8; i++) {
+      words[i] = i % 8 == 0 ? next(seed) : page ^ (i % 8);
+    }
+  }
+
+  /**
+   * Reads one byte of an already touched page, which faults it back in
+   * when it was swapped out.
+   */
+  void retouch(size_t page, LatencyHistogram &latency) {
+    volatile uint8_t *p = base + page * PAGE;
+    auto start = steady_clock::now();
+    (void)*p;
+    latency.record(duration_cast<nanoseconds>(steady_clock::now() - start)
+                       .count());
+  }
+
+  static uint64_t next(uint64_t &seed) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+  }
+
+ private:
+  uint8_t *base = nullptr;
+  size_t size = 0;
+};
+
+struct PhaseResult {
+  LatencyHistogram touch, retouch;
+  uint64_t file_bytes = 0;
+};
+
+class LoadGenerator {
+ public:
+  explicit LoadGenerator(pid_t daemon) : daemon(daemon) {}
+
+  void run(const vector<Phase> &phases, FILE *out) {
+    fprintf(out, "{\"page_size\": %zu, \"clock_ticks\": %ld, \"phases\": [",
+            PAGE, sysconf(_SC_CLK_TCK));
+
+    Counters first = Counters::read(daemon);
+    Counters before = first;
+    for (size_t i = 0; i < phases.size(); i++) {
+      PhaseResult result;
+      execute(phases[i], result);
+      Counters after = Counters::read(daemon);
+
+      fprintf(out, "%s\n  {\"kind\": \"%s\", ", i ? "," : "",
+              phases[i].kind.c_str());
+      report(result, before, after, out);
+      fprintf(out, "}");
+      before = after;
+    }
+
+    fprintf(out, "\n], \"total\": {");
+    report(total, first, before, out);
+    fprintf(out, "}}\n");
+  }
+
+ private:
+  pid_t daemon;
+  vector<unique_ptr<Region>> held;
+  PhaseResult total;
+  uint64_t seed = 0x9E3779B97F4A7C15ull;
+
+  void execute(const Phase &phase, PhaseResult &result) {
+    if (phase.kind == "ramp") {
+      ramp(phase, result);
+    } else if (phase.kind == "launch") {
+      launch(phase, result);
+    } else if (phase.kind == "idle") {
+      this_thread::sleep_for(
+          milliseconds(static_cast<long>(phase.num("seconds", 10) * 1000)));
+    } else if (phase.kind == "fileio") {
+      fileio(phase, result);
+    }
+  }
+
+  static size_t mb_to_bytes(double mb) {
+    return static_cast<size_t>(mb * 1024 * 1024);
+  }
+
+  /**
+   * Allocates in 4 MB steps spread evenly over the phase.
+   */
+  void ramp(const Phase &phase, PhaseResult &result) {
+    const size_t step = mb_to_bytes(4);
+    size_t bytes = mb_to_bytes(phase.num("mb", 1024));
+    size_t steps = max<size_t>(1, bytes / step);
+    auto interval = duration<double>(phase.num("seconds", 30) / steps);
+    auto start = steady_clock::now();
+
+    for (size_t s = 0; s < steps; s++) {
+      auto region = make_unique<Region>(step);
+      if (!region->ok()) break;
+      for (size_t p = 0; p < region->pages(); p++) {
+        region->touch(p, result.touch, seed);
+      }
+      held.push_back(move(region));
+      this_thread::sleep_until(
+          start + duration_cast<steady_clock::duration>(interval * (s + 1)));
+    }
+    merge(result);
+  }
+
+  /**
+   * Re-touches random pages of held memory, as an app brought back to the
+   * foreground would.
+   */
+  void retouch_held(size_t bytes, PhaseResult &result) {
+    if (held.empty()) return;
+    size_t pages = bytes / PAGE;
+    for (size_t i = 0; i < pages; i++) {
+      Region &region = *held[Region::next(seed) % held.size()];
+      region.retouch(Region::next(seed) % region.pages(), result.retouch);
+    }
+  }
+
+  void launch(const Phase &phase, PhaseResult &result) {
+    int count = static_cast<int>(phase.num("count", 10));
+    size_t bytes = mb_to_bytes(phase.num("mb", 256));
+    size_t retouch = mb_to_bytes(phase.num("retouch_mb", 64));
+    auto gap = milliseconds(static_cast<long>(phase.num("gap_ms", 1000)));
+
+    for (int i = 0; i < count; i++) {
+      {
+        Region app(bytes);
+        if (app.ok()) {
+          for (size_t p = 0; p < app.pages(); p++) {
+            app.touch(p, result.touch, seed);
+          }
+        }
+        retouch_held(retouch, result);
+      }  // The app goes away
+      this_thread::sleep_for(gap);
+    }
+    merge(result);
+  }
+
+  void fileio(const Phase &phase, PhaseResult &result) {
+    string path = phase.str("dir", "/tmp") + "/loadgen.XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0) {
+      perror("mkstemp");
+      return;
+    }
+    unlink(path.c_str());
+
+    size_t bytes = mb_to_bytes(phase.num("mb", 512));
+    size_t retouch = mb_to_bytes(phase.num("retouch_mb", 16));
+    auto end = steady_clock::now() +
+               milliseconds(static_cast<long>(phase.num("seconds", 30) * 1000));
+    vector<char> buffer(1 << 20);
+    for (size_t i = 0; i < buffer.size(); i++) buffer[i] = "fmiop"[i % 5];
+
+    while (steady_clock::now() < end) {
+      lseek(fd, 0, SEEK_SET);
+      for (size_t done = 0; done < bytes && steady_clock::now() < end;) {
+        ssize_t n = write(fd, buffer.data(), buffer.size());
+        if (n <= 0) break;
+        done += n;
+        result.file_bytes += n;
+      }
+      lseek(fd, 0, SEEK_SET);
+      for (ssize_t n; (n = read(fd, buffer.data(), buffer.size())) > 0;) {
+        result.file_bytes += n;
+      }
+      retouch_held(retouch, result);
+    }
+    close(fd);
+    merge(result);
+  }
+
+  void merge(const PhaseResult &result) {
+    total.touch.merge(result.touch);
+    total.retouch.merge(result.retouch);
+    total.file_bytes += result.file_bytes;
+  }
+
+  static void report(const PhaseResult &result, const Counters &before,
+                     const Counters &after, FILE *out) {
+    double seconds = duration<double>(after.time - before.time).count();
+    double mb_per_page = static_cast<double>(PAGE) / (1024 * 1024);
+    double ticks = sysconf(_SC_CLK_TCK);
+
+    fprintf(out, "\"seconds\": %.3f, \"touch\": ", seconds);
+    result.touch.to_json(out);
+    fprintf(out, ", \"retouch\": ");
+    result.retouch.to_json(out);
+    fprintf(out,
+            ", \"major_faults\": %" PRIu64 ", \"system_major_faults\": %" PRIu64
+            ", \"swap_in_mb_s\": %.3f, \"swap_out_mb_s\": %.3f"
+            ", \"psi_some_ms\": %.3f, \"psi_full_ms\": %.3f"
+            ", \"daemon_cpu_ms\": %.1f, \"file_mb_s\": %.3f",
+            after.major_faults - before.major_faults,
+            after.pgmajfault - before.pgmajfault,
+            (after.pswpin - before.pswpin) * mb_per_page / seconds,
+            (after.pswpout - before.pswpout) * mb_per_page / seconds,
+            (after.psi_some_us - before.psi_some_us) / 1000.0,
+            (after.psi_full_us - before.psi_full_us) / 1000.0,
+            (after.daemon_cpu_ticks - before.daemon_cpu_ticks) * 1000.0 / ticks,
+            result.file_bytes / (1024.0 * 1024.0) / seconds);
+  }
+};
+
+int main(int argc, char *argv[]) {
+  pid_t daemon = 0;
+  vector<Phase> phases;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--daemon-pid" && i + 1 < argc) {
+      daemon = atoi(argv[++i]);
+      continue;
+    }
+    Phase phase;
+    if (!parse_phase(arg, phase) ||
+        (phase.kind != "ramp" && phase.kind != "launch" &&
+         phase.kind != "idle" && phase.kind != "fileio")) {
+      fprintf(stderr, "Invalid phase: %s\n", arg.c_str());
+      return 1;
+    }
+    phases.push_back(phase);
+  }
+
+  if (phases.empty()) {
+    fprintf(stderr,
+            "Usage: %s [--daemon-pid PID] PHASE...\n"
+            "  ramp:mb=N,seconds=N\n"
+            "  launch:count=N,mb=N,gap_ms=N,retouch_mb=N\n"
+            "  idle:seconds=N\n"
+            "  fileio:mb=N,seconds=N,dir=PATH,retouch_mb=N\n",
+            argv[0]);
+    return 1;
+  }
+
+  LoadGenerator(daemon).run(phases, stdout);
+  return 0;
+}